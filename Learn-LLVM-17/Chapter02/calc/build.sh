@@ -6,3 +6,6 @@ make
 ./src/calc "with a, b: a*3+b*2" | llc -filetype=obj -relocation-model=pic -o expr.o
 clang -o expr expr.o ../rtcalc.c
 ./expr
+./src/calc -batch "with a, b: a*3+b*2" > batch.ll
+clang -O2 -o batch batch.ll ../rtcalc_batch.c
+printf 'a,b\n1,2\n3,4\n' | ./batch
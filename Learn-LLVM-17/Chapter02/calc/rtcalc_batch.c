@@ -0,0 +1,232 @@
+/* Runtime for expressions compiled with calc -batch.
+ *
+ *   expr [file.csv]
+ *   expr -b col1.bin col2.bin ...
+ *
+ * CSV input has one row per line with one integer per
+ * variable of the with clause, separated by commas. A
+ * first line which does not start with a number is a
+ * header and is skipped. The results are printed one per
+ * line.
+ *
+ * With -b, each variable is read from its own file of raw
+ * int32 values in native byte order, in the order of the
+ * with clause. The results are written to stdout in the
+ * same format.
+ *
+ * Rows are passed to calc_batch() in blocks of BLOCK_ROWS.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern const int32_t calc_batch_cols;
+void calc_batch(const int32_t **cols, int32_t *out, size_t n);
+
+enum { BLOCK_ROWS = 64 * 1024 };
+
+static void fail(const char *msg, const char *arg)
+{
+  fprintf(stderr, "%s%s\n", msg, arg);
+  exit(1);
+}
+
+/* Buffered reader for the CSV input. */
+struct reader {
+  FILE *f;
+  size_t pos, len;
+  unsigned long line;
+  char buf[1 << 16];
+};
+
+static int peek(struct reader *r)
+{
+  if (r->pos == r->len) {
+    r->len = fread(r->buf, 1, sizeof(r->buf), r->f);
+    r->pos = 0;
+    if (r->len == 0)
+      return EOF;
+  }
+  return (unsigned char)r->buf[r->pos];
+}
+
+static int skip_blanks(struct reader *r)
+{
+  int c = peek(r);
+  while (c == ' ' || c == '\t' || c == '\r') {
+    ++r->pos;
+    c = peek(r);
+  }
+  return c;
+}
+
+static void skip_line(struct reader *r)
+{
+  int c = peek(r);
+  while (c != EOF && c != '\n') {
+    ++r->pos;
+    c = peek(r);
+  }
+  if (c == '\n')
+    ++r->pos;
+  ++r->line;
+}
+
+static void parse_error(struct reader *r, const char *msg)
+{
+  fprintf(stderr, "line %lu: %s\n", r->line, msg);
+  exit(1);
+}
+
+/* Reads the next row into cols[..][row]. Returns 0 at the
+   end of the input. */
+static int read_row(struct reader *r, int32_t **cols,
+                    int ncols, size_t row)
+{
+  int c = skip_blanks(r);
+  /* Without variables every line is a row. */
+  while (ncols > 0 && c == '\n') {
+    skip_line(r);
+    c = skip_blanks(r);
+  }
+  if (c == EOF)
+    return 0;
+  for (int i = 0; i < ncols; ++i) {
+    int neg = 0;
+    uint32_t val = 0;
+    if (i > 0) {
+      if (c != ',')
+        parse_error(r, "',' expected");
+      ++r->pos;
+      c = skip_blanks(r);
+    }
+    if (c == '-' || c == '+') {
+      neg = c == '-';
+      ++r->pos;
+      c = peek(r);
+    }
+    if (c < '0' || c > '9')
+      parse_error(r, "number expected");
+    do {
+      val = val * 10 + (uint32_t)(c - '0');
+      ++r->pos;
+      c = peek(r);
+    } while (c >= '0' && c <= '9');
+    cols[i][row] = (int32_t)(neg ? 0u - val : val);
+    c = skip_blanks(r);
+  }
+  if (ncols > 0 && c != '\n' && c != EOF)
+    parse_error(r, "end of line expected");
+  skip_line(r);
+  return 1;
+}
+
+static char *format_int(char *p, int32_t v)
+{
+  char tmp[12];
+  int len = 0;
+  uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+  do {
+    tmp[len++] = (char)('0' + u % 10);
+    u /= 10;
+  } while (u);
+  if (v < 0)
+    *p++ = '-';
+  while (len)
+    *p++ = tmp[--len];
+  *p++ = '\n';
+  return p;
+}
+
+static void write_text(const int32_t *out, size_t n)
+{
+  static char buf[BLOCK_ROWS * 12];
+  char *p = buf;
+  for (size_t i = 0; i < n; ++i)
+    p = format_int(p, out[i]);
+  fwrite(buf, 1, (size_t)(p - buf), stdout);
+}
+
+static void run_csv(FILE *f, int32_t **cols, int ncols,
+                    int32_t *out)
+{
+  static struct reader r;
+  size_t n;
+  int c;
+  r.f = f;
+  r.line = 1;
+  c = skip_blanks(&r);
+  if (c != EOF && c != '\n' && c != '-' && c != '+' &&
+      (c < '0' || c > '9'))
+    skip_line(&r);
+  do {
+    n = 0;
+    while (n < BLOCK_ROWS && read_row(&r, cols, ncols, n))
+      ++n;
+    if (n) {
+      calc_batch((const int32_t **)cols, out, n);
+      write_text(out, n);
+    }
+  } while (n == BLOCK_ROWS);
+}
+
+static void run_binary(FILE **files, int32_t **cols,
+                       int ncols, int32_t *out)
+{
+  size_t n;
+  do {
+    n = BLOCK_ROWS;
+    for (int i = 0; i < ncols; ++i) {
+      size_t got = fread(cols[i], sizeof(int32_t), n,
+                         files[i]);
+      if (i > 0 && got != n)
+        fail("Column files differ in length", "");
+      n = got;
+    }
+    if (n) {
+      calc_batch((const int32_t **)cols, out, n);
+      fwrite(out, sizeof(int32_t), n, stdout);
+    }
+  } while (n == BLOCK_ROWS);
+  /* All columns must be exhausted together. */
+  for (int i = 1; i < ncols; ++i)
+    if (fgetc(files[i]) != EOF)
+      fail("Column files differ in length", "");
+}
+
+int main(int argc, char **argv)
+{
+  int ncols = calc_batch_cols;
+  int32_t **cols = malloc((ncols + 1) * sizeof(int32_t *));
+  int32_t *out = malloc(BLOCK_ROWS * sizeof(int32_t));
+  if (!cols || !out)
+    fail("Out of memory", "");
+  for (int i = 0; i < ncols; ++i) {
+    cols[i] = malloc(BLOCK_ROWS * sizeof(int32_t));
+    if (!cols[i])
+      fail("Out of memory", "");
+  }
+
+  if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+    FILE **files = malloc((ncols + 1) * sizeof(FILE *));
+    if (argc - 2 != ncols) {
+      fprintf(stderr, "Expected %d column files\n", ncols);
+      return 1;
+    }
+    if (ncols == 0)
+      fail("-b needs at least one variable", "");
+    for (int i = 0; i < ncols; ++i) {
+      files[i] = fopen(argv[i + 2], "rb");
+      if (!files[i])
+        fail("Cannot open ", argv[i + 2]);
+    }
+    run_binary(files, cols, ncols, out);
+  } else {
+    FILE *f = stdin;
+    if (argc > 1 && !(f = fopen(argv[1], "r")))
+      fail("Cannot open ", argv[1]);
+    run_csv(f, cols, ncols, out);
+  }
+  return 0;
+}
@@ -11,6 +11,13 @@ static llvm::cl::opt<std::string>
           llvm::cl::desc("<input expression>"),
           llvm::cl::init(""));
 
+// Declare a command-line tool option to emit a kernel over
+// arrays of inputs instead of main()
+static llvm::cl::opt<bool>
+    Batch("batch",
+          llvm::cl::desc("Emit calc_batch(cols, out, n) "
+                         "for use with rtcalc_batch.c"));
+
 int main(int argc, const char **argv) {
   llvm::InitLLVM X(argc, argv);
   llvm::cl::ParseCommandLineOptions(
@@ -29,6 +36,6 @@ int main(int argc, const char **argv) {
     return 1;
   }
   CodeGen CodeGenerator;
-  CodeGenerator.compile(Tree);
+  CodeGenerator.compile(Tree, Batch);
   return 0;
 }
\ No newline at end of file
@@ -19,6 +19,14 @@ class ToIRVisitor : public ASTVisitor {
   Value *V;
   StringMap<Value *> nameMap;
 
+  // Only set while generating calc_batch(): the array of
+  // column pointers, the row index of the current loop
+  // iteration and the block where the columns are loaded.
+  Value *Cols = nullptr;
+  Value *Index = nullptr;
+  BasicBlock *EntryBB = nullptr;
+  unsigned NumCols = 0;
+
 public:
   ToIRVisitor(Module *M) : M(M), Builder(M->getContext()) {
     VoidTy = Type::getVoidTy(M->getContext());
@@ -49,6 +57,71 @@ public:
     Builder.CreateRet(Int32Zero);  // Return 0 from the main function
   }
 
+  // Generates the kernel
+  //   void calc_batch(const int32_t **cols, int32_t *out,
+  //                   size_t n)
+  // which evaluates the expression for n rows. The value
+  // of the i-th variable in row r is cols[i][r]. The loop
+  // has no calls, so the optimizer can vectorize it.
+  void runBatch(AST *Tree) {
+    Type *SizeTy = M->getDataLayout().getIntPtrType(
+        M->getContext());
+    FunctionType *BatchFty = FunctionType::get(
+        VoidTy, {PtrTy, PtrTy, SizeTy}, false);
+    Function *BatchFn = Function::Create(
+        BatchFty, GlobalValue::ExternalLinkage,
+        "calc_batch", M);
+    BatchFn->addFnAttr(Attribute::NoUnwind);
+    // The result array never overlaps the inputs.
+    for (unsigned I = 0; I < 2; ++I)
+      BatchFn->addParamAttr(I, Attribute::NoCapture);
+    BatchFn->addParamAttr(0, Attribute::ReadOnly);
+    BatchFn->addParamAttr(1, Attribute::NoAlias);
+    Cols = BatchFn->getArg(0);
+    Value *Out = BatchFn->getArg(1);
+    Value *N = BatchFn->getArg(2);
+    Cols->setName("cols");
+    Out->setName("out");
+    N->setName("n");
+
+    EntryBB = BasicBlock::Create(M->getContext(), "entry",
+                                 BatchFn);
+    BasicBlock *LoopBB = BasicBlock::Create(
+        M->getContext(), "loop", BatchFn);
+    BasicBlock *ExitBB = BasicBlock::Create(
+        M->getContext(), "exit", BatchFn);
+    Builder.SetInsertPoint(EntryBB);
+    Builder.CreateCondBr(
+        Builder.CreateICmpEQ(N, ConstantInt::get(SizeTy, 0)),
+        ExitBB, LoopBB);
+
+    Builder.SetInsertPoint(LoopBB);
+    PHINode *Phi = Builder.CreatePHI(SizeTy, 2, "i");
+    Phi->addIncoming(ConstantInt::get(SizeTy, 0), EntryBB);
+    Index = Phi;
+
+    Tree->accept(*this);  // visit(WithDecl) loads the
+                          // variables from the columns
+
+    Builder.CreateStore(
+        V, Builder.CreateInBoundsGEP(Int32Ty, Out, Index));
+    Value *Next = Builder.CreateNUWAdd(
+        Index, ConstantInt::get(SizeTy, 1), "i.next");
+    Phi->addIncoming(Next, Builder.GetInsertBlock());
+    Builder.CreateCondBr(Builder.CreateICmpEQ(Next, N),
+                         ExitBB, LoopBB);
+
+    Builder.SetInsertPoint(ExitBB);
+    Builder.CreateRetVoid();
+
+    // The runtime needs to know how many columns to read.
+    new GlobalVariable(
+        *M, Int32Ty, /*isConstant=*/true,
+        GlobalValue::ExternalLinkage,
+        ConstantInt::get(Int32Ty, NumCols),
+        "calc_batch_cols");
+  }
+
   virtual void visit(Factor &Node) override {
     if (Node.getKind() == Factor::Ident) {
       V = nameMap[Node.getVal()];
@@ -81,6 +154,10 @@ public:
   };
 
   virtual void visit(WithDecl &Node) override {
+    if (Index) {
+      visitBatch(Node);
+      return;
+    }
     FunctionType *ReadFty =
         FunctionType::get(Int32Ty, {PtrTy}, false);
     Function *ReadFn = Function::Create(
@@ -107,14 +184,38 @@ public:
 
     Node.getExpr()->accept(*this);
   };
+
+  void visitBatch(WithDecl &Node) {
+    // The column pointers do not change in the loop, so
+    // they are loaded once in the entry block.
+    IRBuilder<> EntryBuilder(EntryBB->getTerminator());
+    for (auto I = Node.begin(), E = Node.end(); I != E;
+         ++I, ++NumCols) {
+      StringRef Var = *I;
+      Value *ColPtr = EntryBuilder.CreateLoad(
+          PtrTy,
+          EntryBuilder.CreateConstInBoundsGEP1_32(
+              PtrTy, Cols, NumCols),
+          Twine(Var).concat(".col"));
+      nameMap[Var] = Builder.CreateLoad(
+          Int32Ty,
+          Builder.CreateInBoundsGEP(Int32Ty, ColPtr, Index),
+          Var);
+    }
+
+    Node.getExpr()->accept(*this);
+  }
 };
 } // namespace
 
 // The frontend compiler generates LLVM IR
-void CodeGen::compile(AST *Tree) {
+void CodeGen::compile(AST *Tree, bool Batch) {
   LLVMContext Ctx;
   Module *M = new Module("calc.expr", Ctx);
   ToIRVisitor ToIR(M);
-  ToIR.run(Tree);
+  if (Batch)
+    ToIR.runBatch(Tree);
+  else
+    ToIR.run(Tree);
   M->print(outs(), nullptr);
 }
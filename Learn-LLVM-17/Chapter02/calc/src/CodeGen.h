@@ -6,7 +6,8 @@
 class CodeGen
 {
 public:
- void compile(AST *Tree);
+ // Emits main(), or with Batch the calc_batch() kernel.
+ void compile(AST *Tree, bool Batch = false);
 
 };
 #endif
\ No newline at end of file
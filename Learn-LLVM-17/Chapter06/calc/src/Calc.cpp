@@ -10,6 +10,11 @@ static llvm::cl::opt<std::string>
           llvm::cl::desc("<input expression>"),
           llvm::cl::init(""));
 
+static llvm::cl::opt<bool>
+    Batch("batch",
+          llvm::cl::desc("Emit calc_batch(cols, out, n) "
+                         "for use with rtcalc_batch.cpp"));
+
 int main(int argc, const char **argv) {
   llvm::InitLLVM X(argc, argv);
   llvm::cl::ParseCommandLineOptions(
@@ -28,6 +33,6 @@ int main(int argc, const char **argv) {
     return 1;
   }
   CodeGen CodeGenerator;
-  CodeGenerator.compile(Tree);
+  CodeGenerator.compile(Tree, Batch);
   return 0;
 }
\ No newline at end of file
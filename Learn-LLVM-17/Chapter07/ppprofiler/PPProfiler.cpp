@@ -1,9 +1,17 @@
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/SpecialCaseList.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 using namespace llvm;
 
@@ -11,6 +19,35 @@ using namespace llvm;
 
 ALWAYS_ENABLED_STATISTIC(
     NumOfFunc, "Number of instrumented functions.");
+ALWAYS_ENABLED_STATISTIC(
+    NumOfSkipped, "Number of skipped functions.");
+
+static cl::opt<unsigned> MinInstructions(
+    "ppprofiler-min-instructions",
+    cl::desc("Do not instrument functions with less "
+             "instructions"),
+    cl::init(0));
+
+static cl::opt<bool> SkipLeaves(
+    "ppprofiler-skip-leaves",
+    cl::desc("Do not instrument functions without calls "
+             "and loops"),
+    cl::init(false));
+
+static cl::list<std::string> AllowList(
+    "ppprofiler-allowlist",
+    cl::desc("Only instrument the functions listed in "
+             "the file (fun:<glob> entries)"));
+
+static cl::list<std::string> DenyList(
+    "ppprofiler-denylist",
+    cl::desc("Do not instrument the functions listed in "
+             "the file (fun:<glob> entries)"));
+
+static cl::opt<unsigned> SampleRate(
+    "ppprofiler-sample",
+    cl::desc("Record only every N-th call of a function"),
+    cl::init(1));
 
 namespace {
 class PPProfilerIRPass
@@ -20,37 +57,116 @@ public:
   run(llvm::Module &M, llvm::ModuleAnalysisManager &AM);
 
 private:
-  void instrument(llvm::Function &F,
+  bool shouldInstrument(
+      llvm::Function &F,
+      llvm::FunctionAnalysisManager &FAM,
+      const llvm::SpecialCaseList *Allow,
+      const llvm::SpecialCaseList *Deny);
+  void instrument(llvm::Function &F, unsigned ID,
+                  llvm::GlobalVariable *ModuleInfo,
+                  llvm::GlobalVariable *Samples,
                   llvm::Function *EnterFn,
                   llvm::Function *ExitFn);
 };
 } // namespace
 
-void PPProfilerIRPass::instrument(llvm::Function &F,
-                                  Function *EnterFn,
-                                  Function *ExitFn) {
+bool PPProfilerIRPass::shouldInstrument(
+    Function &F, FunctionAnalysisManager &FAM,
+    const SpecialCaseList *Allow,
+    const SpecialCaseList *Deny) {
+  if (F.isDeclaration() || !F.hasName())
+    return false;
+  StringRef Name = F.getName();
+  if (Allow && !Allow->inSection("ppprofiler", "fun", Name))
+    return false;
+  if (Deny && Deny->inSection("ppprofiler", "fun", Name))
+    return false;
+  if (F.getInstructionCount() < MinInstructions)
+    return false;
+  if (SkipLeaves) {
+    // A function without calls and loops runs only for a
+    // short time, and the profiler would mostly measure
+    // itself.
+    bool HasCall = llvm::any_of(
+        instructions(F), [](const Instruction &I) {
+          return isa<CallBase>(I) && !isa<IntrinsicInst>(I);
+        });
+    if (!HasCall && FAM.getResult<LoopAnalysis>(F).empty())
+      return false;
+  }
+  return true;
+}
+
+void PPProfilerIRPass::instrument(
+    llvm::Function &F, unsigned ID,
+    GlobalVariable *ModuleInfo, GlobalVariable *Samples,
+    Function *EnterFn, Function *ExitFn) {
   ++NumOfFunc;
 
-  // Set the insertion point to begin of first block.
-  IRBuilder<> Builder(&*F.getEntryBlock().begin());
+  // Set the insertion point after the allocas, which must
+  // stay in the entry block.
+  BasicBlock::iterator InsertPt =
+      F.getEntryBlock().getFirstInsertionPt();
+  while (isa<AllocaInst>(InsertPt))
+    ++InsertPt;
+  IRBuilder<> Builder(&*InsertPt);
 
-  // Create global constant for the function name.
-  GlobalVariable *FnName =
-      Builder.CreateGlobalString(F.getName());
+  // The ID of the function is the index in the name
+  // table plus the base which the runtime assigned to the
+  // module. The base is the first member of the module
+  // info.
+  Value *Base = Builder.CreateLoad(Builder.getInt32Ty(),
+                                   ModuleInfo, "ppp.base");
+  Value *FnID = Builder.CreateAdd(
+      Base, Builder.getInt32(ID), "ppp.id");
+
+  // With sampling, a counter per function selects every
+  // N-th call. The counter is not updated atomically,
+  // because a lost update only changes which call is
+  // recorded. The exits are recorded for the same calls
+  // as the entries.
+  Value *Sampled = nullptr;
+  if (Samples) {
+    Type *Int32Ty = Builder.getInt32Ty();
+    Value *Counter = Builder.CreateConstInBoundsGEP2_32(
+        Samples->getValueType(), Samples, 0, ID);
+    LoadInst *Count = Builder.CreateAlignedLoad(
+        Int32Ty, Counter, Align(4), "ppp.count");
+    Count->setAtomic(AtomicOrdering::Monotonic);
+    Value *Next = Builder.CreateAdd(
+        Count, Builder.getInt32(1), "ppp.next");
+    Sampled = Builder.CreateICmpUGE(
+        Next, Builder.getInt32(SampleRate), "ppp.sampled");
+    StoreInst *Store = Builder.CreateAlignedStore(
+        Builder.CreateSelect(Sampled, Builder.getInt32(0),
+                             Next),
+        Counter, Align(4));
+    Store->setAtomic(AtomicOrdering::Monotonic);
+    Builder.SetInsertPoint(SplitBlockAndInsertIfThen(
+        Sampled, &*InsertPt, /*Unreachable=*/false));
+  }
 
   // Call the EnterFn at function entry.
   Builder.CreateCall(EnterFn->getFunctionType(), EnterFn,
-                     {FnName});
+                     {FnID});
 
   // Find all Ret instructions, and call ExitFn before.
+  // The blocks are collected first, because sampling
+  // splits them.
+  SmallVector<ReturnInst *, 4> Rets;
   for (BasicBlock &BB : F) {
-    for (Instruction &Inst : BB) {
-      if (Inst.getOpcode() == Instruction::Ret) {
-        Builder.SetInsertPoint(&Inst);
-        Builder.CreateCall(ExitFn->getFunctionType(),
-                           ExitFn, {FnName});
-      }
-    }
+    if (auto *Ret =
+            dyn_cast<ReturnInst>(BB.getTerminator()))
+      Rets.push_back(Ret);
+  }
+  for (ReturnInst *Ret : Rets) {
+    Instruction *InsertBefore = Ret;
+    if (Sampled)
+      InsertBefore = SplitBlockAndInsertIfThen(
+          Sampled, Ret, /*Unreachable=*/false);
+    Builder.SetInsertPoint(InsertBefore);
+    Builder.CreateCall(ExitFn->getFunctionType(), ExitFn,
+                       {FnID});
   }
 }
 
@@ -59,16 +175,42 @@ PPProfilerIRPass::run(Module &M,
                       ModuleAnalysisManager &AM) {
   // Do not instrument the runtime functions.
   if (M.getFunction("__ppp_enter") ||
-      M.getFunction("__ppp_exit")) {
+      M.getFunction("__ppp_exit") ||
+      M.getFunction("__ppp_register")) {
     return PreservedAnalyses::all();
   }
 
+  std::unique_ptr<SpecialCaseList> Allow, Deny;
+  if (!AllowList.empty())
+    Allow = SpecialCaseList::createOrDie(
+        AllowList, *vfs::getRealFileSystem());
+  if (!DenyList.empty())
+    Deny = SpecialCaseList::createOrDie(
+        DenyList, *vfs::getRealFileSystem());
+
+  // Collect the functions to instrument. The position
+  // in this list is the ID of the function inside the
+  // module.
+  FunctionAnalysisManager &FAM =
+      AM.getResult<FunctionAnalysisManagerModuleProxy>(M)
+          .getManager();
+  SmallVector<Function *, 0> Fns;
+  for (auto &F : M.functions()) {
+    if (shouldInstrument(F, FAM, Allow.get(), Deny.get()))
+      Fns.push_back(&F);
+    else if (!F.isDeclaration())
+      ++NumOfSkipped;
+  }
+  if (Fns.empty())
+    return PreservedAnalyses::all();
+
   // Create the function type and functions.
-  Type *VoidTy = Type::getVoidTy(M.getContext());
-  PointerType *PtrTy =
-      PointerType::getUnqual(M.getContext());
+  LLVMContext &Ctx = M.getContext();
+  Type *VoidTy = Type::getVoidTy(Ctx);
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  PointerType *PtrTy = PointerType::getUnqual(Ctx);
   FunctionType *EnterExitFty =
-      FunctionType::get(VoidTy, {PtrTy}, false);
+      FunctionType::get(VoidTy, {Int32Ty}, false);
   Function *EnterFn = Function::Create(
       EnterExitFty, GlobalValue::ExternalLinkage,
       "__ppp_enter", M);
@@ -76,11 +218,65 @@ PPProfilerIRPass::run(Module &M,
       EnterExitFty, GlobalValue::ExternalLinkage,
       "__ppp_exit", M);
 
-  // Call enter function.
-  for (auto &F : M.functions()) {
-    if (!F.isDeclaration() && F.hasName())
-      instrument(F, EnterFn, ExitFn);
+  // Create the name table of the module. The names are
+  // only read by the runtime when the module is
+  // registered, never when an event is recorded.
+  IRBuilder<> Builder(Ctx);
+  SmallVector<Constant *, 0> Names;
+  for (Function *F : Fns)
+    Names.push_back(Builder.CreateGlobalString(
+        F->getName(), "ppp.name", 0, &M));
+  ArrayType *NamesTy = ArrayType::get(PtrTy, Names.size());
+  auto *NameTable = new GlobalVariable(
+      M, NamesTy, /*isConstant=*/true,
+      GlobalValue::PrivateLinkage,
+      ConstantArray::get(NamesTy, Names), "ppp.names");
+
+  // Create the module info, which must match struct
+  // Module in runtime/runtime.c. The runtime writes the
+  // base of the IDs into the first member.
+  StructType *ModuleInfoTy = StructType::get(
+      Ctx, {Int32Ty, Int32Ty, PtrTy});
+  auto *ModuleInfo = new GlobalVariable(
+      M, ModuleInfoTy, /*isConstant=*/false,
+      GlobalValue::PrivateLinkage,
+      ConstantStruct::get(
+          ModuleInfoTy,
+          {Builder.getInt32(0),
+           Builder.getInt32(Names.size()), NameTable}),
+      "ppp.module");
+
+  // The sample counters, one per function. They start
+  // so that the first call of each function is recorded.
+  GlobalVariable *Samples = nullptr;
+  if (SampleRate > 1) {
+    ArrayType *SamplesTy =
+        ArrayType::get(Int32Ty, Fns.size());
+    SmallVector<Constant *, 0> Init(
+        Fns.size(), Builder.getInt32(SampleRate - 1));
+    Samples = new GlobalVariable(
+        M, SamplesTy, /*isConstant=*/false,
+        GlobalValue::PrivateLinkage,
+        ConstantArray::get(SamplesTy, Init), "ppp.samples");
   }
+
+  // Register the module before any function can run.
+  FunctionType *RegisterFty =
+      FunctionType::get(VoidTy, {PtrTy}, false);
+  FunctionCallee RegisterFn =
+      M.getOrInsertFunction("__ppp_register", RegisterFty);
+  Function *Ctor = Function::Create(
+      FunctionType::get(VoidTy, false),
+      GlobalValue::InternalLinkage, "ppp.register", M);
+  Builder.SetInsertPoint(
+      BasicBlock::Create(Ctx, "entry", Ctor));
+  Builder.CreateCall(RegisterFn, {ModuleInfo});
+  Builder.CreateRetVoid();
+  appendToGlobalCtors(M, Ctor, 0);
+
+  for (unsigned ID = 0, E = Fns.size(); ID < E; ++ID)
+    instrument(*Fns[ID], ID, ModuleInfo, Samples,
+               EnterFn, ExitFn);
   return PreservedAnalyses::none();
 }
 
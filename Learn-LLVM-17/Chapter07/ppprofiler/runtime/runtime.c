@@ -1,45 +1,629 @@
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+/* Each thread keeps a shadow stack of the active calls and
+   a calling context tree, with one node per call path. The
+   node of a call path has the number of calls, the
+   inclusive time and the exclusive time. Recording an
+   event takes no lock. When a thread exits, its tree is
+   merged into a global tree, which is written at exit.
+   The thread calling exit() is merged then, too. Other
+   threads still running at that point are left out, as
+   their trees and trace buffers change without a lock:
+
+     ppprofile.folded: one line per call path with the
+         exclusive time in nanoseconds, e.g.
+           main;fib;leaf 1234
+         This is the collapsed stack format read by
+         flamegraph.pl.
+     ppprofile.edges: one line per caller and callee,
+           calls inclusive exclusive caller callee
+         sorted by inclusive time. The caller of the
+         outermost calls is "-". The inclusive time of a
+         recursive edge is only counted for the outermost
+         use of the edge on a path.
+
+   The size of both files depends on the number of call
+   paths, not on the run time of the program.
+
+   With the environment variable PPP_TRACE set, the events
+   are also written to a trace. The events of each thread
+   are collected in a thread-local buffer of fixed-size
+   binary records. A full buffer is written to the trace
+   file as one block. The file format is read by
+   ppprofconv:
+
+     header:  "PPPROF1\0"
+     chunk:   uint32 Tag, uint32 Thread, uint64 Size,
+              followed by Size bytes
+       'N':   names, each uint64 Fn, uint32 Len, Len chars
+       'E':   Size / sizeof(struct Record) records
+       'C':   number of calls, one uint64 per function ID
+
+   All values are in native byte order.
+
+   The functions are identified by a dense integer ID.
+   Each instrumented module registers its name table
+   before any of its functions runs, and is given the
+   first ID of its functions. An event needs no string
+   handling. */
+
 typedef unsigned long long Time;
 
+struct Record {
+  uint64_t Fn;    /* ID of the function. */
+  uint64_t Time;  /* Nanoseconds, PPP_EXIT set on exit. */
+  uint64_t Frame; /* Frame address of the function. */
+};
+
+/* Created by the PPProfiler pass, once per module. */
+struct Module {
+  uint32_t Base; /* Set by __ppp_register(). */
+  uint32_t Count;
+  const char *const *Names;
+};
+
+#define PPP_EXIT (1ULL << 63)
+#define PPP_BUFFER_RECORDS (1 << 16)
+
+struct Buffer {
+  uint32_t Count;
+  struct Record Records[PPP_BUFFER_RECORDS];
+};
+
+/* A node of the calling context tree. Node 0 is the root,
+   which is the caller of the outermost calls. A parent is
+   always created before its children, so it has a lower
+   index. */
+struct Node {
+  uint32_t Fn;
+  uint32_t Parent;
+  uint32_t Child; /* First child, or 0. */
+  uint32_t Next;  /* Next sibling, or 0. */
+  uint64_t Calls;
+  uint64_t Incl;
+  uint64_t Self;
+};
+
+/* The nodes are allocated in blocks, so adding a node
+   never moves the others. */
+#define PPP_NODE_BITS 12
+#define PPP_NODE_BLOCK (1 << PPP_NODE_BITS)
+#define PPP_NODE_BLOCKS (1 << 12)
+
+struct Tree {
+  uint32_t NumNodes;
+  struct Node *Blocks[PPP_NODE_BLOCKS];
+};
+
+struct Frame {
+  uint32_t Node;
+  uint32_t Fn;
+  Time Start;
+  Time Children; /* Inclusive time of the callees. */
+};
+
+struct Thread {
+  uint32_t Id;
+  uint32_t Depth;
+  uint32_t StackSize;
+  struct Frame *Stack;
+  struct Buffer *Trace; /* NULL unless tracing. */
+  struct Tree Tree;
+};
+
+/* Guards everything below, but not the contents of the
+   thread-local data. */
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static int Initialized = 0;
+static int Tracing = 0;
 static FILE *FileFD = NULL;
+static uint32_t NumThreads = 0;
+static int Finished = 0;
 
-static void cleanup() {
-  if (FileFD == NULL) {
-    fclose(FileFD);
-    FileFD = NULL;
+/* The calls of the exited threads. */
+static struct Tree *Global = NULL;
+
+/* The names of the functions, indexed by function ID. */
+static const char **Names = NULL;
+static uint32_t NamesSize = 0;
+static uint32_t NextID = 0;
+
+static pthread_once_t KeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t Key;
+static __thread struct Thread *ThreadData = NULL;
+
+static inline struct Node *getNode(struct Tree *T,
+                                   uint32_t N) {
+  return &T->Blocks[N >> PPP_NODE_BITS]
+                   [N & (PPP_NODE_BLOCK - 1)];
+}
+
+/* Returns the new node, or 0 if out of memory. */
+static uint32_t addNode(struct Tree *T, uint32_t Parent,
+                        uint32_t Fn) {
+  uint32_t N = T->NumNodes;
+  if ((N & (PPP_NODE_BLOCK - 1)) == 0) {
+    if ((N >> PPP_NODE_BITS) == PPP_NODE_BLOCKS)
+      return 0;
+    struct Node *Block =
+        malloc(PPP_NODE_BLOCK * sizeof(struct Node));
+    if (Block == NULL)
+      return 0;
+    T->Blocks[N >> PPP_NODE_BITS] = Block;
   }
+  struct Node *Node = getNode(T, N);
+  memset(Node, 0, sizeof(*Node));
+  Node->Fn = Fn;
+  Node->Parent = Parent;
+  if (N != 0) {
+    struct Node *P = getNode(T, Parent);
+    Node->Next = P->Child;
+    P->Child = N;
+  }
+  T->NumNodes = N + 1;
+  return N;
+}
+
+/* Creates the root. Returns 0 if out of memory. */
+static int initTree(struct Tree *T) {
+  addNode(T, 0, UINT32_MAX);
+  return T->NumNodes == 1;
+}
+
+static void destroyTree(struct Tree *T) {
+  for (uint32_t I = 0; I < PPP_NODE_BLOCKS && T->Blocks[I];
+       ++I)
+    free(T->Blocks[I]);
+}
+
+static uint32_t getChild(struct Tree *T, uint32_t Parent,
+                         uint32_t Fn) {
+  for (uint32_t C = getNode(T, Parent)->Child; C;
+       C = getNode(T, C)->Next)
+    if (getNode(T, C)->Fn == Fn)
+      return C;
+  return addNode(T, Parent, Fn);
 }
 
-static void init() {
-  if (FileFD == NULL) {
-    FileFD = fopen("ppprofile.csv", "w");
-    atexit(&cleanup);
+/* Adds the counters of Src to Dst. Called with Lock
+   held. */
+static void mergeTree(struct Tree *Dst, struct Tree *Src) {
+  uint32_t Num = Src->NumNodes;
+  uint32_t *Map = malloc(Num * sizeof(uint32_t));
+  if (Map == NULL)
+    return;
+  Map[0] = 0;
+  for (uint32_t I = 1; I < Num; ++I) {
+    struct Node *S = getNode(Src, I);
+    /* If the parent is missing in Dst, the node is
+       missing, too. */
+    uint32_t P = Map[S->Parent];
+    Map[I] = (P || S->Parent == 0)
+                 ? getChild(Dst, P, S->Fn)
+                 : 0;
+    if (Map[I] == 0)
+      continue;
+    struct Node *D = getNode(Dst, Map[I]);
+    D->Calls += S->Calls;
+    D->Incl += S->Incl;
+    D->Self += S->Self;
   }
+  free(Map);
+}
+
+static void writeChunk(uint32_t Tag, uint32_t Thread,
+                       const void *Data, uint64_t Size) {
+  fwrite(&Tag, sizeof(Tag), 1, FileFD);
+  fwrite(&Thread, sizeof(Thread), 1, FileFD);
+  fwrite(&Size, sizeof(Size), 1, FileFD);
+  fwrite(Data, 1, Size, FileFD);
 }
 
+/* Called with Lock held. */
+static void flushLocked(struct Thread *T) {
+  struct Buffer *B = T->Trace;
+  if (FileFD && B->Count)
+    writeChunk('E', T->Id, B->Records,
+               B->Count * sizeof(struct Record));
+  B->Count = 0;
+}
+
+static void flush(struct Thread *T) {
+  pthread_mutex_lock(&Lock);
+  flushLocked(T);
+  pthread_mutex_unlock(&Lock);
+}
+
+/* CLOCK_MONOTONIC is read without a system call. */
 static Time get_time() {
   struct timespec ts;
-  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
   return 1000000000L * ts.tv_sec + ts.tv_nsec;
 }
 
-void __ppp_enter(const char *FnName) {
-  init();
-  Time T = get_time();
-  void *Frame = __builtin_frame_address(1);
-  fprintf(FileFD,
-          // "enter|name|clock|frame"
-          "enter|%s|%llu|%p\n", FnName, T, Frame);
+/* Ends the innermost active call. */
+static void pop(struct Thread *T, Time Now) {
+  struct Frame *F = &T->Stack[--T->Depth];
+  Time Elapsed = Now - F->Start;
+  struct Node *N = getNode(&T->Tree, F->Node);
+  ++N->Calls;
+  N->Incl += Elapsed;
+  N->Self += Elapsed - F->Children;
+  if (T->Depth)
+    T->Stack[T->Depth - 1].Children += Elapsed;
+}
+
+/* Called with Lock held. */
+static void mergeThread(struct Thread *T) {
+  if (Global == NULL) {
+    Global = calloc(1, sizeof(struct Tree));
+    if (Global != NULL && !initTree(Global)) {
+      free(Global);
+      Global = NULL;
+    }
+  }
+  if (Global != NULL)
+    mergeTree(Global, &T->Tree);
+}
+
+/* Runs when a thread exits. */
+static void releaseThread(void *Ptr) {
+  struct Thread *T = Ptr;
+  /* Calls left by pthread_exit() end here. */
+  Time Now = get_time();
+  while (T->Depth)
+    pop(T, Now);
+  pthread_mutex_lock(&Lock);
+  if (T->Trace)
+    flushLocked(T);
+  if (!Finished)
+    mergeThread(T);
+  pthread_mutex_unlock(&Lock);
+  ThreadData = NULL;
+  destroyTree(&T->Tree);
+  free(T->Stack);
+  free(T->Trace);
+  free(T);
+}
+
+static const char *getName(uint32_t Fn) {
+  return Fn < NextID ? Names[Fn] : "?";
+}
+
+/* An edge of the global tree. The edges are kept in an
+   open addressing hash table keyed by caller and
+   callee. */
+struct Edge {
+  uint32_t Caller; /* UINT32_MAX for the root. */
+  uint32_t Callee;
+  uint32_t Active; /* Uses on the current path. */
+  uint32_t Used;
+  uint64_t Calls;
+  uint64_t Incl;
+  uint64_t Self;
+};
+
+static struct Edge *findEdge(struct Edge *Edges,
+                             size_t Mask, struct Tree *T,
+                             struct Node *N) {
+  uint32_t Caller =
+      N->Parent ? getNode(T, N->Parent)->Fn : UINT32_MAX;
+  uint64_t Key = (uint64_t)Caller << 32 | N->Fn;
+  size_t I = (Key * 0x9E3779B97F4A7C15ULL) >> 32 & Mask;
+  while (Edges[I].Used && (Edges[I].Caller != Caller ||
+                           Edges[I].Callee != N->Fn))
+    I = (I + 1) & Mask;
+  struct Edge *E = &Edges[I];
+  if (!E->Used) {
+    E->Used = 1;
+    E->Caller = Caller;
+    E->Callee = N->Fn;
+  }
+  return E;
+}
+
+static int compareEdges(const void *A, const void *B) {
+  const struct Edge *EA = A, *EB = B;
+  if (EA->Incl != EB->Incl)
+    return EA->Incl < EB->Incl ? 1 : -1;
+  return 0;
+}
+
+/* Writes the global tree as collapsed stacks and as edge
+   table. Called with Lock held. */
+static void writeProfile(struct Tree *T) {
+  FILE *FoldedFD = fopen("ppprofile.folded", "w");
+  FILE *EdgesFD = fopen("ppprofile.edges", "w");
+  size_t EdgesSize = 16;
+  while (EdgesSize < 2 * (size_t)T->NumNodes)
+    EdgesSize *= 2;
+  struct Edge *Edges =
+      calloc(EdgesSize, sizeof(struct Edge));
+  size_t PathSize = 4096, LensSize = 256;
+  char *Path = malloc(PathSize);
+  size_t *Lens = malloc(LensSize * sizeof(size_t));
+  if (!FoldedFD || !EdgesFD || !Edges || !Path || !Lens)
+    goto out;
+
+  /* Walk the tree depth-first. Lens[D] is the length of
+     the path of the caller of a node at depth D. */
+  uint32_t N = getNode(T, 0)->Child;
+  size_t Depth = 0;
+  Lens[0] = 0;
+  while (N) {
+    struct Node *Node = getNode(T, N);
+    const char *Name = getName(Node->Fn);
+    size_t Len = strlen(Name);
+    size_t Start = Depth ? Lens[Depth] + 1 : 0;
+    while (Start + Len > PathSize)
+      if (!(Path = realloc(Path, PathSize *= 2)))
+        goto out;
+    while (Depth + 2 > LensSize)
+      if (!(Lens = realloc(Lens, (LensSize *= 2) *
+                                     sizeof(size_t))))
+        goto out;
+    if (Depth)
+      Path[Start - 1] = ';';
+    memcpy(Path + Start, Name, Len);
+    Lens[Depth + 1] = Start + Len;
+    if (Node->Self)
+      fprintf(FoldedFD, "%.*s %llu\n", (int)(Start + Len),
+              Path, (unsigned long long)Node->Self);
+
+    struct Edge *E =
+        findEdge(Edges, EdgesSize - 1, T, Node);
+    E->Calls += Node->Calls;
+    E->Self += Node->Self;
+    if (E->Active++ == 0)
+      E->Incl += Node->Incl;
+
+    if (Node->Child) {
+      N = Node->Child;
+      ++Depth;
+      continue;
+    }
+    /* Leave the nodes without a next sibling. */
+    for (;;) {
+      --findEdge(Edges, EdgesSize - 1, T, Node)->Active;
+      if (Node->Next || Node->Parent == 0)
+        break;
+      Node = getNode(T, Node->Parent);
+      --Depth;
+    }
+    N = Node->Next;
+  }
+
+  size_t NumEdges = 0;
+  for (size_t I = 0; I < EdgesSize; ++I)
+    if (Edges[I].Used)
+      Edges[NumEdges++] = Edges[I];
+  qsort(Edges, NumEdges, sizeof(struct Edge),
+        &compareEdges);
+  for (size_t I = 0; I < NumEdges; ++I) {
+    struct Edge *E = &Edges[I];
+    fprintf(EdgesFD, "%llu %llu %llu %s %s\n",
+            (unsigned long long)E->Calls,
+            (unsigned long long)E->Incl,
+            (unsigned long long)E->Self,
+            E->Caller == UINT32_MAX ? "-"
+                                    : getName(E->Caller),
+            getName(E->Callee));
+  }
+
+out:
+  free(Lens);
+  free(Path);
+  free(Edges);
+  if (EdgesFD)
+    fclose(EdgesFD);
+  if (FoldedFD)
+    fclose(FoldedFD);
+}
+
+/* Writes the calls per function to the trace. Called with
+   Lock held. */
+static void writeCalls(struct Tree *T) {
+  uint64_t *Calls = calloc(NextID + 1, sizeof(uint64_t));
+  if (Calls == NULL)
+    return;
+  for (uint32_t I = 1; T && I < T->NumNodes; ++I) {
+    struct Node *N = getNode(T, I);
+    if (N->Fn < NextID)
+      Calls[N->Fn] += N->Calls;
+  }
+  writeChunk('C', 0, Calls, NextID * sizeof(uint64_t));
+  free(Calls);
+}
+
+static void cleanup() {
+  /* Calls left by exit() end here. */
+  struct Thread *Self = ThreadData;
+  if (Self != NULL) {
+    Time Now = get_time();
+    while (Self->Depth)
+      pop(Self, Now);
+  }
+  pthread_mutex_lock(&Lock);
+  /* Only this thread is known not to record events now. */
+  if (Self != NULL) {
+    if (Self->Trace)
+      flushLocked(Self);
+    mergeThread(Self);
+  }
+  if (Global != NULL)
+    writeProfile(Global);
+  if (FileFD != NULL) {
+    writeCalls(Global);
+    fclose(FileFD);
+    FileFD = NULL;
+  }
+  Finished = 1;
+  pthread_mutex_unlock(&Lock);
 }
 
-void __ppp_exit(const char *FnName) {
-  init();
-  Time T = get_time();
-  void *Frame = __builtin_frame_address(1);
-  fprintf(FileFD,
-          // "exit|name|clock|frame"
-          "exit|%s|%llu|%p\n", FnName, T, Frame);
-}
\ No newline at end of file
+/* Called with Lock held. */
+static void initLocked() {
+  if (Initialized)
+    return;
+  Initialized = 1;
+  const char *Env = getenv("PPP_TRACE");
+  Tracing = Env != NULL && *Env != '\0' &&
+            strcmp(Env, "0") != 0;
+  if (Tracing) {
+    FileFD = fopen("ppprofile.bin", "wb");
+    if (FileFD != NULL)
+      fwrite("PPPROF1", 1, 8, FileFD);
+  }
+  atexit(&cleanup);
+}
+
+static void createKey() {
+  pthread_key_create(&Key, &releaseThread);
+}
+
+static struct Thread *init() {
+  pthread_once(&KeyOnce, &createKey);
+  struct Thread *T = calloc(1, sizeof(struct Thread));
+  if (T == NULL)
+    return NULL;
+  if (!initTree(&T->Tree)) {
+    free(T);
+    return NULL;
+  }
+  pthread_mutex_lock(&Lock);
+  if (Finished) {
+    pthread_mutex_unlock(&Lock);
+    destroyTree(&T->Tree);
+    free(T);
+    return NULL;
+  }
+  initLocked();
+  if (Tracing) {
+    T->Trace = malloc(sizeof(struct Buffer));
+    if (T->Trace != NULL)
+      T->Trace->Count = 0;
+  }
+  T->Id = NumThreads++;
+  pthread_mutex_unlock(&Lock);
+  pthread_setspecific(Key, T);
+  ThreadData = T;
+  return T;
+}
+
+void __ppp_register(struct Module *M) {
+  pthread_mutex_lock(&Lock);
+  initLocked();
+  if (NamesSize < NextID + M->Count) {
+    uint32_t Size = NamesSize ? NamesSize : 1024;
+    while (Size < NextID + M->Count)
+      Size *= 2;
+    const char **New =
+        realloc(Names, Size * sizeof(const char *));
+    if (New == NULL) {
+      /* The functions of the module are named "?". */
+      M->Base = UINT32_MAX - M->Count;
+      pthread_mutex_unlock(&Lock);
+      return;
+    }
+    Names = New;
+    NamesSize = Size;
+  }
+  M->Base = NextID;
+  for (uint32_t I = 0; I < M->Count; ++I)
+    Names[NextID + I] = M->Names[I];
+  NextID += M->Count;
+
+  if (FileFD != NULL) {
+    size_t Size = 0;
+    for (uint32_t I = 0; I < M->Count; ++I)
+      Size += sizeof(uint64_t) + sizeof(uint32_t) +
+              strlen(M->Names[I]);
+    char *Data = malloc(Size);
+    if (Data != NULL) {
+      char *P = Data;
+      for (uint32_t I = 0; I < M->Count; ++I) {
+        uint64_t Fn = M->Base + I;
+        uint32_t Len = strlen(M->Names[I]);
+        memcpy(P, &Fn, sizeof(Fn));
+        memcpy(P + sizeof(Fn), &Len, sizeof(Len));
+        memcpy(P + sizeof(Fn) + sizeof(Len), M->Names[I],
+               Len);
+        P += sizeof(Fn) + sizeof(Len) + Len;
+      }
+      writeChunk('N', 0, Data, Size);
+      free(Data);
+    }
+  }
+  pthread_mutex_unlock(&Lock);
+}
+
+static inline struct Thread *getThread() {
+  struct Thread *T = ThreadData;
+  if (__builtin_expect(T == NULL, 0)) {
+    if (Finished || (T = init()) == NULL)
+      return NULL;
+  }
+  return T;
+}
+
+static inline void record(struct Thread *T, uint32_t ID,
+                          Time Stamp, void *Frame) {
+  struct Buffer *B = T->Trace;
+  struct Record *R = &B->Records[B->Count];
+  R->Fn = ID;
+  R->Time = Stamp;
+  R->Frame = (uintptr_t)Frame;
+  if (__builtin_expect(++B->Count == PPP_BUFFER_RECORDS, 0))
+    flush(T);
+}
+
+void __ppp_enter(uint32_t ID) {
+  Time Now = get_time();
+  struct Thread *T = getThread();
+  if (T == NULL)
+    return;
+  if (T->Trace)
+    record(T, ID, Now, __builtin_frame_address(1));
+  if (__builtin_expect(T->Depth == T->StackSize, 0)) {
+    uint32_t Size = T->StackSize ? 2 * T->StackSize : 256;
+    struct Frame *New =
+        realloc(T->Stack, Size * sizeof(struct Frame));
+    if (New == NULL)
+      return;
+    T->Stack = New;
+    T->StackSize = Size;
+  }
+  uint32_t Parent =
+      T->Depth ? T->Stack[T->Depth - 1].Node : 0;
+  uint32_t N = getChild(&T->Tree, Parent, ID);
+  if (__builtin_expect(N == 0, 0))
+    return;
+  struct Frame *F = &T->Stack[T->Depth++];
+  F->Node = N;
+  F->Fn = ID;
+  F->Start = Now;
+  F->Children = 0;
+}
+
+void __ppp_exit(uint32_t ID) {
+  Time Now = get_time();
+  struct Thread *T = getThread();
+  if (T == NULL)
+    return;
+  if (T->Trace)
+    record(T, ID, Now | PPP_EXIT,
+           __builtin_frame_address(1));
+  /* Calls left by longjmp() or an exception have no exit
+     event. They end together with the caller. An exit
+     without an active call is ignored. */
+  uint32_t D = T->Depth;
+  while (D && T->Stack[D - 1].Fn != ID)
+    --D;
+  while (D && T->Depth >= D)
+    pop(T, Now);
+}
@@ -0,0 +1,269 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cmath>
+#include <cstring>
+#include <tuple>
+
+using namespace llvm;
+
+// Reads the binary trace written by runtime/runtime.c
+// and prints the same summaries as the awk scripts in
+// scripts/, without a text trace in between.
+
+enum ActionType { Avg, Count, Join, Text };
+
+static cl::opt<ActionType> Action(
+    cl::desc("Action to perform:"),
+    cl::values(
+        clEnumValN(Avg, "avg",
+                   "Print count, total and average "
+                   "duration per function, like "
+                   "join.awk | avg.awk (default)"),
+        clEnumValN(Count, "count",
+                   "Print the number of calls per "
+                   "function, like count.awk"),
+        clEnumValN(Join, "join",
+                   "Print name|enter|exit|duration|frame "
+                   "for each call, like join.awk"),
+        clEnumValN(Text, "text",
+                   "Print the trace in the old text "
+                   "format enter|name|clock|frame")),
+    cl::init(Avg));
+
+static cl::opt<std::string>
+    InputFilename(cl::Positional,
+                  cl::desc("<trace file>"),
+                  cl::init("ppprofile.bin"));
+
+namespace {
+// Must match struct Record in runtime/runtime.c.
+struct Record {
+  uint64_t Fn;
+  uint64_t Time;
+  uint64_t Frame;
+};
+
+constexpr uint64_t ExitFlag = 1ULL << 63;
+
+class TraceReader {
+  raw_ostream &OS;
+  ActionType Action;
+
+  // The names of the functions, keyed by the function ID.
+  DenseMap<uint64_t, StringRef> Names;
+
+  // The open calls of each thread.
+  DenseMap<uint32_t, SmallVector<Record, 32>> Stacks;
+
+  struct Stat {
+    uint64_t Count = 0;
+    uint64_t Sum = 0;
+  };
+  DenseMap<uint64_t, Stat> Stats;
+
+  StringRef getName(uint64_t Fn) const {
+    return Names.lookup(Fn);
+  }
+
+  void printFrame(uint64_t Frame) {
+    // Same output as %p of glibc.
+    if (Frame)
+      OS << format("0x%llx", (unsigned long long)Frame);
+    else
+      OS << "(nil)";
+  }
+
+  void readNames(StringRef Data);
+  void readCalls(StringRef Data);
+  void readEvents(uint32_t Thread, StringRef Data);
+
+public:
+  TraceReader(raw_ostream &OS, ActionType Action)
+      : OS(OS), Action(Action) {}
+
+  bool read(StringRef Buffer, std::string &Error);
+  void printSummary();
+};
+} // namespace
+
+void TraceReader::readNames(StringRef Data) {
+  while (Data.size() >= 12) {
+    uint64_t Fn;
+    uint32_t Len;
+    std::memcpy(&Fn, Data.data(), sizeof(Fn));
+    std::memcpy(&Len, Data.data() + 8, sizeof(Len));
+    Names[Fn] = Data.substr(12, Len);
+    Data = Data.drop_front(12 + Len);
+  }
+}
+
+void TraceReader::readCalls(StringRef Data) {
+  for (size_t Fn = 0, E = Data.size() / sizeof(uint64_t);
+       Fn < E; ++Fn) {
+    uint64_t Calls;
+    std::memcpy(&Calls, Data.data() + Fn * sizeof(Calls),
+                sizeof(Calls));
+    if (Calls)
+      Stats[Fn].Count += Calls;
+  }
+}
+
+void TraceReader::readEvents(uint32_t Thread,
+                             StringRef Data) {
+  SmallVector<Record, 32> &Stack = Stacks[Thread];
+  for (size_t I = 0, E = Data.size() / sizeof(Record);
+       I < E; ++I) {
+    Record R;
+    std::memcpy(&R, Data.data() + I * sizeof(Record),
+                sizeof(Record));
+    bool IsExit = R.Time & ExitFlag;
+    R.Time &= ~ExitFlag;
+    if (Action == Text) {
+      OS << (IsExit ? "exit|" : "enter|") << getName(R.Fn)
+         << "|" << R.Time << "|";
+      printFrame(R.Frame);
+      OS << "\n";
+    } else if (!IsExit) {
+      if (Action == Count)
+        ++Stats[R.Fn].Count;
+      else
+        Stack.push_back(R);
+    } else if (Action != Count) {
+      // Match the exit with the innermost open call of
+      // the same function. Calls left by longjmp() or an
+      // exception are dropped.
+      auto It = llvm::find_if(
+          llvm::reverse(Stack),
+          [&R](const Record &Open) {
+            return Open.Fn == R.Fn;
+          });
+      if (It == Stack.rend())
+        continue;
+      Record Open = *It;
+      Stack.erase(std::prev(It.base()), Stack.end());
+      uint64_t Duration = R.Time - Open.Time;
+      if (Action == Join) {
+        OS << getName(R.Fn) << "|" << Open.Time << "|"
+           << R.Time << "|" << Duration << "|";
+        printFrame(Open.Frame);
+        OS << "\n";
+      } else {
+        Stat &S = Stats[R.Fn];
+        ++S.Count;
+        S.Sum += Duration;
+      }
+    }
+  }
+}
+
+bool TraceReader::read(StringRef Buffer,
+                       std::string &Error) {
+  if (!Buffer.starts_with(StringRef("PPPROF1\0", 8))) {
+    Error = "not a ppprofiler trace";
+    return false;
+  }
+  Buffer = Buffer.drop_front(8);
+
+  // The runtime counts the calls itself and writes the
+  // counts in a 'C' chunk at exit. If it is present,
+  // the events need not be read to count the calls.
+  bool UseCalls = false;
+  SmallVector<std::tuple<uint32_t, uint32_t, StringRef>, 0>
+      Chunks;
+  while (!Buffer.empty()) {
+    uint32_t Tag, Thread;
+    uint64_t Size;
+    if (Buffer.size() < 16) {
+      Error = "truncated chunk header";
+      return false;
+    }
+    std::memcpy(&Tag, Buffer.data(), sizeof(Tag));
+    std::memcpy(&Thread, Buffer.data() + 4,
+                sizeof(Thread));
+    std::memcpy(&Size, Buffer.data() + 8, sizeof(Size));
+    Buffer = Buffer.drop_front(16);
+    if (Buffer.size() < Size) {
+      Error = "truncated chunk";
+      return false;
+    }
+    Chunks.emplace_back(Tag, Thread,
+                        Buffer.take_front(Size));
+    Buffer = Buffer.drop_front(Size);
+    if (Tag == 'C' && Action == Count)
+      UseCalls = true;
+  }
+  for (const auto &[Tag, Thread, Data] : Chunks) {
+    if (Tag == 'N')
+      readNames(Data);
+    else if (Tag == 'E' && !UseCalls)
+      readEvents(Thread, Data);
+    else if (Tag == 'C' && UseCalls)
+      readCalls(Data);
+  }
+  return true;
+}
+
+void TraceReader::printSummary() {
+  if (Action != Avg && Action != Count)
+    return;
+  // Functions with the same name are summarized together.
+  StringMap<Stat> ByName;
+  for (const auto &[Fn, S] : Stats) {
+    Stat &Sum = ByName[getName(Fn)];
+    Sum.Count += S.Count;
+    Sum.Sum += S.Sum;
+  }
+  SmallVector<StringRef, 0> Sorted;
+  for (const auto &Entry : ByName)
+    Sorted.push_back(Entry.getKey());
+  llvm::sort(Sorted);
+  for (StringRef Name : Sorted) {
+    const Stat &S = ByName[Name];
+    if (Action == Count) {
+      OS << S.Count << " " << Name << "\n";
+      continue;
+    }
+    // awk prints integral numbers as integers, and all
+    // others with "%.6g".
+    double Avg = double(S.Sum) / S.Count;
+    OS << S.Count << " " << S.Sum << " ";
+    if (Avg == std::floor(Avg))
+      OS << (uint64_t)Avg;
+    else
+      OS << format("%.6g", Avg);
+    OS << " " << Name << "\n";
+  }
+}
+
+int main(int argc, const char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(
+      argc, argv,
+      "ppprofconv - summarize ppprofiler traces\n");
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> FileOrErr =
+      MemoryBuffer::getFile(InputFilename);
+  if (std::error_code EC = FileOrErr.getError()) {
+    WithColor::error() << InputFilename << ": "
+                       << EC.message() << "\n";
+    return 1;
+  }
+
+  TraceReader Reader(outs(), Action);
+  std::string Error;
+  if (!Reader.read((*FileOrErr)->getBuffer(), Error)) {
+    WithColor::error() << InputFilename << ": " << Error
+                       << "\n";
+    return 1;
+  }
+  Reader.printSummary();
+  return 0;
+}
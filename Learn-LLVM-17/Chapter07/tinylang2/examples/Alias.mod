@@ -0,0 +1,35 @@
+(* Passing one variable to two VAR parameters. Local() returns 202
+   and Global() returns 2: x and y denote the same variable. *)
+MODULE Alias;
+
+VAR g: INTEGER;
+
+PROCEDURE P(VAR x, y: INTEGER);
+BEGIN
+  x := 1;
+  y := y + x
+END P;
+
+PROCEDURE Local(): INTEGER;
+VAR a, b: INTEGER;
+  PROCEDURE Q(VAR x, y: INTEGER);
+  BEGIN
+    x := 1;
+    y := y + x
+  END Q;
+BEGIN
+  a := 5;
+  b := 5;
+  P(a, a);
+  Q(b, b);
+  RETURN a * 100 + b
+END Local;
+
+PROCEDURE Global(): INTEGER;
+BEGIN
+  g := 5;
+  P(g, g);
+  RETURN g
+END Global;
+
+END Alias.
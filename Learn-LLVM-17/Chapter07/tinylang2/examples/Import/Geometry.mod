@@ -0,0 +1,11 @@
+(* Imported by Main, imports Math. *)
+MODULE Geometry;
+
+FROM Math IMPORT Square;
+
+PROCEDURE Area(a: INTEGER): INTEGER;
+BEGIN
+  RETURN Square(a)
+END Area;
+
+END Geometry.
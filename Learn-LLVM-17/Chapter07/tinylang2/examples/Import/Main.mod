@@ -0,0 +1,21 @@
+(* A program of three modules: Main imports Geometry and
+   Math, and Geometry imports Math. The importers are given
+   first, so the driver must reorder the compilations:
+
+     tinylang Main.mod Geometry.mod Math.mod
+     tinylang -j=3 Main.mod Geometry.mod Math.mod
+
+   both compile Math before Geometry and Geometry before
+   Main, because every module reads the interfaces of the
+   modules it imports. Volume(2, 3) returns 12. *)
+MODULE Main;
+
+IMPORT Math;
+FROM Geometry IMPORT Area;
+
+PROCEDURE Volume(a, h: INTEGER): INTEGER;
+BEGIN
+  RETURN Area(a) * Math.Abs(h)
+END Volume;
+
+END Main.
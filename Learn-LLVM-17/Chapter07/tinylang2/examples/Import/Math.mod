@@ -0,0 +1,17 @@
+(* Imported by Geometry and Main. *)
+MODULE Math;
+
+PROCEDURE Square(x: INTEGER): INTEGER;
+BEGIN
+  RETURN x * x
+END Square;
+
+PROCEDURE Abs(x: INTEGER): INTEGER;
+BEGIN
+  IF x < 0 THEN
+    RETURN -x
+  END;
+  RETURN x
+END Abs;
+
+END Math.
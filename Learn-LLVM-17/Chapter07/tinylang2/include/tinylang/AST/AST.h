@@ -4,6 +4,7 @@
 #include "tinylang/Basic/LLVM.h"
 #include "tinylang/Basic/TokenKinds.h"
 #include "llvm/ADT/APSInt.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/SMLoc.h"
 #include <string>
@@ -13,18 +14,22 @@ namespace tinylang {
 
 class Decl;
 class FormalParameterDeclaration;
+class IdentifierInfo;
 class Expr;
 class Selector;
 class Stmt;
 class TypeDeclaration;
 
+// The lists are used while parsing. The AST nodes store
+// copies which live in the ASTContext.
 using DeclList = std::vector<Decl *>;
 using FormalParamList =
     std::vector<FormalParameterDeclaration *>;
 using ExprList = std::vector<Expr *>;
 using SelectorList = std::vector<Selector *>;
 using StmtList = std::vector<Stmt *>;
-using IdentList = std::vector<std::pair<SMLoc, StringRef>>;
+using IdentList =
+    std::vector<std::pair<SMLoc, IdentifierInfo *>>;
 
 class Field {
   SMLoc Loc;
@@ -77,8 +82,8 @@ public:
 };
 
 class ModuleDeclaration : public Decl {
-  DeclList Decls;
-  StmtList Stmts;
+  ArrayRef<Decl *> Decls;
+  ArrayRef<Stmt *> Stmts;
 
 public:
   ModuleDeclaration(Decl *EnclosingDecL, SMLoc Loc,
@@ -86,15 +91,15 @@ public:
       : Decl(DK_Module, EnclosingDecL, Loc, Name) {}
 
   ModuleDeclaration(Decl *EnclosingDecL, SMLoc Loc,
-                    StringRef Name, DeclList &Decls,
-                    StmtList &Stmts)
+                    StringRef Name, ArrayRef<Decl *> Decls,
+                    ArrayRef<Stmt *> Stmts)
       : Decl(DK_Module, EnclosingDecL, Loc, Name),
         Decls(Decls), Stmts(Stmts) {}
 
-  const DeclList &getDecls() { return Decls; }
-  void setDecls(DeclList &D) { Decls = D; }
-  const StmtList &getStmts() { return Stmts; }
-  void setStmts(StmtList &L) { Stmts = L; }
+  ArrayRef<Decl *> getDecls() { return Decls; }
+  void setDecls(ArrayRef<Decl *> D) { Decls = D; }
+  ArrayRef<Stmt *> getStmts() { return Stmts; }
+  void setStmts(ArrayRef<Stmt *> L) { Stmts = L; }
 
   static bool classof(const Decl *D) {
     return D->getKind() == DK_Module;
@@ -104,13 +109,28 @@ public:
 class ConstantDeclaration : public Decl {
   Expr *E;
 
+  // The value of E, computed once by Sema.
+  llvm::APSInt Value;
+  bool HasValue;
+
 public:
   ConstantDeclaration(Decl *EnclosingDecL, SMLoc Loc,
                       StringRef Name, Expr *E)
-      : Decl(DK_Const, EnclosingDecL, Loc, Name), E(E) {}
+      : Decl(DK_Const, EnclosingDecL, Loc, Name), E(E),
+        HasValue(false) {}
 
   Expr *getExpr() { return E; }
 
+  bool hasValue() const { return HasValue; }
+  const llvm::APSInt &getValue() const {
+    assert(HasValue && "Constant not evaluated");
+    return Value;
+  }
+  void setValue(const llvm::APSInt &V) {
+    Value = V;
+    HasValue = true;
+  }
+
   static bool classof(const Decl *D) {
     return D->getKind() == DK_Const;
   }
@@ -149,17 +169,21 @@ public:
 
 class ArrayTypeDeclaration : public TypeDeclaration {
   Expr *Nums;
+  uint64_t NumElements;
   TypeDeclaration *Type;
 
 public:
   ArrayTypeDeclaration(Decl *EnclosingDecL, SMLoc Loc,
                        StringRef Name, Expr *Nums,
+                       uint64_t NumElements,
                        TypeDeclaration *Type)
       : TypeDeclaration(DK_ArrayType, EnclosingDecL, Loc,
                         Name),
-        Nums(Nums), Type(Type) {}
+        Nums(Nums), NumElements(NumElements), Type(Type) {}
 
   Expr *getNums() const { return Nums; }
+  // The value of Nums, computed by Sema.
+  uint64_t getNumElements() const { return NumElements; }
   TypeDeclaration *getType() const { return Type; }
 
   static bool classof(const Decl *D) {
@@ -198,17 +222,17 @@ public:
 };
 
 class RecordTypeDeclaration : public TypeDeclaration {
-  FieldList Fields;
+  ArrayRef<Field> Fields;
 
 public:
   RecordTypeDeclaration(Decl *EnclosingDecL, SMLoc Loc,
                         StringRef Name,
-                        const FieldList &Fields)
+                        ArrayRef<Field> Fields)
       : TypeDeclaration(DK_RecordType, EnclosingDecL, Loc,
                         Name),
         Fields(Fields) {}
 
-  const FieldList &getFields() const { return Fields; }
+  ArrayRef<Field> getFields() const { return Fields; }
 
   static bool classof(const Decl *D) {
     return D->getKind() == DK_RecordType;
@@ -251,36 +275,41 @@ public:
 };
 
 class ProcedureDeclaration : public Decl {
-  FormalParamList Params;
+  ArrayRef<FormalParameterDeclaration *> Params;
   TypeDeclaration *RetType;
-  DeclList Decls;
-  StmtList Stmts;
+  ArrayRef<Decl *> Decls;
+  ArrayRef<Stmt *> Stmts;
 
 public:
   ProcedureDeclaration(Decl *EnclosingDecL, SMLoc Loc,
                        StringRef Name)
-      : Decl(DK_Proc, EnclosingDecL, Loc, Name) {}
+      : Decl(DK_Proc, EnclosingDecL, Loc, Name),
+        RetType(nullptr) {}
 
-  ProcedureDeclaration(Decl *EnclosingDecL, SMLoc Loc,
-                       StringRef Name,
-                       FormalParamList &Params,
-                       TypeDeclaration *RetType,
-                       DeclList &Decls, StmtList &Stmts)
+  ProcedureDeclaration(
+      Decl *EnclosingDecL, SMLoc Loc, StringRef Name,
+      ArrayRef<FormalParameterDeclaration *> Params,
+      TypeDeclaration *RetType, ArrayRef<Decl *> Decls,
+      ArrayRef<Stmt *> Stmts)
       : Decl(DK_Proc, EnclosingDecL, Loc, Name),
         Params(Params), RetType(RetType), Decls(Decls),
         Stmts(Stmts) {}
 
-  const FormalParamList &getFormalParams() {
+  ArrayRef<FormalParameterDeclaration *>
+  getFormalParams() {
     return Params;
   }
-  void setFormalParams(FormalParamList &FP) { Params = FP; }
+  void
+  setFormalParams(ArrayRef<FormalParameterDeclaration *> FP) {
+    Params = FP;
+  }
   TypeDeclaration *getRetType() { return RetType; }
   void setRetType(TypeDeclaration *Ty) { RetType = Ty; }
 
-  const DeclList &getDecls() { return Decls; }
-  void setDecls(DeclList &D) { Decls = D; }
-  const StmtList &getStmts() { return Stmts; }
-  void setStmts(StmtList &L) { Stmts = L; }
+  ArrayRef<Decl *> getDecls() { return Decls; }
+  void setDecls(ArrayRef<Decl *> D) { Decls = D; }
+  ArrayRef<Stmt *> getStmts() { return Stmts; }
+  void setStmts(ArrayRef<Stmt *> L) { Stmts = L; }
 
   static bool classof(const Decl *D) {
     return D->getKind() == DK_Proc;
@@ -468,7 +497,7 @@ public:
 
 class Designator : public Expr {
   Decl *Var;
-  SelectorList Selectors;
+  ArrayRef<Selector *> Selectors;
 
 public:
   Designator(VariableDeclaration *Var)
@@ -478,13 +507,16 @@ public:
       : Expr(EK_Designator, Param->getType(), false),
         Var(Param) {}
 
-  void addSelector(Selector *Sel) {
-    Selectors.push_back(Sel);
-    setType(Sel->getType());
+  // The selector list is owned by the ASTContext. Sema
+  // replaces it with a longer copy for each new selector.
+  void setSelectors(ArrayRef<Selector *> Sels) {
+    Selectors = Sels;
+    if (!Sels.empty())
+      setType(Sels.back()->getType());
   }
 
   Decl *getDecl() { return Var; }
-  const SelectorList &getSelectors() const {
+  ArrayRef<Selector *> getSelectors() const {
     return Selectors;
   }
 
@@ -510,16 +542,16 @@ public:
 
 class FunctionCallExpr : public Expr {
   ProcedureDeclaration *Proc;
-  ExprList Params;
+  ArrayRef<Expr *> Params;
 
 public:
   FunctionCallExpr(ProcedureDeclaration *Proc,
-                   ExprList Params)
+                   ArrayRef<Expr *> Params)
       : Expr(EK_Func, Proc->getRetType(), false),
         Proc(Proc), Params(Params) {}
 
-  ProcedureDeclaration *geDecl() { return Proc; }
-  const ExprList &getParams() { return Params; }
+  ProcedureDeclaration *getDecl() { return Proc; }
+  ArrayRef<Expr *> getParams() { return Params; }
 
   static bool classof(const Expr *E) {
     return E->getKind() == EK_Func;
@@ -564,15 +596,15 @@ public:
 
 class ProcedureCallStatement : public Stmt {
   ProcedureDeclaration *Proc;
-  ExprList Params;
+  ArrayRef<Expr *> Params;
 
 public:
   ProcedureCallStatement(ProcedureDeclaration *Proc,
-                         ExprList &Params)
+                         ArrayRef<Expr *> Params)
       : Stmt(SK_ProcCall), Proc(Proc), Params(Params) {}
 
   ProcedureDeclaration *getProc() { return Proc; }
-  const ExprList &getParams() { return Params; }
+  ArrayRef<Expr *> getParams() { return Params; }
 
   static bool classof(const Stmt *S) {
     return S->getKind() == SK_ProcCall;
@@ -581,18 +613,18 @@ public:
 
 class IfStatement : public Stmt {
   Expr *Cond;
-  StmtList IfStmts;
-  StmtList ElseStmts;
+  ArrayRef<Stmt *> IfStmts;
+  ArrayRef<Stmt *> ElseStmts;
 
 public:
-  IfStatement(Expr *Cond, StmtList &IfStmts,
-              StmtList &ElseStmts)
+  IfStatement(Expr *Cond, ArrayRef<Stmt *> IfStmts,
+              ArrayRef<Stmt *> ElseStmts)
       : Stmt(SK_If), Cond(Cond), IfStmts(IfStmts),
         ElseStmts(ElseStmts) {}
 
   Expr *getCond() { return Cond; }
-  const StmtList &getIfStmts() { return IfStmts; }
-  const StmtList &getElseStmts() { return ElseStmts; }
+  ArrayRef<Stmt *> getIfStmts() { return IfStmts; }
+  ArrayRef<Stmt *> getElseStmts() { return ElseStmts; }
 
   static bool classof(const Stmt *S) {
     return S->getKind() == SK_If;
@@ -601,14 +633,14 @@ public:
 
 class WhileStatement : public Stmt {
   Expr *Cond;
-  StmtList Stmts;
+  ArrayRef<Stmt *> Stmts;
 
 public:
-  WhileStatement(Expr *Cond, StmtList &Stmts)
+  WhileStatement(Expr *Cond, ArrayRef<Stmt *> Stmts)
       : Stmt(SK_While), Cond(Cond), Stmts(Stmts) {}
 
   Expr *getCond() { return Cond; }
-  const StmtList &getWhileStmts() { return Stmts; }
+  ArrayRef<Stmt *> getWhileStmts() { return Stmts; }
 
   static bool classof(const Stmt *S) {
     return S->getKind() == SK_While;
@@ -1,27 +1,102 @@
 #ifndef TINYLANG_AST_ASTCONTEXT_H
 #define TINYLANG_AST_ASTCONTEXT_H
 
+#include "tinylang/Basic/IdentifierTable.h"
 #include "tinylang/Basic/LLVM.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/SourceMgr.h"
+#include <memory>
+#include <vector>
 
 namespace tinylang {
 
 class ASTContext {
   llvm::SourceMgr &SrcMgr;
   StringRef Filename;
+  IdentifierTable &Idents;
+
+  /// All AST nodes of the compilation unit are allocated
+  /// here. Nodes are never destroyed one by one; the
+  /// memory is released together with the context.
+  mutable llvm::BumpPtrAllocator Allocator;
 
 public:
-  ASTContext(llvm::SourceMgr &SrcMgr, StringRef Filename)
-      : SrcMgr(SrcMgr), Filename(Filename) {}
+  ASTContext(llvm::SourceMgr &SrcMgr,
+             StringRef Filename, IdentifierTable &Idents)
+      : SrcMgr(SrcMgr), Filename(Filename),
+        Idents(Idents) {}
+
+  ASTContext(const ASTContext &) = delete;
+  ASTContext &operator=(const ASTContext &) = delete;
 
   StringRef getFilename() { return Filename; }
 
+  IdentifierTable &getIdents() { return Idents; }
+
   llvm::SourceMgr &getSourceMgr() { return SrcMgr; }
   const llvm::SourceMgr &getSourceMgr() const {
     return SrcMgr;
   }
+
+  void *Allocate(size_t Size, unsigned Align = 8) const {
+    return Allocator.Allocate(Size, Align);
+  }
+  template <typename T> T *Allocate(size_t Num = 1) const {
+    return static_cast<T *>(
+        Allocate(Num * sizeof(T), alignof(T)));
+  }
+  void Deallocate(void *Ptr) const {}
+
+  /// Copies a list built up by the parser into memory
+  /// owned by the context.
+  template <typename T>
+  llvm::ArrayRef<T> copyArray(llvm::ArrayRef<T> Elts) const {
+    if (Elts.empty())
+      return {};
+    T *Mem = Allocate<T>(Elts.size());
+    std::uninitialized_copy(Elts.begin(), Elts.end(), Mem);
+    return llvm::ArrayRef<T>(Mem, Elts.size());
+  }
+  template <typename T>
+  llvm::ArrayRef<T>
+  copyArray(const std::vector<T> &Elts) const {
+    return copyArray(llvm::ArrayRef<T>(Elts));
+  }
+
+  size_t getTotalMemory() const {
+    return Allocator.getTotalMemory();
+  }
 };
 
 } // namespace tinylang
 
-#endif
\ No newline at end of file
+/// Placement new for AST nodes, e.g.
+/// \code
+///   new (Context) IntegerLiteral(Loc, Value, Ty);
+/// \endcode
+inline void *operator new(size_t Bytes,
+                          const tinylang::ASTContext &C,
+                          size_t Alignment = 8) {
+  return C.Allocate(Bytes, Alignment);
+}
+
+inline void operator delete(void *Ptr,
+                            const tinylang::ASTContext &C,
+                            size_t) {
+  C.Deallocate(Ptr);
+}
+
+inline void *operator new[](size_t Bytes,
+                            const tinylang::ASTContext &C,
+                            size_t Alignment = 8) {
+  return C.Allocate(Bytes, Alignment);
+}
+
+inline void operator delete[](void *Ptr,
+                              const tinylang::ASTContext &C,
+                              size_t) {
+  C.Deallocate(Ptr);
+}
+
+#endif
@@ -24,11 +24,13 @@ class DiagnosticsEngine {
   getDiagnosticKind(unsigned DiagID);
 
   SourceMgr &SrcMgr;
+  raw_ostream &OS;
   unsigned NumErrors;
 
 public:
-  DiagnosticsEngine(SourceMgr &SrcMgr)
-      : SrcMgr(SrcMgr), NumErrors(0) {}
+  DiagnosticsEngine(SourceMgr &SrcMgr,
+                    raw_ostream &OS = llvm::errs())
+      : SrcMgr(SrcMgr), OS(OS), NumErrors(0) {}
 
   unsigned numErrors() { return NumErrors; }
 
@@ -40,7 +42,7 @@ public:
                       std::forward<Args>(Arguments)...)
             .str();
     SourceMgr::DiagKind Kind = getDiagnosticKind(DiagID);
-    SrcMgr.PrintMessage(Loc, Kind, Msg);
+    SrcMgr.PrintMessage(OS, Loc, Kind, Msg);
     NumErrors += (Kind == SourceMgr::DK_Error);
   }
 };
@@ -0,0 +1,88 @@
+#ifndef TINYLANG_BASIC_IDENTIFIERTABLE_H
+#define TINYLANG_BASIC_IDENTIFIERTABLE_H
+
+#include "tinylang/Basic/LLVM.h"
+#include "tinylang/Basic/TokenKinds.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+
+namespace tinylang {
+
+/// The unique entry of an identifier or keyword. The
+/// lexer looks up each spelling once and stores the
+/// entry in the token, so that later phases compare
+/// pointers instead of strings.
+class IdentifierInfo {
+  friend class IdentifierTable;
+
+  const llvm::StringMapEntry<IdentifierInfo *> *Entry =
+      nullptr;
+
+  /// The keyword kind, or tok::identifier.
+  tok::TokenKind TokenID = tok::identifier;
+
+  /// Data owned by the semantic analysis, e.g. the
+  /// chain of declarations visible under this name.
+  void *FETokenInfo = nullptr;
+
+public:
+  IdentifierInfo() = default;
+  IdentifierInfo(const IdentifierInfo &) = delete;
+  IdentifierInfo &
+  operator=(const IdentifierInfo &) = delete;
+
+  StringRef getName() const { return Entry->getKey(); }
+
+  tok::TokenKind getTokenID() const { return TokenID; }
+  bool isKeyword() const {
+    return TokenID != tok::identifier;
+  }
+
+  template <typename T> T *getFETokenInfo() const {
+    return static_cast<T *>(FETokenInfo);
+  }
+  void setFETokenInfo(void *T) { FETokenInfo = T; }
+};
+
+/// Interns the spelling of all identifiers and keywords
+/// of a compilation.
+class IdentifierTable {
+  using HashTableTy =
+      llvm::StringMap<IdentifierInfo *,
+                      llvm::BumpPtrAllocator>;
+  HashTableTy HashTable;
+
+public:
+  /// Creates the table with all keywords.
+  IdentifierTable();
+
+  IdentifierTable(const IdentifierTable &) = delete;
+  IdentifierTable &
+  operator=(const IdentifierTable &) = delete;
+
+  /// Returns the entry for the spelling, creating it if
+  /// necessary.
+  IdentifierInfo &get(StringRef Name) {
+    auto &Entry =
+        *HashTable.try_emplace(Name, nullptr).first;
+    IdentifierInfo *&II = Entry.second;
+    if (II)
+      return *II;
+    II = new (HashTable.getAllocator()
+                  .Allocate<IdentifierInfo>())
+        IdentifierInfo;
+    II->Entry = &Entry;
+    return *II;
+  }
+
+  IdentifierInfo &get(StringRef Name,
+                      tok::TokenKind TokenCode) {
+    IdentifierInfo &II = get(Name);
+    II.TokenID = TokenCode;
+    return II;
+  }
+};
+
+} // namespace tinylang
+#endif
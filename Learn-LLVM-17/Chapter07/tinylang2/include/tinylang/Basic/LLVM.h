@@ -4,6 +4,7 @@
 #include "llvm/Support/Casting.h"
 
 namespace llvm {
+template <typename T> class ArrayRef;
 class SMLoc;
 class SourceMgr;
 template <typename T, typename A> class StringMap;
@@ -18,6 +19,8 @@ using llvm::dyn_cast;
 using llvm::dyn_cast_or_null;
 using llvm::isa;
 
+using llvm::ArrayRef;
+
 using llvm::raw_ostream;
 using llvm::SMLoc;
 using llvm::SourceMgr;
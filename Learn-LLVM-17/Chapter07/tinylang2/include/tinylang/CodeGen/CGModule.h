@@ -24,6 +24,9 @@ class CGModule {
   CGTBAA TBAA;
   std::unique_ptr<CGDebugInfo> DebugInfo;
 
+  void emitProcedure(ProcedureDeclaration *Proc);
+  void inferAttributes();
+
 public:
   llvm::Type *VoidTy;
   llvm::Type *Int1Ty;
@@ -49,6 +52,9 @@ public:
   std::string mangleName(Decl *D);
 
   llvm::GlobalObject *getGlobal(Decl *);
+  void setGlobal(Decl *D, llvm::GlobalObject *G) {
+    Globals[D] = G;
+  }
 
   CGDebugInfo *getDbgInfo() {
     return DebugInfo.get();
@@ -6,6 +6,7 @@
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Value.h"
+#include <vector>
 
 namespace llvm {
 class Function;
@@ -23,34 +24,58 @@ class CGProcedure {
   llvm::FunctionType *Fty;
   llvm::Function *Fn;
 
+  // The local variables (and formal parameters) and the
+  // basic blocks of the procedure are numbered densely.
+  // The current definition of variable V in block B is
+  // stored in Defs[B * Vars.size() + V].
+  llvm::DenseMap<Decl *, unsigned> VarIndex;
+  llvm::SmallVector<Decl *, 16> Vars;
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> BlockIndex;
+  std::vector<llvm::Value *> Defs;
+
   struct BasicBlockDef {
-    // Maps the variable (or formal parameter) to its
-    // definition.
-    llvm::DenseMap<Decl *, llvm::TrackingVH<llvm::Value>>
-        Defs;
-    // Set of incompleted phi instructions.
-    llvm::DenseMap<llvm::PHINode *, Decl *> IncompletePhis;
+    // Incomplete phi instructions and their variables.
+    llvm::SmallVector<std::pair<llvm::PHINode *, unsigned>,
+                      0>
+        IncompletePhis;
     // Block is sealed, that is, no more predecessors will
     // be added.
     unsigned Sealed : 1;
 
     BasicBlockDef() : Sealed(0) {}
   };
+  std::vector<BasicBlockDef> BlockDefs;
+
+  // Trivial phis are unlinked but not deleted until the
+  // procedure is finished, because Defs may still refer to
+  // them. Reading such a definition follows the
+  // replacement.
+  llvm::DenseMap<llvm::PHINode *, llvm::Value *>
+      ReplacedPhis;
+
+  unsigned getVarIndex(Decl *D) {
+    assert(VarIndex.count(D) && "Not a local variable");
+    return VarIndex.find(D)->second;
+  }
+  unsigned getBlockIndex(llvm::BasicBlock *BB) {
+    assert(BB && "Basic block is nullptr");
+    assert(BlockIndex.count(BB) && "Unknown basic block");
+    return BlockIndex.find(BB)->second;
+  }
+  llvm::Value *getReplacement(llvm::PHINode *Phi);
 
-  llvm::DenseMap<llvm::BasicBlock *, BasicBlockDef>
-      CurrentDef;
-
-  void writeLocalVariable(llvm::BasicBlock *BB, Decl *Decl,
-                          llvm::Value *Val);
+  void writeLocalVariable(llvm::BasicBlock *BB,
+                          unsigned Var, llvm::Value *Val);
   llvm::Value *readLocalVariable(llvm::BasicBlock *BB,
-                                 Decl *Decl);
+                                 unsigned Var);
   llvm::Value *
   readLocalVariableRecursive(llvm::BasicBlock *BB,
-                             Decl *Decl);
+                             unsigned Var);
   llvm::PHINode *addEmptyPhi(llvm::BasicBlock *BB,
-                             Decl *Decl);
-  llvm::Value *addPhiOperands(llvm::BasicBlock *BB, Decl *Decl,
-                      llvm::PHINode *Phi);
+                             unsigned Var);
+  llvm::Value *addPhiOperands(llvm::BasicBlock *BB,
+                              unsigned Var,
+                              llvm::PHINode *Phi);
   llvm::Value *optimizePhi(llvm::PHINode *Phi);
   void sealBlock(llvm::BasicBlock *BB);
 
@@ -70,6 +95,7 @@ class CGProcedure {
   createFunctionType(ProcedureDeclaration *Proc);
   llvm::Function *createFunction(ProcedureDeclaration *Proc,
                                  llvm::FunctionType *FTy);
+  llvm::Function *getFunction(ProcedureDeclaration *Proc);
 
 protected:
   void setCurr(llvm::BasicBlock *BB) {
@@ -80,20 +106,30 @@ protected:
   llvm::BasicBlock *createBasicBlock(
       const llvm::Twine &Name,
       llvm::BasicBlock *InsertBefore = nullptr) {
-    return llvm::BasicBlock::Create(CGM.getLLVMCtx(), Name,
-                                    Fn, InsertBefore);
+    llvm::BasicBlock *BB = llvm::BasicBlock::Create(
+        CGM.getLLVMCtx(), Name, Fn, InsertBefore);
+    BlockIndex[BB] = BlockDefs.size();
+    BlockDefs.emplace_back();
+    Defs.resize(Defs.size() + Vars.size());
+    return BB;
   }
 
   llvm::Value *emitInfixExpr(InfixExpression *E);
+  llvm::Value *emitLogicalExpr(InfixExpression *E);
   llvm::Value *emitPrefixExpr(PrefixExpression *E);
   llvm::Value *emitExpr(Expr *E);
+  llvm::Value *emitAddress(Designator *Desig);
+  llvm::CallInst *emitCall(ProcedureDeclaration *Callee,
+                           ArrayRef<Expr *> Params);
+  void emitBranchOnCond(Expr *Cond, llvm::BasicBlock *TrueBB,
+                        llvm::BasicBlock *FalseBB);
 
   void emitStmt(AssignmentStatement *Stmt);
   void emitStmt(ProcedureCallStatement *Stmt);
   void emitStmt(IfStatement *Stmt);
   void emitStmt(WhileStatement *Stmt);
   void emitStmt(ReturnStatement *Stmt);
-  void emit(const StmtList &Stmts);
+  void emit(ArrayRef<Stmt *> Stmts);
 
 public:
   CGProcedure(CGModule &CGM)
@@ -101,6 +137,7 @@ public:
         Curr(nullptr){};
 
   void run(ProcedureDeclaration *Proc);
+  // Emits the module body.
   void run();
 };
 } // namespace tinylang
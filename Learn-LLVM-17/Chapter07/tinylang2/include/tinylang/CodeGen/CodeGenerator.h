@@ -22,6 +22,11 @@ public:
   static CodeGenerator *create(llvm::LLVMContext &Ctx, ASTContext &ASTCtx, llvm::TargetMachine *TM);
 
   std::unique_ptr<llvm::Module> run(ModuleDeclaration *CM, std::string FileName);
+
+  /// Returns the symbol of a declaration, given the names of the declaration
+  /// and its enclosing declarations, outermost first. The body of a module is
+  /// the procedure named like the module.
+  static std::string mangleName(llvm::ArrayRef<llvm::StringRef> Names);
 };
 } // namespace tinylang
 #endif
\ No newline at end of file
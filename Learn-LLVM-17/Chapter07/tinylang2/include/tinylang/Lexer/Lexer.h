@@ -2,34 +2,15 @@
 #define TINYLANG_LEXER_LEXER_H
 
 #include "tinylang/Basic/Diagnostic.h"
+#include "tinylang/Basic/IdentifierTable.h"
 #include "tinylang/Basic/LLVM.h"
 #include "tinylang/Lexer/Token.h"
-#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/SourceMgr.h"
 
 namespace tinylang {
 
-class KeywordFilter {
-  llvm::StringMap<tok::TokenKind> HashTable;
-
-  void addKeyword(StringRef Keyword,
-                  tok::TokenKind TokenCode);
-
-public:
-  void addKeywords();
-
-  tok::TokenKind getKeyword(
-      StringRef Name,
-      tok::TokenKind DefaultTokenCode = tok::unknown) {
-    auto Result = HashTable.find(Name);
-    if (Result != HashTable.end())
-      return Result->second;
-    return DefaultTokenCode;
-  }
-};
-
 class Lexer {
   SourceMgr &SrcMgr;
   DiagnosticsEngine &Diags;
@@ -41,15 +22,16 @@ class Lexer {
   /// lexing from as managed by the SourceMgr object.
   unsigned CurBuffer = 0;
 
-  KeywordFilter Keywords;
+  /// The keywords and all identifiers seen so far.
+  IdentifierTable &Idents;
 
 public:
-  Lexer(SourceMgr &SrcMgr, DiagnosticsEngine &Diags)
-      : SrcMgr(SrcMgr), Diags(Diags) {
+  Lexer(SourceMgr &SrcMgr, DiagnosticsEngine &Diags,
+        IdentifierTable &Idents)
+      : SrcMgr(SrcMgr), Diags(Diags), Idents(Idents) {
     CurBuffer = SrcMgr.getMainFileID();
     CurBuf = SrcMgr.getMemoryBuffer(CurBuffer)->getBuffer();
     CurPtr = CurBuf.begin();
-    Keywords.addKeywords();
   }
 
   DiagnosticsEngine &getDiagnostics() const {
@@ -8,6 +8,7 @@
 
 namespace tinylang {
 
+class IdentifierInfo;
 class Lexer;
 
 class Token {
@@ -22,6 +23,9 @@ class Token {
   /// Kind - The actual flavor of token this is.
   tok::TokenKind Kind;
 
+  /// The interned spelling of identifiers and keywords.
+  IdentifierInfo *II;
+
 public:
   tok::TokenKind getKind() const { return Kind; }
   void setKind(tok::TokenKind K) { Kind = K; }
@@ -45,6 +49,12 @@ public:
   }
   size_t getLength() const { return Length; }
 
+  IdentifierInfo *getIdentifierInfo() const {
+    assert(is(tok::identifier) &&
+           "Cannot get identfier of non-identifier");
+    return II;
+  }
+
   StringRef getIdentifier() {
     assert(is(tok::identifier) &&
            "Cannot get identfier of non-identifier");
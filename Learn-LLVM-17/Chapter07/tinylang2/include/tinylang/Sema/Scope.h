@@ -1,25 +1,56 @@
 #ifndef TINYLANG_SEMA_SCOPE_H
 #define TINYLANG_SEMA_SCOPE_H
 
+#include "tinylang/Basic/IdentifierTable.h"
 #include "tinylang/Basic/LLVM.h"
-#include "llvm/ADT/StringMap.h"
-#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Allocator.h"
 
 namespace tinylang {
 
 class Decl;
 
+/// A scope does not own a symbol table. The
+/// declarations visible under a name are chained from
+/// the IdentifierInfo of the name, innermost first, as
+/// in clang's IdentifierResolver. A lookup is therefore
+/// a single pointer access, and leaving a scope restores
+/// the declarations it shadowed.
 class Scope {
+  /// A declaration bound to a name in a scope.
+  struct Binding {
+    Decl *D;
+    Scope *S;
+    Binding *Shadowed;
+  };
+
   Scope *Parent;
-  StringMap<Decl *> Symbols;
+  llvm::BumpPtrAllocator &Allocator;
+
+  /// The names declared in this scope.
+  llvm::SmallVector<IdentifierInfo *, 8> Names;
 
 public:
-  Scope(Scope *Parent = nullptr) : Parent(Parent) {}
+  Scope(llvm::BumpPtrAllocator &Allocator,
+        Scope *Parent = nullptr)
+      : Parent(Parent), Allocator(Allocator) {}
+  ~Scope();
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+  /// Binds the declaration to the name. Returns false
+  /// if the name is already declared in this scope.
+  bool insert(IdentifierInfo *II, Decl *Declaration);
 
-  bool insert(Decl *Declaration);
-  Decl *lookup(StringRef Name);
+  /// Returns the innermost declaration of the name.
+  static Decl *lookup(IdentifierInfo *II) {
+    if (Binding *B = II->getFETokenInfo<Binding>())
+      return B->D;
+    return nullptr;
+  }
 
   Scope *getParent() { return Parent; }
 };
 } // namespace tinylang
-#endif
\ No newline at end of file
+#endif
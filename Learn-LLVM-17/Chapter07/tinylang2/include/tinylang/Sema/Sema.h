@@ -2,8 +2,10 @@
 #define TINYLANG_SEMA_SEMA_H
 
 #include "tinylang/AST/AST.h"
+#include "tinylang/AST/ASTContext.h"
 #include "tinylang/Basic/Diagnostic.h"
 #include "tinylang/Sema/Scope.h"
+#include "tinylang/Serialization/ModuleInterface.h"
 #include <memory>
 
 namespace tinylang {
@@ -17,11 +19,20 @@ class Sema {
                          TypeDeclaration *Ty);
 
   void checkFormalAndActualParameters(
-      SMLoc Loc, const FormalParamList &Formals,
-      const ExprList &Actuals);
+      SMLoc Loc,
+      ArrayRef<FormalParameterDeclaration *> Formals,
+      ArrayRef<Expr *> Actuals);
 
+  void addSelector(Designator *D, Selector *Sel);
+
+  bool evaluate(Expr *E, llvm::APSInt &Result);
+  Expr *foldBoolean(Expr *E);
+
+  /// The name bindings of all scopes.
+  llvm::BumpPtrAllocator ScopeAllocator;
   Scope *CurrentScope;
   Decl *CurrentDecl;
+  ASTContext &Context;
   DiagnosticsEngine &Diags;
 
   TypeDeclaration *IntegerType;
@@ -31,36 +42,57 @@ class Sema {
   ConstantDeclaration *TrueConst;
   ConstantDeclaration *FalseConst;
 
+  /// The directories searched for the interfaces of
+  /// imported modules.
+  std::vector<std::string> ImportPaths;
+  std::unique_ptr<ModuleLoader> Loader;
+
 public:
-  Sema(DiagnosticsEngine &Diags)
+  Sema(ASTContext &Context, DiagnosticsEngine &Diags,
+       ArrayRef<std::string> ImportPaths = {})
       : CurrentScope(nullptr), CurrentDecl(nullptr),
-        Diags(Diags) {
+        Context(Context), Diags(Diags),
+        ImportPaths(ImportPaths.begin(),
+                    ImportPaths.end()) {
     initialize();
   }
+  ~Sema();
 
   void initialize();
 
-  ModuleDeclaration *actOnModuleDeclaration(SMLoc Loc,
-                                            StringRef Name);
+  /// Returns the interface files of the imported modules.
+  ArrayRef<InterfaceFile> getImportedInterfaces() const {
+    return Loader->getFiles();
+  }
+
+  ModuleDeclaration *
+  actOnModuleDeclaration(SMLoc Loc, IdentifierInfo *II);
   void actOnModuleDeclaration(ModuleDeclaration *ModDecl,
-                              SMLoc Loc, StringRef Name,
+                              SMLoc Loc,
+                              IdentifierInfo *II,
                               DeclList &Decls,
                               StmtList &Stmts);
-  void actOnImport(StringRef ModuleName, IdentList &Ids);
+  void actOnImport(SMLoc Loc, IdentifierInfo *ModuleName,
+                   IdentList &Ids);
   void actOnConstantDeclaration(DeclList &Decls, SMLoc Loc,
-                                StringRef Name, Expr *E);
+                                IdentifierInfo *II,
+                                Expr *E);
   void actOnAliasTypeDeclaration(DeclList &Decls, SMLoc Loc,
-                                 StringRef Name, Decl *D);
-  void actOnArrayTypeDeclaration(DeclList &Decls, SMLoc Loc,
-                                 StringRef Name, Expr *E,
+                                 IdentifierInfo *II,
                                  Decl *D);
+  void actOnArrayTypeDeclaration(DeclList &Decls,
+                                 SMLoc Loc,
+                                 IdentifierInfo *II,
+                                 Expr *E, Decl *D);
   void actOnPointerTypeDeclaration(DeclList &Decls,
                                    SMLoc Loc,
-                                   StringRef Name, Decl *D);
+                                   IdentifierInfo *II,
+                                   Decl *D);
   void actOnFieldDeclaration(FieldList &Fields,
                              IdentList &Ids, Decl *D);
   void actOnRecordTypeDeclaration(DeclList &Decls,
-                                  SMLoc Loc, StringRef Name,
+                                  SMLoc Loc,
+                                  IdentifierInfo *II,
                                   const FieldList &Fields);
   void actOnVariableDeclaration(DeclList &Decls,
                                 IdentList &Ids, Decl *D);
@@ -69,13 +101,15 @@ public:
                                   IdentList &Ids, Decl *D,
                                   bool IsVar);
   ProcedureDeclaration *
-  actOnProcedureDeclaration(SMLoc Loc, StringRef Name);
+  actOnProcedureDeclaration(SMLoc Loc,
+                            IdentifierInfo *II);
   void actOnProcedureHeading(ProcedureDeclaration *ProcDecl,
                              FormalParamList &Params,
                              Decl *RetType);
   void actOnProcedureDeclaration(
       ProcedureDeclaration *ProcDecl, SMLoc Loc,
-      StringRef Name, DeclList &Decls, StmtList &Stmts);
+      IdentifierInfo *II, DeclList &Decls,
+      StmtList &Stmts);
   void actOnAssignment(StmtList &Stmts, SMLoc Loc, Expr *D,
                        Expr *E);
   void actOnProcCall(StmtList &Stmts, SMLoc Loc, Decl *D,
@@ -104,7 +138,7 @@ public:
   Expr *actOnDesignator(Decl *D);
   Expr *actOnFunctionCall(Decl *D, ExprList &Params);
   Decl *actOnQualIdentPart(Decl *Prev, SMLoc Loc,
-                           StringRef Name);
+                           IdentifierInfo *II);
 };
 
 class EnterDeclScope {
@@ -0,0 +1,109 @@
+#ifndef TINYLANG_SERIALIZATION_MODULEINTERFACE_H
+#define TINYLANG_SERIALIZATION_MODULEINTERFACE_H
+
+#include "tinylang/AST/AST.h"
+#include "tinylang/AST/ASTContext.h"
+#include "tinylang/Basic/Diagnostic.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+
+namespace tinylang {
+
+/// The interface of a module is the list of its
+/// declarations at module level. Compiling a module writes
+/// the interface in a compact binary form into the file
+/// <module name>.tli. An IMPORT reads this file instead of
+/// the source of the imported module.
+///
+/// All integers are little endian. A string is its length
+/// (uint32_t) followed by the characters. The file starts
+/// with the magic "TLMI", the format version (uint32_t),
+/// the module name and the number of declarations
+/// (uint32_t). Each declaration is its kind (uint8_t) and
+/// name, followed by the data of the kind. A reference to
+/// a type is a uint32_t: 0 is no type, 1 and 2 are INTEGER
+/// and BOOLEAN, and 3 + I is declaration I of the same
+/// file. ForeignTypeRef is followed by the name of a module
+/// and the name of a type it exports.
+namespace interface {
+constexpr char Magic[] = {'T', 'L', 'M', 'I'};
+constexpr uint32_t Version = 1;
+constexpr char Extension[] = ".tli";
+
+enum DeclKind : uint8_t {
+  Const,
+  AliasType,
+  ArrayType,
+  PointerType,
+  RecordType,
+  Var,
+  Proc
+};
+
+enum TypeRef : uint32_t {
+  NoTypeRef = 0,
+  IntegerTypeRef = 1,
+  BooleanTypeRef = 2,
+  FirstDeclTypeRef = 3,
+  ForeignTypeRef = ~0U
+};
+} // namespace interface
+
+/// An interface file read while compiling a module.
+struct InterfaceFile {
+  std::string Path;
+  /// The xxHash64 of the contents.
+  uint64_t Hash;
+};
+
+/// Writes the interface of Mod to OS.
+void writeModuleInterface(ModuleDeclaration *Mod,
+                          llvm::raw_ostream &OS);
+
+/// Finds and reads the interfaces of imported modules.
+/// The declarations of an interface are created in the
+/// ASTContext, once per module, so a type imported on two
+/// paths is still the same declaration.
+class ModuleLoader {
+  ASTContext &Context;
+  DiagnosticsEngine &Diags;
+  std::vector<std::string> SearchPaths;
+  TypeDeclaration *IntegerType;
+  TypeDeclaration *BooleanType;
+
+  /// The loaded modules. The entry is nullptr while the
+  /// module is read, or if reading failed.
+  llvm::StringMap<ModuleDeclaration *> Modules;
+
+  /// The interface files in the order they were read.
+  std::vector<InterfaceFile> Files;
+
+  ModuleDeclaration *read(SMLoc Loc, StringRef Name,
+                          StringRef Path);
+
+public:
+  ModuleLoader(ASTContext &Context,
+               DiagnosticsEngine &Diags,
+               ArrayRef<std::string> SearchPaths,
+               TypeDeclaration *IntegerType,
+               TypeDeclaration *BooleanType)
+      : Context(Context), Diags(Diags),
+        SearchPaths(SearchPaths.begin(),
+                    SearchPaths.end()),
+        IntegerType(IntegerType),
+        BooleanType(BooleanType) {}
+
+  /// Returns the module with the given name, or nullptr
+  /// if its interface cannot be read. Errors are reported
+  /// at Loc.
+  ModuleDeclaration *load(SMLoc Loc, StringRef Name);
+
+  /// Returns the interface files read so far. The output
+  /// of a compilation depends on their contents.
+  ArrayRef<InterfaceFile> getFiles() const { return Files; }
+};
+
+} // namespace tinylang
+#endif
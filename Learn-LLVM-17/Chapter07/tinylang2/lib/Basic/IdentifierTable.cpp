@@ -0,0 +1,8 @@
+#include "tinylang/Basic/IdentifierTable.h"
+
+using namespace tinylang;
+
+IdentifierTable::IdentifierTable() {
+#define KEYWORD(NAME, FLAGS) get(#NAME, tok::kw_##NAME);
+#include "tinylang/Basic/TokenKinds.def"
+}
@@ -69,11 +69,9 @@ CGDebugInfo::getArrayType(ArrayTypeDeclaration *Ty) {
   const llvm::DataLayout &DL =
       CGM.getModule()->getDataLayout();
 
-  Expr *Nums = Ty->getNums();
-  uint64_t NumElements = 5; // TODO Eval Nums
   llvm::SmallVector<llvm::Metadata *, 4> Subscripts;
-  Subscripts.push_back(
-      DBuilder.getOrCreateSubrange(0, NumElements));
+  Subscripts.push_back(DBuilder.getOrCreateSubrange(
+      0, Ty->getNumElements()));
   return DBuilder.createArrayType(
       DL.getTypeSizeInBits(ATy) * 8,
       1 << Log2(DL.getABITypeAlign(ATy)),
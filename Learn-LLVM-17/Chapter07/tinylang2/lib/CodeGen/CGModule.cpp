@@ -1,7 +1,14 @@
 #include "tinylang/CodeGen/CGModule.h"
 #include "tinylang/CodeGen/CGProcedure.h"
+#include "tinylang/CodeGen/CodeGenerator.h"
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/TimeProfiler.h"
 
 using namespace tinylang;
 
@@ -41,10 +48,8 @@ llvm::Type *CGModule::convertType(TypeDeclaration *Ty) {
   } else if (auto *ArrayTy =
                  llvm::dyn_cast<ArrayTypeDeclaration>(Ty)) {
     llvm::Type *Component = convertType(ArrayTy->getType());
-    Expr *Nums = ArrayTy->getNums();
-    uint64_t NumElements = 5; // TODO Eval Nums
-    llvm::Type *T =
-        llvm::ArrayType::get(Component, NumElements);
+    llvm::Type *T = llvm::ArrayType::get(
+        Component, ArrayTy->getNumElements());
     return TypeCache[Ty] = T;
   } else if (auto *RecordTy =
                  llvm ::dyn_cast<RecordTypeDeclaration>(
@@ -61,18 +66,11 @@ llvm::Type *CGModule::convertType(TypeDeclaration *Ty) {
 }
 
 std::string CGModule::mangleName(Decl *D) {
-  std::string Mangled;
-  llvm::SmallString<16> Tmp;
-  while (D) {
-    llvm::StringRef Name = D->getName();
-    Tmp.clear();
-    Tmp.append(llvm::itostr(Name.size()));
-    Tmp.append(Name);
-    Mangled.insert(0, Tmp.c_str());
-    D = D->getEnclosingDecl();
-  }
-  Mangled.insert(0, "_t");
-  return Mangled;
+  llvm::SmallVector<llvm::StringRef, 4> Names;
+  for (; D; D = D->getEnclosingDecl())
+    Names.push_back(D->getName());
+  std::reverse(Names.begin(), Names.end());
+  return CodeGenerator::mangleName(Names);
 }
 
 void CGModule::decorateInst(llvm::Instruction *Inst,
@@ -82,7 +80,18 @@ void CGModule::decorateInst(llvm::Instruction *Inst,
 }
 
 llvm::GlobalObject *CGModule::getGlobal(Decl *D) {
-  return Globals[D];
+  llvm::GlobalObject *&G = Globals[D];
+  // A variable of an imported module is declared on first
+  // use.
+  if (!G)
+    if (auto *Var = llvm::dyn_cast<VariableDeclaration>(D))
+      if (Var->getEnclosingDecl() != Mod)
+        G = new llvm::GlobalVariable(
+            *M, convertType(Var->getType()),
+            /*isConstant=*/false,
+            llvm::GlobalValue::ExternalLinkage, nullptr,
+            mangleName(Var));
+  return G;
 }
 
 void CGModule::applyLocation(llvm::Instruction *Inst,
@@ -96,11 +105,13 @@ void CGModule::run(ModuleDeclaration *Mod) {
   for (auto *Decl : Mod->getDecls()) {
     if (auto *Var =
             llvm::dyn_cast<VariableDeclaration>(Decl)) {
-      // Create global variables
+      // Create global variables. They are part of the
+      // module interface, so other modules can use them.
+      llvm::Type *Ty = convertType(Var->getType());
       llvm::GlobalVariable *V = new llvm::GlobalVariable(
-          *M, convertType(Var->getType()),
-          /*isConstant=*/false,
-          llvm::GlobalValue::PrivateLinkage, nullptr,
+          *M, Ty, /*isConstant=*/false,
+          llvm::GlobalValue::ExternalLinkage,
+          llvm::Constant::getNullValue(Ty),
           mangleName(Var));
       Globals[Var] = V;
       if (CGDebugInfo *Dbg = getDbgInfo())
@@ -108,10 +119,129 @@ void CGModule::run(ModuleDeclaration *Mod) {
     } else if (auto *Proc =
                    llvm::dyn_cast<ProcedureDeclaration>(
                        Decl)) {
-      CGProcedure CGP(*this);
-      CGP.run(Proc);
+      emitProcedure(Proc);
     }
   }
+  {
+    CGProcedure CGP(*this);
+    CGP.run();
+  }
+  {
+    llvm::TimeTraceScope Scope("InferAttributes");
+    inferAttributes();
+  }
   if (CGDebugInfo *Dbg = getDbgInfo())
     Dbg->finalize();
 }
+
+void CGModule::emitProcedure(ProcedureDeclaration *Proc) {
+  {
+    CGProcedure CGP(*this);
+    CGP.run(Proc);
+  }
+  for (auto *D : Proc->getDecls())
+    if (auto *Nested =
+            llvm::dyn_cast<ProcedureDeclaration>(D))
+      emitProcedure(Nested);
+}
+
+namespace {
+// Returns true if Fn modifies no memory visible to its
+// callers. Stores to its own stack slots do not count.
+bool onlyReadsMemory(llvm::Function &Fn) {
+  for (llvm::Instruction &I : llvm::instructions(Fn)) {
+    if (auto *Call = llvm::dyn_cast<llvm::CallInst>(&I)) {
+      llvm::Function *Callee = Call->getCalledFunction();
+      if (!Callee ||
+          (Callee != &Fn && !Callee->onlyReadsMemory()))
+        return false;
+    } else if (auto *Store =
+                   llvm::dyn_cast<llvm::StoreInst>(&I)) {
+      if (!llvm::isa<llvm::AllocaInst>(
+              llvm::getUnderlyingObject(
+                  Store->getPointerOperand())))
+        return false;
+    } else if (I.mayWriteToMemory())
+      return false;
+  }
+  return true;
+}
+
+// Returns true if Fn has no loop and calls only functions
+// which return. Recursion may not terminate.
+bool alwaysReturns(llvm::Function &Fn) {
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> Order;
+  llvm::ReversePostOrderTraversal<llvm::Function *> RPOT(
+      &Fn);
+  for (llvm::BasicBlock *BB : RPOT)
+    Order[BB] = Order.size();
+  for (llvm::BasicBlock *BB : RPOT) {
+    for (llvm::BasicBlock *Succ : llvm::successors(BB))
+      if (Order[Succ] <= Order[BB])
+        return false;
+    for (llvm::Instruction &I : *BB)
+      if (auto *Call = llvm::dyn_cast<llvm::CallInst>(&I)) {
+        llvm::Function *Callee = Call->getCalledFunction();
+        if (!Callee || Callee == &Fn ||
+            !Callee->willReturn())
+          return false;
+      }
+  }
+  return true;
+}
+
+// Returns true if at every call of Fn, argument ArgNo
+// points into a stack slot of the caller which is not
+// passed in any other argument. The callee has no other
+// way to reach the local variables of its caller.
+bool isNoAliasArg(llvm::Function &Fn, unsigned ArgNo) {
+  for (llvm::User *U : Fn.users()) {
+    auto *Call = llvm::dyn_cast<llvm::CallInst>(U);
+    if (!Call || Call->getCalledFunction() != &Fn)
+      return false;
+    const llvm::Value *Obj = llvm::getUnderlyingObject(
+        Call->getArgOperand(ArgNo));
+    if (!llvm::isa<llvm::AllocaInst>(Obj))
+      return false;
+    for (unsigned I = 0, E = Call->arg_size(); I != E; ++I)
+      if (I != ArgNo &&
+          Call->getArgOperand(I)->getType()->isPointerTy() &&
+          llvm::getUnderlyingObject(
+              Call->getArgOperand(I)) == Obj)
+        return false;
+  }
+  return true;
+}
+} // namespace
+
+// Derives readonly and willreturn for all procedures, and
+// noalias for the VAR parameters of procedures which are
+// not visible outside the module. Attributes of callees
+// are used, so iterate until nothing changes. Recursive
+// procedures keep the conservative result.
+void CGModule::inferAttributes() {
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (llvm::Function &Fn : *M) {
+      if (Fn.isDeclaration())
+        continue;
+      if (!Fn.onlyReadsMemory() && onlyReadsMemory(Fn)) {
+        Fn.setOnlyReadsMemory();
+        Changed = true;
+      }
+      if (!Fn.willReturn() && alwaysReturns(Fn)) {
+        Fn.setWillReturn();
+        Changed = true;
+      }
+    }
+  }
+  for (llvm::Function &Fn : *M) {
+    if (Fn.isDeclaration() || !Fn.hasLocalLinkage())
+      continue;
+    for (llvm::Argument &Arg : Fn.args())
+      if (Arg.getType()->isPointerTy() &&
+          isNoAliasArg(Fn, Arg.getArgNo()))
+        Arg.addAttr(llvm::Attribute::NoAlias);
+  }
+}
@@ -1,72 +1,122 @@
 #include "tinylang/CodeGen/CGProcedure.h"
+#include "llvm/ADT/SetVector.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/TimeProfiler.h"
 
 using namespace tinylang;
 
+// Marks a definition which is currently computed, to
+// detect a cycle back to its block.
+static llvm::Value *const Pending =
+    llvm::DenseMapInfo<llvm::Value *>::getTombstoneKey();
+
+llvm::Value *
+CGProcedure::getReplacement(llvm::PHINode *Phi) {
+  llvm::Value *Val = ReplacedPhis.lookup(Phi);
+  while (auto *P = llvm::dyn_cast<llvm::PHINode>(Val)) {
+    if (P->getParent())
+      break;
+    Val = ReplacedPhis.lookup(P);
+  }
+  return ReplacedPhis[Phi] = Val;
+}
+
 void CGProcedure::writeLocalVariable(llvm::BasicBlock *BB,
-                                     Decl *Decl,
+                                     unsigned Var,
                                      llvm::Value *Val) {
-  assert(BB && "Basic block is nullptr");
-  assert(
-      (llvm::isa<VariableDeclaration>(Decl) ||
-       llvm::isa<FormalParameterDeclaration>(Decl)) &&
-      "Declaration must be variable or formal parameter");
   assert(Val && "Value is nullptr");
-  CurrentDef[BB].Defs[Decl] = Val;
+  Defs[getBlockIndex(BB) * Vars.size() + Var] = Val;
 }
 
 llvm::Value *
 CGProcedure::readLocalVariable(llvm::BasicBlock *BB,
-                               Decl *Decl) {
-  assert(BB && "Basic block is nullptr");
-  assert(
-      (llvm::isa<VariableDeclaration>(Decl) ||
-       llvm::isa<FormalParameterDeclaration>(Decl)) &&
-      "Declaration must be variable or formal parameter");
-  auto Val = CurrentDef[BB].Defs.find(Decl);
-  if (Val != CurrentDef[BB].Defs.end())
-    return Val->second;
-  return readLocalVariableRecursive(BB, Decl);
+                               unsigned Var) {
+  llvm::Value *&Val =
+      Defs[getBlockIndex(BB) * Vars.size() + Var];
+  if (!Val)
+    return readLocalVariableRecursive(BB, Var);
+  if (Val == Pending) {
+    // The definition depends on itself, which requires
+    // a phi.
+    Val = addEmptyPhi(BB, Var);
+    return Val;
+  }
+  if (auto *Phi = llvm::dyn_cast<llvm::PHINode>(Val))
+    if (!Phi->getParent())
+      Val = getReplacement(Phi);
+  return Val;
 }
 
 llvm::Value *CGProcedure::readLocalVariableRecursive(
-    llvm::BasicBlock *BB, Decl *Decl) {
+    llvm::BasicBlock *BB, unsigned Var) {
   llvm::Value *Val = nullptr;
-  if (!CurrentDef[BB].Sealed) {
+  BasicBlockDef &Def = BlockDefs[getBlockIndex(BB)];
+  if (!Def.Sealed) {
     // Add incomplete phi for variable.
-    llvm::PHINode *Phi = addEmptyPhi(BB, Decl);
-    CurrentDef[BB].IncompletePhis[Phi] = Decl;
+    llvm::PHINode *Phi = addEmptyPhi(BB, Var);
+    Def.IncompletePhis.emplace_back(Phi, Var);
     Val = Phi;
   } else if (auto *PredBB = BB->getSinglePredecessor()) {
     // Only one predecessor.
-    Val = readLocalVariable(PredBB, Decl);
+    Val = readLocalVariable(PredBB, Var);
   } else {
-    // Create empty phi instruction to break potential
-    // cycles.
-    llvm::PHINode *Phi = addEmptyPhi(BB, Decl);
-    writeLocalVariable(BB, Decl, Phi);
-    Val = addPhiOperands(BB, Decl, Phi);
+    // Read the definitions of the predecessors first.
+    // Most of them are the same, and then no phi is
+    // needed, unless the reads reach this block again.
+    unsigned Idx = getBlockIndex(BB) * Vars.size() + Var;
+    Defs[Idx] = Pending;
+    llvm::SmallVector<llvm::Value *, 4> Incoming;
+    for (llvm::BasicBlock *Pred : llvm::predecessors(BB))
+      Incoming.push_back(readLocalVariable(Pred, Var));
+    // Reading a later predecessor may have replaced a
+    // trivial phi returned for an earlier one.
+    for (llvm::Value *&V : Incoming)
+      if (auto *Phi = llvm::dyn_cast<llvm::PHINode>(V))
+        if (!Phi->getParent())
+          V = getReplacement(Phi);
+    auto AddIncoming = [&](llvm::PHINode *Phi) {
+      llvm::Value **V = Incoming.begin();
+      for (llvm::BasicBlock *Pred : llvm::predecessors(BB))
+        Phi->addIncoming(*V++, Pred);
+    };
+    if (Defs[Idx] != Pending) {
+      auto *Phi = llvm::cast<llvm::PHINode>(Defs[Idx]);
+      AddIncoming(Phi);
+      Val = optimizePhi(Phi);
+    } else if (Incoming.empty()) {
+      // Not defined on any path.
+      Val = llvm::UndefValue::get(mapType(Vars[Var]));
+    } else if (llvm::all_equal(Incoming)) {
+      Val = Incoming.front();
+    } else {
+      llvm::PHINode *Phi = addEmptyPhi(BB, Var);
+      AddIncoming(Phi);
+      Val = Phi;
+    }
   }
-  writeLocalVariable(BB, Decl, Val);
+  writeLocalVariable(BB, Var, Val);
   return Val;
 }
 
 llvm::PHINode *
-CGProcedure::addEmptyPhi(llvm::BasicBlock *BB, Decl *Decl) {
+CGProcedure::addEmptyPhi(llvm::BasicBlock *BB,
+                         unsigned Var) {
   return BB->empty()
-             ? llvm::PHINode::Create(mapType(Decl), 0, "",
-                                     BB)
-             : llvm::PHINode::Create(mapType(Decl), 0, "",
-                                     &BB->front());
+             ? llvm::PHINode::Create(mapType(Vars[Var]), 0,
+                                     "", BB)
+             : llvm::PHINode::Create(mapType(Vars[Var]), 0,
+                                     "", &BB->front());
 }
 
-llvm::Value *CGProcedure::addPhiOperands(
-    llvm::BasicBlock *BB, Decl *Decl, llvm::PHINode *Phi) {
+llvm::Value *
+CGProcedure::addPhiOperands(llvm::BasicBlock *BB,
+                            unsigned Var,
+                            llvm::PHINode *Phi) {
   for (auto I = llvm::pred_begin(BB),
             E = llvm::pred_end(BB);
        I != E; ++I) {
-    Phi->addIncoming(readLocalVariable(*I, Decl), *I);
+    Phi->addIncoming(readLocalVariable(*I, Var), *I);
   }
   return optimizePhi(Phi);
 }
@@ -82,49 +132,60 @@ llvm::Value *CGProcedure::optimizePhi(llvm::PHINode *Phi) {
   }
   if (Same == nullptr)
     Same = llvm::UndefValue::get(Phi->getType());
-  // Collect phi instructions using this one.
-  llvm::SmallVector<llvm::PHINode *, 8> CandidatePhis;
+  // Collect phi instructions using this one. A phi may
+  // use it more than once.
+  llvm::SmallSetVector<llvm::PHINode *, 8> CandidatePhis;
   for (llvm::Use &U : Phi->uses()) {
     if (auto *P =
             llvm::dyn_cast<llvm::PHINode>(U.getUser()))
       if (P != Phi)
-        CandidatePhis.push_back(P);
+        CandidatePhis.insert(P);
   }
   Phi->replaceAllUsesWith(Same);
-  Phi->eraseFromParent();
+  Phi->dropAllReferences();
+  Phi->removeFromParent();
+  ReplacedPhis[Phi] = Same;
+  // Optimizing one candidate may already have removed a
+  // later one.
   for (auto *P : CandidatePhis)
-    optimizePhi(P);
+    if (P->getParent())
+      optimizePhi(P);
+  // That includes Same, if it is a phi.
+  if (auto *P = llvm::dyn_cast<llvm::PHINode>(Same))
+    if (!P->getParent())
+      return getReplacement(P);
   return Same;
 }
 
 void CGProcedure::sealBlock(llvm::BasicBlock *BB) {
-  assert(!CurrentDef[BB].Sealed &&
+  BasicBlockDef &Def = BlockDefs[getBlockIndex(BB)];
+  assert(!Def.Sealed &&
          "Attempt to seal already sealed block");
-  for (auto PhiDecl : CurrentDef[BB].IncompletePhis) {
-    addPhiOperands(BB, PhiDecl.second, PhiDecl.first);
+  for (auto [Phi, Var] : Def.IncompletePhis) {
+    addPhiOperands(BB, Var, Phi);
   }
-  CurrentDef[BB].IncompletePhis.clear();
-  CurrentDef[BB].Sealed = true;
+  Def.IncompletePhis.clear();
+  Def.Sealed = true;
 }
 
 void CGProcedure::writeVariable(llvm::BasicBlock *BB,
                                 Decl *D, llvm::Value *Val) {
   if (auto *V = llvm::dyn_cast<VariableDeclaration>(D)) {
     if (V->getEnclosingDecl() == Proc)
-      writeLocalVariable(BB, D, Val);
-    else if (V->getEnclosingDecl() ==
-             CGM.getModuleDeclaration()) {
+      writeLocalVariable(BB, getVarIndex(D), Val);
+    else if (llvm::isa<ModuleDeclaration>(
+                 V->getEnclosingDecl())) {
       Builder.CreateStore(Val, CGM.getGlobal(D));
     } else
-      llvm::report_fatal_error(
-          "Nested procedures not yet supported");
+      llvm_unreachable("Sema rejects access to a local of "
+                       "an enclosing procedure");
   } else if (auto *FP =
                  llvm::dyn_cast<FormalParameterDeclaration>(
                      D)) {
     if (FP->isVar()) {
       Builder.CreateStore(Val, FormalParams[FP]);
     } else
-      writeLocalVariable(BB, D, Val);
+      writeLocalVariable(BB, getVarIndex(D), Val);
   } else
     llvm::report_fatal_error("Unsupported declaration");
 }
@@ -134,16 +195,16 @@ llvm::Value *CGProcedure::readVariable(llvm::BasicBlock *BB,
                                        bool LoadVal) {
   if (auto *V = llvm::dyn_cast<VariableDeclaration>(D)) {
     if (V->getEnclosingDecl() == Proc)
-      return readLocalVariable(BB, D);
-    else if (V->getEnclosingDecl() ==
-             CGM.getModuleDeclaration()) {
+      return readLocalVariable(BB, getVarIndex(D));
+    else if (llvm::isa<ModuleDeclaration>(
+                 V->getEnclosingDecl())) {
       auto *Global = CGM.getGlobal(D);
       if (!LoadVal)
         return Global;
       return Builder.CreateLoad(mapType(D), Global);
     } else
-      llvm::report_fatal_error(
-          "Nested procedures not yet supported");
+      llvm_unreachable("Sema rejects access to a local of "
+                       "an enclosing procedure");
   } else if (auto *FP =
                  llvm::dyn_cast<FormalParameterDeclaration>(
                      D)) {
@@ -151,10 +212,10 @@ llvm::Value *CGProcedure::readVariable(llvm::BasicBlock *BB,
       if (!LoadVal)
         return FormalParams[FP];
       return Builder.CreateLoad(
-          mapType(FP)->getPointerTo(),
+          CGM.convertType(FP->getType()),
           FormalParams[FP]);
     } else
-      return readLocalVariable(BB, D);
+      return readLocalVariable(BB, getVarIndex(D));
   } else
     llvm::report_fatal_error("Unsupported declaration");
 }
@@ -191,9 +252,21 @@ llvm::FunctionType *CGProcedure::createFunctionType(
 llvm::Function *
 CGProcedure::createFunction(ProcedureDeclaration *Proc,
                             llvm::FunctionType *FTy) {
+  // Only procedures declared at module level can be
+  // called from outside the module. All others are
+  // private to the module, and use the fast calling
+  // convention. Imported procedures are only declared.
+  bool IsExported =
+      llvm::isa<ModuleDeclaration>(Proc->getEnclosingDecl());
   llvm::Function *Fn = llvm::Function::Create(
-      Fty, llvm::GlobalValue::ExternalLinkage,
+      FTy,
+      IsExported ? llvm::GlobalValue::ExternalLinkage
+                 : llvm::GlobalValue::InternalLinkage,
       CGM.mangleName(Proc), CGM.getModule());
+  if (!IsExported)
+    Fn->setCallingConv(llvm::CallingConv::Fast);
+  // Tinylang has no exceptions.
+  Fn->setDoesNotThrow();
   // Give parameters a name.
   size_t Idx = 0;
   for (auto I = Fn->arg_begin(), E = Fn->arg_end(); I != E;
@@ -212,15 +285,26 @@ CGProcedure::createFunction(ProcedureDeclaration *Proc,
     }
     Arg->setName(FP->getName());
   }
+  CGM.setGlobal(Proc, Fn);
   return Fn;
 }
 
+llvm::Function *
+CGProcedure::getFunction(ProcedureDeclaration *Proc) {
+  if (auto *Fn = CGM.getGlobal(Proc))
+    return llvm::cast<llvm::Function>(Fn);
+  return createFunction(Proc, createFunctionType(Proc));
+}
+
 llvm::Value *
 CGProcedure::emitInfixExpr(InfixExpression *E) {
+  tok::TokenKind Kind = E->getOperatorInfo().getKind();
+  if (Kind == tok::kw_AND || Kind == tok::kw_OR)
+    return emitLogicalExpr(E);
   llvm::Value *Left = emitExpr(E->getLeft());
   llvm::Value *Right = emitExpr(E->getRight());
   llvm::Value *Result = nullptr;
-  switch (E->getOperatorInfo().getKind()) {
+  switch (Kind) {
   case tok::plus:
     Result = Builder.CreateNSWAdd(Left, Right);
     break;
@@ -254,12 +338,6 @@ CGProcedure::emitInfixExpr(InfixExpression *E) {
   case tok::greaterequal:
     Result = Builder.CreateICmpSGE(Left, Right);
     break;
-  case tok::kw_AND:
-    Result = Builder.CreateAnd(Left, Right);
-    break;
-  case tok::kw_OR:
-    Result = Builder.CreateOr(Left, Right);
-    break;
   case tok::slash:
     // Divide by real numbers not supported.
     LLVM_FALLTHROUGH;
@@ -269,6 +347,41 @@ CGProcedure::emitInfixExpr(InfixExpression *E) {
   return Result;
 }
 
+// AND and OR only evaluate the right operand if the left
+// one does not already decide the result. The left operand
+// is emitted as a condition, and the result is merged with
+// a phi in the end block.
+llvm::Value *
+CGProcedure::emitLogicalExpr(InfixExpression *E) {
+  bool IsAnd =
+      E->getOperatorInfo().getKind() == tok::kw_AND;
+  llvm::BasicBlock *RhsBB = createBasicBlock(
+      IsAnd ? "and.rhs" : "or.rhs", Curr->getNextNode());
+  llvm::BasicBlock *EndBB = createBasicBlock(
+      IsAnd ? "and.end" : "or.end", RhsBB->getNextNode());
+
+  if (IsAnd)
+    emitBranchOnCond(E->getLeft(), RhsBB, EndBB);
+  else
+    emitBranchOnCond(E->getLeft(), EndBB, RhsBB);
+
+  setCurr(RhsBB);
+  sealBlock(RhsBB);
+  llvm::Value *Right = emitExpr(E->getRight());
+  llvm::BasicBlock *RhsEndBB = Curr;
+  Builder.CreateBr(EndBB);
+
+  setCurr(EndBB);
+  sealBlock(EndBB);
+  llvm::PHINode *Phi = Builder.CreatePHI(CGM.Int1Ty, 2);
+  llvm::Value *Decided =
+      llvm::ConstantInt::get(CGM.Int1Ty, !IsAnd);
+  for (llvm::BasicBlock *Pred : llvm::predecessors(EndBB))
+    Phi->addIncoming(Pred == RhsEndBB ? Right : Decided,
+                     Pred);
+  return Phi;
+}
+
 llvm::Value *
 CGProcedure::emitPrefixExpr(PrefixExpression *E) {
   llvm::Value *Result = emitExpr(E->getExpr());
@@ -295,59 +408,22 @@ llvm::Value *CGProcedure::emitExpr(Expr *E) {
                  llvm::dyn_cast<PrefixExpression>(E)) {
     return emitPrefixExpr(Prefix);
   } else if (auto *Var = llvm::dyn_cast<Designator>(E)) {
-    auto *Decl = Var->getDecl();
-    llvm::Value *Val = readVariable(Curr, Decl);
-    // With more languages features in place, here you
-    // need to add array and record support.
-    auto &Selectors = Var->getSelectors();
-    for (auto I = Selectors.begin(), E = Selectors.end();
-         I != E;
-         /* no increment */) {
-      if (auto *IdxSel =
-              llvm::dyn_cast<IndexSelector>(*I)) {
-        llvm::SmallVector<llvm::Value *, 4> IdxList;
-        while (I != E) {
-          if (auto *Sel =
-                  llvm::dyn_cast<IndexSelector>(*I)) {
-            IdxList.push_back(emitExpr(Sel->getIndex()));
-            ++I;
-          } else
-            break;
-        }
-        Val = Builder.CreateInBoundsGEP(Val->getType(), Val, IdxList);
-        Val = Builder.CreateLoad(
-            Val->getType(), Val);
-      } else if (auto *FieldSel =
-                     llvm::dyn_cast<FieldSelector>(*I)) {
-        llvm::SmallVector<llvm::Value *, 4> IdxList;
-        while (I != E) {
-          if (auto *Sel =
-                  llvm::dyn_cast<FieldSelector>(*I)) {
-            llvm::Value *V = llvm::ConstantInt::get(
-                CGM.Int64Ty, Sel->getIndex());
-            IdxList.push_back(V);
-            ++I;
-          } else
-            break;
-        }
-        Val = Builder.CreateInBoundsGEP(Val->getType(), Val, IdxList);
-        Val = Builder.CreateLoad(
-            Val->getType(), Val);
-      } else if (auto *DerefSel =
-                     llvm::dyn_cast<DereferenceSelector>(
-                         *I)) {
-        Val = Builder.CreateLoad(
-            Val->getType(), Val);
-        ++I;
-      } else {
-        llvm::report_fatal_error("Unsupported selector");
-      }
-    }
-
-    return Val;
+    if (Var->getSelectors().empty())
+      return readVariable(Curr, Var->getDecl());
+    llvm::Value *Addr = emitAddress(Var);
+    if (!Addr)
+      llvm::report_fatal_error("not implemented");
+    return Builder.CreateLoad(
+        CGM.convertType(Var->getType()), Addr);
   } else if (auto *Const =
                  llvm::dyn_cast<ConstantAccess>(E)) {
-    return emitExpr(Const->getDecl()->getExpr());
+    // Sema has already computed the value.
+    return llvm::ConstantInt::get(
+        CGM.convertType(Const->getType()),
+        Const->getDecl()->getValue());
+  } else if (auto *Call =
+                 llvm::dyn_cast<FunctionCallExpr>(E)) {
+    return emitCall(Call->getDecl(), Call->getParams());
   } else if (auto *IntLit =
                  llvm::dyn_cast<IntegerLiteral>(E)) {
     return llvm::ConstantInt::get(CGM.Int64Ty,
@@ -360,48 +436,155 @@ llvm::Value *CGProcedure::emitExpr(Expr *E) {
   llvm::report_fatal_error("Unsupported expression");
 }
 
+// Terminates the current block with a branch to TrueBB if
+// Cond holds, and to FalseBB otherwise. AND, OR and NOT
+// become control flow instead of values. The current block
+// is not sealed, but all blocks created here are.
+void CGProcedure::emitBranchOnCond(Expr *Cond,
+                                   llvm::BasicBlock *TrueBB,
+                                   llvm::BasicBlock *FalseBB) {
+  if (auto *Infix = llvm::dyn_cast<InfixExpression>(Cond)) {
+    tok::TokenKind Kind =
+        Infix->getOperatorInfo().getKind();
+    if (Kind == tok::kw_AND || Kind == tok::kw_OR) {
+      bool IsAnd = Kind == tok::kw_AND;
+      llvm::BasicBlock *RhsBB =
+          createBasicBlock(IsAnd ? "and.rhs" : "or.rhs",
+                           Curr->getNextNode());
+      if (IsAnd)
+        emitBranchOnCond(Infix->getLeft(), RhsBB,
+                         FalseBB);
+      else
+        emitBranchOnCond(Infix->getLeft(), TrueBB,
+                         RhsBB);
+      setCurr(RhsBB);
+      sealBlock(RhsBB);
+      emitBranchOnCond(Infix->getRight(), TrueBB, FalseBB);
+      return;
+    }
+  } else if (auto *Prefix =
+                 llvm::dyn_cast<PrefixExpression>(Cond)) {
+    if (Prefix->getOperatorInfo().getKind() ==
+        tok::kw_NOT) {
+      emitBranchOnCond(Prefix->getExpr(), FalseBB, TrueBB);
+      return;
+    }
+  } else if (auto *BoolLit =
+                 llvm::dyn_cast<BooleanLiteral>(Cond)) {
+    Builder.CreateBr(BoolLit->getValue() ? TrueBB
+                                         : FalseBB);
+    return;
+  }
+  Builder.CreateCondBr(emitExpr(Cond), TrueBB, FalseBB);
+}
+
 void CGProcedure::emitStmt(AssignmentStatement *Stmt) {
   auto *Val = emitExpr(Stmt->getExpr());
   Designator *Desig = Stmt->getVar();
-  auto &Selectors = Desig->getSelectors();
+  auto Selectors = Desig->getSelectors();
   if (Selectors.empty())
     writeVariable(Curr, Desig->getDecl(), Val);
-  else {
-    llvm::SmallVector<llvm::Value *, 4> IdxList;
-    // First index for GEP.
-    IdxList.push_back(
-        llvm::ConstantInt::get(CGM.Int32Ty, 0));
-    auto *Base =
-        readVariable(Curr, Desig->getDecl(), false);
-    for (auto I = Selectors.begin(), E = Selectors.end();
-         I != E; ++I) {
-      if (auto *IdxSel =
-              llvm::dyn_cast<IndexSelector>(*I)) {
-        IdxList.push_back(emitExpr(IdxSel->getIndex()));
-      } else if (auto *FieldSel =
-                     llvm::dyn_cast<FieldSelector>(*I)) {
-        llvm::Value *V = llvm::ConstantInt::get(
-            CGM.Int32Ty, FieldSel->getIndex());
-        IdxList.push_back(V);
-      } else {
-        llvm::report_fatal_error("not implemented");
-      }
+  else if (llvm::Value *Addr = emitAddress(Desig))
+    Builder.CreateStore(Val, Addr);
+  else
+    llvm::report_fatal_error("not implemented");
+}
+
+// Returns the address of the variable denoted by Desig, or
+// nullptr if the variable lives in an SSA register.
+llvm::Value *CGProcedure::emitAddress(Designator *Desig) {
+  Decl *D = Desig->getDecl();
+  TypeDeclaration *Ty;
+  if (auto *FP =
+          llvm::dyn_cast<FormalParameterDeclaration>(D)) {
+    if (!FP->isVar())
+      return nullptr;
+    Ty = FP->getType();
+  } else {
+    auto *Var = llvm::cast<VariableDeclaration>(D);
+    if (Var->getEnclosingDecl() == Proc &&
+        !mapType(Var)->isAggregateType())
+      return nullptr;
+    Ty = Var->getType();
+  }
+  llvm::Value *Base = readVariable(Curr, D, false);
+  auto Selectors = Desig->getSelectors();
+  if (Selectors.empty())
+    return Base;
+  llvm::SmallVector<llvm::Value *, 4> IdxList;
+  // First index for GEP.
+  IdxList.push_back(CGM.Int32Zero);
+  for (auto *Sel : Selectors) {
+    if (auto *IdxSel = llvm::dyn_cast<IndexSelector>(Sel))
+      IdxList.push_back(emitExpr(IdxSel->getIndex()));
+    else if (auto *FieldSel =
+                 llvm::dyn_cast<FieldSelector>(Sel))
+      IdxList.push_back(llvm::ConstantInt::get(
+          CGM.Int32Ty, FieldSel->getIndex()));
+    else
+      llvm::report_fatal_error("not implemented");
+  }
+  return Builder.CreateInBoundsGEP(CGM.convertType(Ty),
+                                   Base, IdxList);
+}
+
+llvm::CallInst *
+CGProcedure::emitCall(ProcedureDeclaration *Callee,
+                      ArrayRef<Expr *> Params) {
+  llvm::Function *CalleeFn = getFunction(Callee);
+  auto Formals = Callee->getFormalParams();
+  llvm::SmallVector<llvm::Value *, 8> Args;
+  // A variable in an SSA register is passed to a VAR
+  // parameter in a stack slot, and read back after the
+  // call. A variable passed twice uses one slot, so that
+  // both parameters denote the same variable.
+  llvm::SmallVector<std::pair<Decl *, llvm::AllocaInst *>,
+                    4>
+      CopyBack;
+  for (size_t I = 0, E = Params.size(); I != E; ++I) {
+    if (!Formals[I]->isVar()) {
+      Args.push_back(emitExpr(Params[I]));
+      continue;
     }
-    if (!IdxList.empty()) {
-      if (Base->getType()->isPointerTy()) {
-        Base = Builder.CreateInBoundsGEP(
-            mapType(Desig->getDecl()), Base, IdxList);
-        Builder.CreateStore(Val, Base);
-      } else {
+    auto *Desig = llvm::cast<Designator>(Params[I]);
+    llvm::Value *Addr = emitAddress(Desig);
+    if (!Addr) {
+      if (!Desig->getSelectors().empty())
         llvm::report_fatal_error("not implemented");
-        //Builder.CreateInsertValue(Base, Val, IdxList);
+      Decl *D = Desig->getDecl();
+      auto It = llvm::find_if(CopyBack, [D](auto &Copy) {
+        return Copy.first == D;
+      });
+      if (It != CopyBack.end()) {
+        Args.push_back(It->second);
+        continue;
       }
+      llvm::BasicBlock &Entry = Fn->getEntryBlock();
+      llvm::IRBuilder<> EntryBuilder(&Entry,
+                                     Entry.begin());
+      llvm::AllocaInst *Slot =
+          EntryBuilder.CreateAlloca(mapType(D));
+      Builder.CreateStore(readVariable(Curr, D), Slot);
+      CopyBack.emplace_back(D, Slot);
+      Addr = Slot;
     }
+    Args.push_back(Addr);
   }
+  llvm::CallInst *Call = Builder.CreateCall(CalleeFn, Args);
+  Call->setCallingConv(CalleeFn->getCallingConv());
+  // Calls need a location if the callee has debug info.
+  // The module body has no debug info.
+  if (Proc)
+    CGM.applyLocation(Call, Proc->getLocation());
+  for (auto &[D, Slot] : CopyBack)
+    writeVariable(
+        Curr, D,
+        Builder.CreateLoad(Slot->getAllocatedType(), Slot));
+  return Call;
 }
 
 void CGProcedure::emitStmt(ProcedureCallStatement *Stmt) {
-  llvm::report_fatal_error("not implemented");
+  emitCall(Stmt->getProc(), Stmt->getParams());
 }
 
 void CGProcedure::emitStmt(IfStatement *Stmt) {
@@ -414,32 +597,33 @@ void CGProcedure::emitStmt(IfStatement *Stmt) {
   llvm::BasicBlock *AfterIfBB =
       createBasicBlock("after.if");
 
-  llvm::Value *Cond = emitExpr(Stmt->getCond());
-  Builder.CreateCondBr(Cond, IfBB,
-                       HasElse ? ElseBB : AfterIfBB);
-  sealBlock(Curr);
+  emitBranchOnCond(Stmt->getCond(), IfBB,
+                   HasElse ? ElseBB : AfterIfBB);
 
   setCurr(IfBB);
+  sealBlock(IfBB);
   emit(Stmt->getIfStmts());
   if (!Curr->getTerminator()) {
     Builder.CreateBr(AfterIfBB);
   }
-  sealBlock(Curr);
 
   if (HasElse) {
     setCurr(ElseBB);
+    sealBlock(ElseBB);
     emit(Stmt->getElseStmts());
     if (!Curr->getTerminator()) {
       Builder.CreateBr(AfterIfBB);
     }
-    sealBlock(Curr);
   }
   setCurr(AfterIfBB);
+  sealBlock(AfterIfBB);
 }
 
 void CGProcedure::emitStmt(WhileStatement *Stmt) {
-  // The basic block for the condition.
-  llvm::BasicBlock *WhileCondBB;
+  // The basic block for the condition. It is the loop
+  // header, so it is sealed after the back edge is added.
+  llvm::BasicBlock *WhileCondBB =
+      createBasicBlock("while.cond");
   // The basic block for the while body.
   llvm::BasicBlock *WhileBodyBB =
       createBasicBlock("while.body");
@@ -447,26 +631,21 @@ void CGProcedure::emitStmt(WhileStatement *Stmt) {
   llvm::BasicBlock *AfterWhileBB =
       createBasicBlock("after.while");
 
-  if (Curr->empty()) {
-    Curr->setName("while.cond");
-    WhileCondBB = Curr;
-  } else {
-    WhileCondBB = createBasicBlock("while.cond");
-    Builder.CreateBr(WhileCondBB);
-    sealBlock(Curr);
-    setCurr(WhileCondBB);
-  }
-
-  llvm::Value *Cond = emitExpr(Stmt->getCond());
-  Builder.CreateCondBr(Cond, WhileBodyBB, AfterWhileBB);
+  Builder.CreateBr(WhileCondBB);
+  setCurr(WhileCondBB);
+  emitBranchOnCond(Stmt->getCond(), WhileBodyBB,
+                   AfterWhileBB);
 
   setCurr(WhileBodyBB);
+  sealBlock(WhileBodyBB);
   emit(Stmt->getWhileStmts());
-  Builder.CreateBr(WhileCondBB);
+  if (!Curr->getTerminator()) {
+    Builder.CreateBr(WhileCondBB);
+  }
   sealBlock(WhileCondBB);
-  sealBlock(Curr);
 
   setCurr(AfterWhileBB);
+  sealBlock(AfterWhileBB);
 }
 
 void CGProcedure::emitStmt(ReturnStatement *Stmt) {
@@ -478,7 +657,7 @@ void CGProcedure::emitStmt(ReturnStatement *Stmt) {
   }
 }
 
-void CGProcedure::emit(const StmtList &Stmts) {
+void CGProcedure::emit(ArrayRef<Stmt *> Stmts) {
   for (auto *S : Stmts) {
     if (auto *Stmt = llvm::dyn_cast<AssignmentStatement>(S))
       emitStmt(Stmt);
@@ -498,14 +677,32 @@ void CGProcedure::emit(const StmtList &Stmts) {
 }
 
 void CGProcedure::run(ProcedureDeclaration *Proc) {
+  llvm::TimeTraceScope Scope("IRGen Procedure",
+                             Proc->getName());
   this->Proc = Proc;
-  Fty = createFunctionType(Proc);
-  Fn = createFunction(Proc, Fty);
+  Fn = getFunction(Proc);
+  Fty = Fn->getFunctionType();
   if (CGDebugInfo *Dbg = CGM.getDbgInfo())
     Dbg->emitProcedure(Proc, Fn);
 
+  // Number the variables which live in SSA registers
+  // before the first block is created.
+  for (auto *FP : Proc->getFormalParams()) {
+    VarIndex[FP] = Vars.size();
+    Vars.push_back(FP);
+  }
+  for (auto *D : Proc->getDecls()) {
+    if (llvm::isa<VariableDeclaration>(D)) {
+      VarIndex[D] = Vars.size();
+      Vars.push_back(D);
+    }
+  }
+
+  // Blocks are sealed as soon as all their predecessors
+  // are known. The entry block has none.
   llvm::BasicBlock *BB = createBasicBlock("entry");
   setCurr(BB);
+  sealBlock(BB);
 
   size_t Idx = 0;
   for (auto I = Fn->arg_begin(), E = Fn->arg_end(); I != E;
@@ -516,7 +713,7 @@ void CGProcedure::run(ProcedureDeclaration *Proc) {
     // Create mapping FormalParameter -> llvm::Argument
     // for VAR parameters.
     FormalParams[FP] = Arg;
-    writeLocalVariable(Curr, FP, Arg);
+    writeLocalVariable(Curr, getVarIndex(FP), Arg);
     if (CGDebugInfo *Dbg = CGM.getDbgInfo())
       DIVariables[FP] =
           Dbg->emitParameterVariable(FP, Idx + 1, Arg, BB);
@@ -528,7 +725,8 @@ void CGProcedure::run(ProcedureDeclaration *Proc) {
       llvm::Type *Ty = mapType(Var);
       if (Ty->isAggregateType()) {
         llvm::Value *Val = Builder.CreateAlloca(Ty);
-        writeLocalVariable(Curr, Var, Val);
+        writeLocalVariable(Curr, getVarIndex(Var),
+                           Val);
       }
     }
   }
@@ -538,9 +736,33 @@ void CGProcedure::run(ProcedureDeclaration *Proc) {
   if (!Curr->getTerminator()) {
     Builder.CreateRetVoid();
   }
-  sealBlock(Curr);
   if (CGDebugInfo *Dbg = CGM.getDbgInfo())
     Dbg->emitProcedureEnd(Proc, Fn);
+
+  // Nothing refers to the trivial phis any more.
+  for (auto &Replaced : ReplacedPhis)
+    Replaced.first->deleteValue();
 }
 
-void CGProcedure::run() {}
+// Emits the module body as a procedure named like the module.
+void CGProcedure::run() {
+  ModuleDeclaration *Mod = CGM.getModuleDeclaration();
+  llvm::TimeTraceScope Scope("IRGen Procedure", Mod->getName());
+  Proc = nullptr;
+  Fty = llvm::FunctionType::get(CGM.VoidTy,
+                                /*isVarArg=*/false);
+  Fn = llvm::Function::Create(
+      Fty, llvm::GlobalValue::ExternalLinkage,
+      CGM.mangleName(Mod), CGM.getModule());
+  Fn->setDoesNotThrow();
+
+  llvm::BasicBlock *BB = createBasicBlock("entry");
+  setCurr(BB);
+  sealBlock(BB);
+  emit(Mod->getStmts());
+  if (!Curr->getTerminator())
+    Builder.CreateRetVoid();
+
+  for (auto &Replaced : ReplacedPhis)
+    Replaced.first->deleteValue();
+}
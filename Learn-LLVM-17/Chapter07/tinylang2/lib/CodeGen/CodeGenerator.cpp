@@ -18,6 +18,7 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/TimeProfiler.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace tinylang;
@@ -26,7 +27,17 @@ CodeGenerator *CodeGenerator::create(llvm::LLVMContext &Ctx, ASTContext &ASTCtx,
   return new CodeGenerator(Ctx, ASTCtx, TM);
 }
 
+std::string CodeGenerator::mangleName(llvm::ArrayRef<llvm::StringRef> Names) {
+  std::string Mangled = "_t";
+  for (llvm::StringRef Name : Names) {
+    Mangled.append(llvm::itostr(Name.size()));
+    Mangled.append(Name.str());
+  }
+  return Mangled;
+}
+
 std::unique_ptr<llvm::Module> CodeGenerator::run(ModuleDeclaration *Mod, std::string FileName) {
+  llvm::TimeTraceScope Scope("IRGen", FileName);
   std::unique_ptr<llvm::Module> M = std::make_unique<llvm::Module>(FileName, Ctx);
   M->setTargetTriple(TM->getTargetTriple().getTriple());
   M->setDataLayout(TM->createDataLayout());
@@ -1,17 +1,16 @@
 #include "tinylang/Lexer/Lexer.h"
+#include "llvm/ADT/bit.h"
+#include <cstddef>
+#include <cstdint>
 
-using namespace tinylang;
-
-void KeywordFilter::addKeyword(StringRef Keyword,
-                               tok::TokenKind TokenCode) {
-  HashTable.insert(std::make_pair(Keyword, TokenCode));
-}
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
-void KeywordFilter::addKeywords() {
-#define KEYWORD(NAME, FLAGS)                               \
-  addKeyword(StringRef(#NAME), tok::kw_##NAME);
-#include "tinylang/Basic/TokenKinds.def"
-}
+using namespace tinylang;
 
 namespace charinfo {
 LLVM_READNONE inline bool isASCII(char Ch) {
@@ -52,10 +51,176 @@ LLVM_READNONE inline bool isIdentifierBody(char Ch) {
 }
 } // namespace charinfo
 
-void Lexer::next(Token &Result) {
-  while (*CurPtr && charinfo::isWhitespace(*CurPtr)) {
-    ++CurPtr;
+// Block scanners for the hot loops of the lexer. Each
+// character class below says where a scan stops, both
+// for a single character and for a whole vector of
+// characters. scan::skip() then consumes 32 (AVX2) or
+// 16 (SSE2) bytes per step while a full vector fits
+// into the buffer, and finishes the tail one character
+// at a time. Without SSE2 only the scalar loop is used.
+namespace scan {
+#if defined(__SSE2__)
+struct SSE2 {
+  using Vec = __m128i;
+  static constexpr ptrdiff_t Width = 16;
+  static Vec load(const char *Ptr) {
+    return _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(Ptr));
+  }
+  static Vec splat(char Ch) { return _mm_set1_epi8(Ch); }
+  static Vec eq(Vec A, Vec B) {
+    return _mm_cmpeq_epi8(A, B);
+  }
+  static Vec sub(Vec A, Vec B) {
+    return _mm_sub_epi8(A, B);
+  }
+  static Vec minU(Vec A, Vec B) {
+    return _mm_min_epu8(A, B);
+  }
+  static Vec bitOr(Vec A, Vec B) {
+    return _mm_or_si128(A, B);
+  }
+  static uint32_t mask(Vec A) {
+    return static_cast<uint32_t>(_mm_movemask_epi8(A));
+  }
+};
+#endif
+
+#if defined(__AVX2__)
+struct AVX2 {
+  using Vec = __m256i;
+  static constexpr ptrdiff_t Width = 32;
+  static Vec load(const char *Ptr) {
+    return _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(Ptr));
+  }
+  static Vec splat(char Ch) { return _mm256_set1_epi8(Ch); }
+  static Vec eq(Vec A, Vec B) {
+    return _mm256_cmpeq_epi8(A, B);
+  }
+  static Vec sub(Vec A, Vec B) {
+    return _mm256_sub_epi8(A, B);
+  }
+  static Vec minU(Vec A, Vec B) {
+    return _mm256_min_epu8(A, B);
+  }
+  static Vec bitOr(Vec A, Vec B) {
+    return _mm256_or_si256(A, B);
+  }
+  static uint32_t mask(Vec A) {
+    return static_cast<uint32_t>(
+        _mm256_movemask_epi8(A));
+  }
+};
+#endif
+
+/// Marks the bytes of V in the range [Lo, Lo + Len].
+/// The subtraction wraps, so one unsigned compare
+/// checks both bounds.
+template <typename Ops>
+inline typename Ops::Vec inRange(typename Ops::Vec V,
+                                 char Lo, char Len) {
+  typename Ops::Vec Off = Ops::sub(V, Ops::splat(Lo));
+  return Ops::eq(Ops::minU(Off, Ops::splat(Len)), Off);
+}
+
+/// Stops at the first non-whitespace character.
+struct Whitespace {
+  static bool stop(char Ch) {
+    return !charinfo::isWhitespace(Ch);
+  }
+  // '\t', '\n', '\v', '\f' and '\r' are consecutive.
+  template <typename Ops>
+  static uint32_t keep(typename Ops::Vec V) {
+    return Ops::mask(Ops::bitOr(
+        inRange<Ops>(V, '\t', '\r' - '\t'),
+        Ops::eq(V, Ops::splat(' '))));
+  }
+};
+
+/// Stops at the first character which cannot continue
+/// an identifier.
+struct IdentifierBody {
+  static bool stop(char Ch) {
+    return !charinfo::isIdentifierBody(Ch);
+  }
+  // Setting bit 5 maps upper case to lower case letters
+  // and leaves no other character in 'a'..'z'.
+  template <typename Ops>
+  static uint32_t keep(typename Ops::Vec V) {
+    typename Ops::Vec Lower =
+        Ops::bitOr(V, Ops::splat(0x20));
+    return Ops::mask(Ops::bitOr(
+        Ops::bitOr(inRange<Ops>(Lower, 'a', 'z' - 'a'),
+                   inRange<Ops>(V, '0', '9' - '0')),
+        Ops::eq(V, Ops::splat('_'))));
+  }
+};
+
+/// Stops at a character which may start or end a
+/// comment, or at the terminating NUL.
+struct CommentText {
+  static bool stop(char Ch) {
+    return Ch == '(' || Ch == '*' || Ch == '\0';
+  }
+  template <typename Ops>
+  static uint32_t keep(typename Ops::Vec V) {
+    return ~Ops::mask(Ops::bitOr(
+        Ops::bitOr(Ops::eq(V, Ops::splat('(')),
+                   Ops::eq(V, Ops::splat('*'))),
+        Ops::eq(V, Ops::splat('\0'))));
+  }
+};
+
+/// Advances Ptr by whole vectors of Ops::Width bytes.
+/// Returns true and updates Ptr to the first stop
+/// character if one is found. Otherwise Ptr is left at
+/// the last position from which no full vector can be
+/// loaded.
+template <typename Ops, typename CharClass>
+inline bool skipBlocks(const char *&Ptr,
+                       const char *End) {
+  constexpr uint32_t All =
+      Ops::Width == 32 ? ~0U : (1U << Ops::Width) - 1;
+  while (End - Ptr >= Ops::Width) {
+    uint32_t Stop =
+        ~CharClass::template keep<Ops>(Ops::load(Ptr)) &
+        All;
+    if (Stop) {
+      Ptr += llvm::countr_zero(Stop);
+      return true;
+    }
+    Ptr += Ops::Width;
   }
+  return false;
+}
+
+/// Returns the first character in [Ptr, End) at which
+/// CharClass stops, or End.
+template <typename CharClass>
+LLVM_READONLY inline const char *skip(const char *Ptr,
+                                      const char *End) {
+  // Most runs are short. Check the first character
+  // before paying for a vector load.
+  if (Ptr == End || CharClass::stop(*Ptr))
+    return Ptr;
+#if defined(__AVX2__)
+  if (skipBlocks<AVX2, CharClass>(Ptr, End))
+    return Ptr;
+#endif
+#if defined(__SSE2__)
+  if (skipBlocks<SSE2, CharClass>(Ptr, End))
+    return Ptr;
+#endif
+  while (Ptr != End && !CharClass::stop(*Ptr))
+    ++Ptr;
+  return Ptr;
+}
+} // namespace scan
+
+void Lexer::next(Token &Result) {
+  CurPtr = scan::skip<scan::Whitespace>(CurPtr,
+                                        CurBuf.end());
   if (!*CurPtr) {
     Result.setKind(tok::eof);
     return;
@@ -123,12 +288,12 @@ void Lexer::next(Token &Result) {
 
 void Lexer::identifier(Token &Result) {
   const char *Start = CurPtr;
-  const char *End = CurPtr + 1;
-  while (charinfo::isIdentifierBody(*End))
-    ++End;
-  StringRef Name(Start, End - Start);
-  formToken(Result, End,
-            Keywords.getKeyword(Name, tok::identifier));
+  const char *End = scan::skip<scan::IdentifierBody>(
+      CurPtr + 1, CurBuf.end());
+  IdentifierInfo &II =
+      Idents.get(StringRef(Start, End - Start));
+  formToken(Result, End, II.getTokenID());
+  Result.II = &II;
 }
 
 void Lexer::number(Token &Result) {
@@ -174,7 +339,12 @@ void Lexer::string(Token &Result) {
 void Lexer::comment() {
   const char *End = CurPtr + 2;
   unsigned Level = 1;
-  while (*End && Level) {
+  while (Level) {
+    // Jump to the next character of interest.
+    End = scan::skip<scan::CommentText>(End,
+                                        CurBuf.end());
+    if (!*End)
+      break;
     // Check for nested comment.
     if (*End == '(' && *(End + 1) == '*') {
       End += 2;
@@ -200,5 +370,6 @@ void Lexer::formToken(Token &Result, const char *TokEnd,
   Result.Ptr = CurPtr;;
   Result.Length = TokLen;
   Result.Kind = Kind;
+  Result.II = nullptr;
   CurPtr = TokEnd;
 }
\ No newline at end of file
@@ -30,7 +30,7 @@ bool Parser::parseCompilationUnit(
     if (expect(tok::identifier))
       return _errorhandler();
     D = Actions.actOnModuleDeclaration(
-        Tok.getLocation(), Tok.getIdentifier());
+        Tok.getLocation(), Tok.getIdentifierInfo());
 
     EnterDeclScope S(Actions, D);
     advance();
@@ -46,9 +46,9 @@ bool Parser::parseCompilationUnit(
       return _errorhandler();
     if (expect(tok::identifier))
       return _errorhandler();
-    Actions.actOnModuleDeclaration(D, Tok.getLocation(),
-                                   Tok.getIdentifier(),
-                                   Decls, Stmts);
+    Actions.actOnModuleDeclaration(
+        D, Tok.getLocation(), Tok.getIdentifierInfo(),
+        Decls, Stmts);
     advance();
     if (consume(tok::period))
       return _errorhandler();
@@ -63,12 +63,14 @@ bool Parser::parseImport() {
                       tok::kw_TYPE, tok::kw_VAR);
   };
     IdentList Ids;
-    StringRef ModuleName;
+    IdentifierInfo *ModuleName = nullptr;
+    SMLoc ModuleLoc;
     if (Tok.is(tok::kw_FROM)) {
       advance();
       if (expect(tok::identifier))
         return _errorhandler();
-      ModuleName = Tok.getIdentifier();
+      ModuleLoc = Tok.getLocation();
+      ModuleName = Tok.getIdentifierInfo();
       advance();
     }
     if (consume(tok::kw_IMPORT))
@@ -77,7 +79,7 @@ bool Parser::parseImport() {
       return _errorhandler();
     if (expect(tok::semi))
       return _errorhandler();
-    Actions.actOnImport(ModuleName, Ids);
+    Actions.actOnImport(ModuleLoc, ModuleName, Ids);
     advance();
     return false;
 }
@@ -152,7 +154,7 @@ bool Parser::parseConstantDeclaration(DeclList &Decls) {
       return _errorhandler();
     SMLoc Loc = Tok.getLocation();
 
-    StringRef Name = Tok.getIdentifier();
+    IdentifierInfo *II = Tok.getIdentifierInfo();
     advance();
     if (expect(tok::equal))
       return _errorhandler();
@@ -160,7 +162,7 @@ bool Parser::parseConstantDeclaration(DeclList &Decls) {
     advance();
     if (parseExpression(E))
       return _errorhandler();
-    Actions.actOnConstantDeclaration(Decls, Loc, Name,
+    Actions.actOnConstantDeclaration(Decls, Loc, II,
                                      E);
     return false;
 }
@@ -173,7 +175,7 @@ bool Parser::parseTypeDeclaration(DeclList &Decls) {
       return _errorhandler();
     SMLoc Loc = Tok.getLocation();
 
-    StringRef Name = Tok.getIdentifier();
+    IdentifierInfo *II = Tok.getIdentifierInfo();
     advance();
     if (consume(tok::equal))
       return _errorhandler();
@@ -182,7 +184,7 @@ bool Parser::parseTypeDeclaration(DeclList &Decls) {
       if (parseQualident(D))
         return _errorhandler();
       Actions.actOnAliasTypeDeclaration(Decls, Loc,
-                                        Name, D);
+                                        II, D);
     } else if (Tok.is(tok::kw_POINTER)) {
       advance();
       if (expect(tok::kw_TO))
@@ -192,7 +194,7 @@ bool Parser::parseTypeDeclaration(DeclList &Decls) {
       if (parseQualident(D))
         return _errorhandler();
       Actions.actOnPointerTypeDeclaration(Decls, Loc,
-                                          Name, D);
+                                          II, D);
     } else if (Tok.is(tok::kw_ARRAY)) {
       advance();
       if (expect(tok::l_square))
@@ -210,7 +212,7 @@ bool Parser::parseTypeDeclaration(DeclList &Decls) {
       if (parseQualident(D))
         return _errorhandler();
       Actions.actOnArrayTypeDeclaration(Decls, Loc,
-                                        Name, E, D);
+                                        II, E, D);
     } else if (Tok.is(tok::kw_RECORD)) {
       FieldList Fields;
       advance();
@@ -219,7 +221,7 @@ bool Parser::parseTypeDeclaration(DeclList &Decls) {
       if (expect(tok::kw_END))
         return _errorhandler();
       Actions.actOnRecordTypeDeclaration(Decls, Loc,
-                                         Name, Fields);
+                                         II, Fields);
       advance();
     } else {
       /*ERROR*/
@@ -285,7 +287,7 @@ bool Parser::parseProcedureDeclaration(
       return _errorhandler();
     ProcedureDeclaration *D =
         Actions.actOnProcedureDeclaration(
-            Tok.getLocation(), Tok.getIdentifier());
+            Tok.getLocation(), Tok.getIdentifierInfo());
 
     EnterDeclScope S(Actions, D);
     FormalParamList Params;
@@ -306,7 +308,7 @@ bool Parser::parseProcedureDeclaration(
     if (expect(tok::identifier))
       return _errorhandler();
     Actions.actOnProcedureDeclaration(
-        D, Tok.getLocation(), Tok.getIdentifier(),
+        D, Tok.getLocation(), Tok.getIdentifierInfo(),
         Decls, Stmts);
 
     ParentDecls.push_back(D);
@@ -803,16 +805,17 @@ bool Parser::parseQualident(Decl *&D) {
     D = nullptr;
     if (expect(tok::identifier))
       return _errorhandler();
-    D = Actions.actOnQualIdentPart(D, Tok.getLocation(),
-                                   Tok.getIdentifier());
+    D = Actions.actOnQualIdentPart(
+        D, Tok.getLocation(), Tok.getIdentifierInfo());
     advance();
     while (Tok.is(tok::period) &&
-           (isa<ModuleDeclaration>(D))) {
+           llvm::isa_and_nonnull<ModuleDeclaration>(D)) {
       advance();
       if (expect(tok::identifier))
         return _errorhandler();
       D = Actions.actOnQualIdentPart(
-          D, Tok.getLocation(), Tok.getIdentifier());
+          D, Tok.getLocation(),
+          Tok.getIdentifierInfo());
       advance();
     }
     return false;
@@ -824,15 +827,15 @@ bool Parser::parseIdentList(IdentList &Ids) {
   };
   if (expect(tok::identifier))
     return _errorhandler();
-  Ids.push_back(std::pair<SMLoc, StringRef>(
-      Tok.getLocation(), Tok.getIdentifier()));
+  Ids.push_back(std::pair<SMLoc, IdentifierInfo *>(
+      Tok.getLocation(), Tok.getIdentifierInfo()));
   advance();
   while (Tok.is(tok::comma)) {
     advance();
     if (expect(tok::identifier))
       return _errorhandler();
-    Ids.push_back(std::pair<SMLoc, StringRef>(
-        Tok.getLocation(), Tok.getIdentifier()));
+    Ids.push_back(std::pair<SMLoc, IdentifierInfo *>(
+        Tok.getLocation(), Tok.getIdentifierInfo()));
     advance();
   }
   return false;
@@ -3,21 +3,26 @@
 
 using namespace tinylang;
 
-bool Scope::insert(Decl *Declaration) {
-  return Symbols
-      .insert(std::pair<StringRef, Decl *>(
-          Declaration->getName(), Declaration))
-      .second;
+Scope::~Scope() {
+  // Only the innermost scope is ever left, so the
+  // bindings of this scope are at the front of the
+  // chains.
+  for (IdentifierInfo *II : Names) {
+    Binding *B = II->getFETokenInfo<Binding>();
+    assert(B && B->S == this &&
+           "Scopes left out of order");
+    II->setFETokenInfo(B->Shadowed);
+  }
 }
 
-Decl *Scope::lookup(StringRef Name) {
-  Scope *S = this;
-  while (S) {
-    StringMap<Decl *>::const_iterator I =
-        S->Symbols.find(Name);
-    if (I != S->Symbols.end())
-      return I->second;
-    S = S->getParent();
-  }
-  return nullptr;
+bool Scope::insert(IdentifierInfo *II,
+                   Decl *Declaration) {
+  Binding *Top = II->getFETokenInfo<Binding>();
+  if (Top && Top->S == this)
+    return false;
+  auto *B = new (Allocator.Allocate<Binding>())
+      Binding{Declaration, this, Top};
+  II->setFETokenInfo(B);
+  Names.push_back(II);
+  return true;
 }
@@ -5,7 +5,8 @@
 using namespace tinylang;
 
 void Sema::enterScope(Decl *D) {
-  CurrentScope = new Scope(CurrentScope);
+  CurrentScope =
+      new Scope(ScopeAllocator, CurrentScope);
   CurrentDecl = D;
 }
 
@@ -17,6 +18,16 @@ void Sema::leaveScope() {
   CurrentDecl = CurrentDecl->getEnclosingDecl();
 }
 
+Sema::~Sema() {
+  // Unbind the names of the remaining scopes, because
+  // the identifier table may outlive the bindings.
+  while (CurrentScope) {
+    Scope *Parent = CurrentScope->getParent();
+    delete CurrentScope;
+    CurrentScope = Parent;
+  }
+}
+
 bool Sema::isOperatorForType(tok::TokenKind Op,
                              TypeDeclaration *Ty) {
   switch (Op) {
@@ -38,8 +49,9 @@ bool Sema::isOperatorForType(tok::TokenKind Op,
 }
 
 void Sema::checkFormalAndActualParameters(
-    SMLoc Loc, const FormalParamList &Formals,
-    const ExprList &Actuals) {
+    SMLoc Loc,
+    ArrayRef<FormalParameterDeclaration *> Formals,
+    ArrayRef<Expr *> Actuals) {
   if (Formals.size() != Actuals.size()) {
     Diags.report(Loc, diag::err_wrong_number_of_parameters);
     return;
@@ -54,80 +66,253 @@ void Sema::checkFormalAndActualParameters(
           Loc,
           diag::
               err_type_of_formal_and_actual_parameter_not_compatible);
-    if (F->isVar() && isa<Designator>(Arg))
+    if (F->isVar() && !isa<Designator>(Arg))
       Diags.report(Loc,
                    diag::err_var_parameter_requires_var);
   }
 }
 
+void Sema::addSelector(Designator *D, Selector *Sel) {
+  // Selector chains are short, so growing the list by
+  // copying it into the context is cheap.
+  ArrayRef<Selector *> Old = D->getSelectors();
+  llvm::SmallVector<Selector *, 4> Sels(Old.begin(),
+                                        Old.end());
+  Sels.push_back(Sel);
+  D->setSelectors(
+      Context.copyArray(ArrayRef<Selector *>(Sels)));
+}
+
+static llvm::APSInt getBoolValue(bool V) {
+  return llvm::APSInt(llvm::APInt(1, V), /*isUnsigned=*/true);
+}
+
+// Computes the value of the constant expression E with
+// the same semantics as the generated code: INTEGER is
+// a 64 bit two's complement number, BOOLEAN is 1 bit
+// wide. Returns false if E is not constant, has a type
+// error or divides by zero. Nothing is reported here, as
+// the folding evaluates subexpressions repeatedly;
+// actOnTerm reports a division by zero once.
+bool Sema::evaluate(Expr *E, llvm::APSInt &Result) {
+  if (!E || !E->isConst())
+    return false;
+  if (auto *IntLit = dyn_cast<IntegerLiteral>(E)) {
+    Result = IntLit->getValue();
+    return true;
+  }
+  if (auto *BoolLit = dyn_cast<BooleanLiteral>(E)) {
+    Result = getBoolValue(BoolLit->getValue());
+    return true;
+  }
+  if (auto *Const = dyn_cast<ConstantAccess>(E)) {
+    ConstantDeclaration *D = Const->getDecl();
+    if (!D->hasValue())
+      return false;
+    Result = D->getValue();
+    return true;
+  }
+  if (auto *Prefix = dyn_cast<PrefixExpression>(E)) {
+    if (!evaluate(Prefix->getExpr(), Result))
+      return false;
+    switch (Prefix->getOperatorInfo().getKind()) {
+    case tok::plus:
+      return true;
+    case tok::minus:
+      Result = -Result;
+      return true;
+    case tok::kw_NOT:
+      Result = ~Result;
+      return true;
+    default:
+      return false;
+    }
+  }
+  if (auto *Infix = dyn_cast<InfixExpression>(E)) {
+    llvm::APSInt L, R;
+    if (!evaluate(Infix->getLeft(), L) ||
+        !evaluate(Infix->getRight(), R) ||
+        L.getBitWidth() != R.getBitWidth())
+      return false;
+    const OperatorInfo &Op = Infix->getOperatorInfo();
+    switch (Op.getKind()) {
+    case tok::plus:
+      Result = L + R;
+      return true;
+    case tok::minus:
+      Result = L - R;
+      return true;
+    case tok::star:
+      Result = L * R;
+      return true;
+    case tok::kw_DIV:
+    case tok::kw_MOD:
+      if (R.isZero())
+        return false;
+      Result = Op.getKind() == tok::kw_DIV ? L / R : L % R;
+      return true;
+    case tok::equal:
+      Result = getBoolValue(L == R);
+      return true;
+    case tok::hash:
+      Result = getBoolValue(L != R);
+      return true;
+    case tok::less:
+      Result = getBoolValue(L < R);
+      return true;
+    case tok::lessequal:
+      Result = getBoolValue(L <= R);
+      return true;
+    case tok::greater:
+      Result = getBoolValue(L > R);
+      return true;
+    case tok::greaterequal:
+      Result = getBoolValue(L >= R);
+      return true;
+    case tok::kw_AND:
+      Result = L & R;
+      return true;
+    case tok::kw_OR:
+      Result = L | R;
+      return true;
+    default:
+      return false;
+    }
+  }
+  return false;
+}
+
+// Replaces a constant BOOLEAN expression with one of the
+// predefined literals.
+Expr *Sema::foldBoolean(Expr *E) {
+  llvm::APSInt Value;
+  if (E->getType() != BooleanType || !evaluate(E, Value))
+    return E;
+  return Value.getBoolValue() ? TrueLiteral : FalseLiteral;
+}
+
 void Sema::initialize() {
   // Setup global scope.
-  CurrentScope = new Scope();
+  CurrentScope = new Scope(ScopeAllocator);
   CurrentDecl = nullptr;
-  IntegerType = new PervasiveTypeDeclaration(
+  IdentifierTable &Idents = Context.getIdents();
+  IntegerType = new (Context) PervasiveTypeDeclaration(
       CurrentDecl, SMLoc(), "INTEGER");
-  BooleanType = new PervasiveTypeDeclaration(
+  BooleanType = new (Context) PervasiveTypeDeclaration(
       CurrentDecl, SMLoc(), "BOOLEAN");
-  TrueLiteral = new BooleanLiteral(true, BooleanType);
-  FalseLiteral = new BooleanLiteral(false, BooleanType);
-  TrueConst = new ConstantDeclaration(CurrentDecl, SMLoc(),
-                                      "TRUE", TrueLiteral);
-  FalseConst = new ConstantDeclaration(
+  TrueLiteral =
+      new (Context) BooleanLiteral(true, BooleanType);
+  FalseLiteral =
+      new (Context) BooleanLiteral(false, BooleanType);
+  TrueConst = new (Context) ConstantDeclaration(
+      CurrentDecl, SMLoc(), "TRUE", TrueLiteral);
+  FalseConst = new (Context) ConstantDeclaration(
       CurrentDecl, SMLoc(), "FALSE", FalseLiteral);
-  CurrentScope->insert(IntegerType);
-  CurrentScope->insert(BooleanType);
-  CurrentScope->insert(TrueConst);
-  CurrentScope->insert(FalseConst);
+  TrueConst->setValue(getBoolValue(true));
+  FalseConst->setValue(getBoolValue(false));
+  CurrentScope->insert(&Idents.get("INTEGER"),
+                       IntegerType);
+  CurrentScope->insert(&Idents.get("BOOLEAN"),
+                       BooleanType);
+  CurrentScope->insert(&Idents.get("TRUE"), TrueConst);
+  CurrentScope->insert(&Idents.get("FALSE"),
+                       FalseConst);
+  Loader = std::make_unique<ModuleLoader>(
+      Context, Diags, ImportPaths, IntegerType,
+      BooleanType);
 }
 
 ModuleDeclaration *
-Sema::actOnModuleDeclaration(SMLoc Loc, StringRef Name) {
-  return new ModuleDeclaration(CurrentDecl, Loc, Name);
+Sema::actOnModuleDeclaration(SMLoc Loc,
+                             IdentifierInfo *II) {
+  return new (Context) ModuleDeclaration(
+      CurrentDecl, Loc, II->getName());
 }
 
 void Sema::actOnModuleDeclaration(
-    ModuleDeclaration *ModDecl, SMLoc Loc, StringRef Name,
-    DeclList &Decls, StmtList &Stmts) {
-  if (Name != ModDecl->getName()) {
+    ModuleDeclaration *ModDecl, SMLoc Loc,
+    IdentifierInfo *II, DeclList &Decls,
+    StmtList &Stmts) {
+  if (II->getName() != ModDecl->getName()) {
     Diags.report(Loc,
                  diag::err_module_identifier_not_equal);
     Diags.report(ModDecl->getLocation(),
                  diag::note_module_identifier_declaration);
   }
-  ModDecl->setDecls(Decls);
-  ModDecl->setStmts(Stmts);
+  ModDecl->setDecls(Context.copyArray(Decls));
+  ModDecl->setStmts(Context.copyArray(Stmts));
 }
 
-void Sema::actOnImport(StringRef ModuleName,
+void Sema::actOnImport(SMLoc Loc,
+                       IdentifierInfo *ModuleName,
                        IdentList &Ids) {
-  Diags.report(SMLoc(), diag::err_not_yet_implemented);
+  assert(CurrentScope && "CurrentScope not set");
+  // IMPORT M binds the name of the module, and the
+  // declarations are accessed as M.X.
+  if (!ModuleName) {
+    for (auto &[IdLoc, II] : Ids) {
+      if (ModuleDeclaration *Mod =
+              Loader->load(IdLoc, II->getName()))
+        if (!CurrentScope->insert(II, Mod))
+          Diags.report(IdLoc, diag::err_symbold_declared,
+                       II->getName());
+    }
+    return;
+  }
+  // FROM M IMPORT X binds X directly.
+  ModuleDeclaration *Mod =
+      Loader->load(Loc, ModuleName->getName());
+  if (!Mod)
+    return;
+  for (auto &[IdLoc, II] : Ids) {
+    auto Decls = Mod->getDecls();
+    auto *I = llvm::find_if(Decls, [II = II](Decl *D) {
+      return D->getName() == II->getName();
+    });
+    if (I == Decls.end())
+      Diags.report(IdLoc, diag::err_not_exported,
+                   ModuleName->getName(), II->getName());
+    else if (!CurrentScope->insert(II, *I))
+      Diags.report(IdLoc, diag::err_symbold_declared,
+                   II->getName());
+  }
 }
 
 void Sema::actOnConstantDeclaration(DeclList &Decls,
                                     SMLoc Loc,
-                                    StringRef Name,
+                                    IdentifierInfo *II,
                                     Expr *E) {
   assert(CurrentScope && "CurrentScope not set");
   ConstantDeclaration *Decl =
-      new ConstantDeclaration(CurrentDecl, Loc, Name, E);
-  if (CurrentScope->insert(Decl))
+      new (Context) ConstantDeclaration(
+          CurrentDecl, Loc, II->getName(), E);
+  llvm::APSInt Value;
+  if (E && !E->isConst())
+    Diags.report(Loc, diag::err_expr_not_constant);
+  else if (evaluate(E, Value))
+    Decl->setValue(Value);
+  if (CurrentScope->insert(II, Decl))
     Decls.push_back(Decl);
   else
-    Diags.report(Loc, diag::err_symbold_declared, Name);
+    Diags.report(Loc, diag::err_symbold_declared,
+                   II->getName());
 }
 
 void Sema::actOnAliasTypeDeclaration(DeclList &Decls,
                                      SMLoc Loc,
-                                     StringRef Name,
+                                     IdentifierInfo *II,
                                      Decl *D) {
   assert(CurrentScope && "CurrentScope not set");
-  if (TypeDeclaration *Ty = dyn_cast<TypeDeclaration>(D)) {
-    AliasTypeDeclaration *Decl = new AliasTypeDeclaration(
-        CurrentDecl, Loc, Name, Ty);
-    if (CurrentScope->insert(Decl))
+  if (TypeDeclaration *Ty =
+          dyn_cast_or_null<TypeDeclaration>(D)) {
+    AliasTypeDeclaration *Decl =
+        new (Context) AliasTypeDeclaration(
+            CurrentDecl, Loc, II->getName(), Ty);
+    if (CurrentScope->insert(II, Decl))
       Decls.push_back(Decl);
     else
-      Diags.report(Loc, diag::err_symbold_declared, Name);
+      Diags.report(Loc, diag::err_symbold_declared,
+                   II->getName());
   } else {
     Diags.report(Loc,
                  diag::err_vardecl_requires_type); // TODO
@@ -136,39 +321,56 @@ void Sema::actOnAliasTypeDeclaration(DeclList &Decls,
 
 void Sema::actOnArrayTypeDeclaration(DeclList &Decls,
                                      SMLoc Loc,
-                                     StringRef Name,
+                                     IdentifierInfo *II,
                                      Expr *E, Decl *D) {
   assert(CurrentScope && "CurrentScope not set");
-  if (E && E->isConst() &&
-      E->getType()->getName() == "INTEGER") {
-    if (TypeDeclaration *Ty =
-            dyn_cast<TypeDeclaration>(D)) {
-      ArrayTypeDeclaration *Decl = new ArrayTypeDeclaration(
-          CurrentDecl, Loc, Name, E, Ty);
-      if (CurrentScope->insert(Decl))
-        Decls.push_back(Decl);
-      else
-        Diags.report(Loc, diag::err_symbold_declared, Name);
-    } else {
-      Diags.report(Loc,
-                   diag::err_vardecl_requires_type); // TODO
-    }
+  if (!E)
+    return;
+  if (!E->isConst() || E->getType() != IntegerType) {
+    Diags.report(Loc, diag::err_array_bound_not_integer);
+    return;
+  }
+  // A failed evaluation, e.g. a division by zero, has
+  // already been reported.
+  llvm::APSInt NumElements;
+  if (!evaluate(E, NumElements))
+    return;
+  if (NumElements.isNegative()) {
+    Diags.report(Loc, diag::err_array_size_negative);
+    return;
+  }
+  if (TypeDeclaration *Ty =
+          dyn_cast_or_null<TypeDeclaration>(D)) {
+    ArrayTypeDeclaration *Decl =
+        new (Context) ArrayTypeDeclaration(
+            CurrentDecl, Loc, II->getName(), E,
+            NumElements.getZExtValue(), Ty);
+    if (CurrentScope->insert(II, Decl))
+      Decls.push_back(Decl);
+    else
+      Diags.report(Loc, diag::err_symbold_declared,
+                   II->getName());
+  } else {
+    Diags.report(Loc,
+                 diag::err_vardecl_requires_type); // TODO
   }
 }
 
 void Sema::actOnPointerTypeDeclaration(DeclList &Decls,
                                        SMLoc Loc,
-                                       StringRef Name,
+                                       IdentifierInfo *II,
                                        Decl *D) {
   assert(CurrentScope && "CurrentScope not set");
-  if (TypeDeclaration *Ty = dyn_cast<TypeDeclaration>(D)) {
+  if (TypeDeclaration *Ty =
+          dyn_cast_or_null<TypeDeclaration>(D)) {
     PointerTypeDeclaration *Decl =
-        new PointerTypeDeclaration(CurrentDecl, Loc, Name,
-                                   Ty);
-    if (CurrentScope->insert(Decl))
+        new (Context) PointerTypeDeclaration(
+            CurrentDecl, Loc, II->getName(), Ty);
+    if (CurrentScope->insert(II, Decl))
       Decls.push_back(Decl);
     else
-      Diags.report(Loc, diag::err_symbold_declared, Name);
+      Diags.report(Loc, diag::err_symbold_declared,
+                   II->getName());
   } else {
     Diags.report(Loc,
                  diag::err_vardecl_requires_type); // TODO
@@ -177,10 +379,11 @@ void Sema::actOnPointerTypeDeclaration(DeclList &Decls,
 
 void Sema::actOnFieldDeclaration(FieldList &Fields,
                                  IdentList &Ids, Decl *D) {
-  if (TypeDeclaration *Ty = dyn_cast<TypeDeclaration>(D)) {
+  if (TypeDeclaration *Ty =
+          dyn_cast_or_null<TypeDeclaration>(D)) {
     for (auto I = Ids.begin(), E = Ids.end(); I != E; ++I) {
       SMLoc Loc = I->first;
-      StringRef Name = I->second;
+      StringRef Name = I->second->getName();
       Fields.emplace_back(Loc, Name, Ty);
     }
   } else if (!Ids.empty()) {
@@ -191,7 +394,7 @@ void Sema::actOnFieldDeclaration(FieldList &Fields,
 }
 
 void Sema::actOnRecordTypeDeclaration(
-    DeclList &Decls, SMLoc Loc, StringRef Name,
+    DeclList &Decls, SMLoc Loc, IdentifierInfo *II,
     const FieldList &Fields) {
   assert(CurrentScope && "CurrentScope not set");
   llvm::StringSet<> FieldSet;
@@ -203,26 +406,31 @@ void Sema::actOnRecordTypeDeclaration(
     }
     FieldSet.insert(F.getName());
   }
-  RecordTypeDeclaration *Decl = new RecordTypeDeclaration(
-      CurrentDecl, Loc, Name, Fields);
-  if (CurrentScope->insert(Decl))
+  RecordTypeDeclaration *Decl =
+      new (Context) RecordTypeDeclaration(
+          CurrentDecl, Loc, II->getName(),
+          Context.copyArray(Fields));
+  if (CurrentScope->insert(II, Decl))
     Decls.push_back(Decl);
   else
-    Diags.report(Loc, diag::err_symbold_declared, Name);
+    Diags.report(Loc, diag::err_symbold_declared,
+                 II->getName());
 }
 
 void Sema::actOnVariableDeclaration(DeclList &Decls,
                                     IdentList &Ids,
                                     Decl *D) {
   assert(CurrentScope && "CurrentScope not set");
-  if (TypeDeclaration *Ty = dyn_cast<TypeDeclaration>(D)) {
-    for (auto &[Loc, Name] : Ids) {
-      auto *Decl = new VariableDeclaration(CurrentDecl, Loc,
-                                           Name, Ty);
-      if (CurrentScope->insert(Decl))
+  if (TypeDeclaration *Ty =
+          dyn_cast_or_null<TypeDeclaration>(D)) {
+    for (auto &[Loc, II] : Ids) {
+      auto *Decl = new (Context) VariableDeclaration(
+          CurrentDecl, Loc, II->getName(), Ty);
+      if (CurrentScope->insert(II, Decl))
         Decls.push_back(Decl);
       else
-        Diags.report(Loc, diag::err_symbold_declared, Name);
+        Diags.report(Loc, diag::err_symbold_declared,
+                     II->getName());
     }
   } else if (!Ids.empty()) {
     SMLoc Loc = Ids.front().first;
@@ -234,15 +442,18 @@ void Sema::actOnFormalParameterDeclaration(
     FormalParamList &Params, IdentList &Ids, Decl *D,
     bool IsVar) {
   assert(CurrentScope && "CurrentScope not set");
-  if (TypeDeclaration *Ty = dyn_cast<TypeDeclaration>(D)) {
-    for (auto &[Loc, Name] : Ids) {
+  if (TypeDeclaration *Ty =
+          dyn_cast_or_null<TypeDeclaration>(D)) {
+    for (auto &[Loc, II] : Ids) {
       FormalParameterDeclaration *Decl =
-          new FormalParameterDeclaration(CurrentDecl, Loc,
-                                         Name, Ty, IsVar);
-      if (CurrentScope->insert(Decl))
+          new (Context) FormalParameterDeclaration(
+              CurrentDecl, Loc, II->getName(), Ty,
+              IsVar);
+      if (CurrentScope->insert(II, Decl))
         Params.push_back(Decl);
       else
-        Diags.report(Loc, diag::err_symbold_declared, Name);
+        Diags.report(Loc, diag::err_symbold_declared,
+                     II->getName());
     }
   } else if (!Ids.empty()) {
     SMLoc Loc = Ids.front().first;
@@ -251,18 +462,21 @@ void Sema::actOnFormalParameterDeclaration(
 }
 
 ProcedureDeclaration *
-Sema::actOnProcedureDeclaration(SMLoc Loc, StringRef Name) {
-  ProcedureDeclaration *P =
-      new ProcedureDeclaration(CurrentDecl, Loc, Name);
-  if (!CurrentScope->insert(P))
-    Diags.report(Loc, diag::err_symbold_declared, Name);
+Sema::actOnProcedureDeclaration(SMLoc Loc,
+                                IdentifierInfo *II) {
+  ProcedureDeclaration *P = new (Context)
+      ProcedureDeclaration(CurrentDecl, Loc,
+                           II->getName());
+  if (!CurrentScope->insert(II, P))
+    Diags.report(Loc, diag::err_symbold_declared,
+                 II->getName());
   return P;
 }
 
 void Sema::actOnProcedureHeading(
     ProcedureDeclaration *ProcDecl, FormalParamList &Params,
     Decl *RetType) {
-  ProcDecl->setFormalParams(Params);
+  ProcDecl->setFormalParams(Context.copyArray(Params));
   auto *RetTypeDecl =
       dyn_cast_or_null<TypeDeclaration>(RetType);
   if (!RetTypeDecl && RetType)
@@ -274,26 +488,28 @@ void Sema::actOnProcedureHeading(
 
 void Sema::actOnProcedureDeclaration(
     ProcedureDeclaration *ProcDecl, SMLoc Loc,
-    StringRef Name, DeclList &Decls, StmtList &Stmts) {
+    IdentifierInfo *II, DeclList &Decls,
+    StmtList &Stmts) {
 
-  if (Name != ProcDecl->getName()) {
+  if (II->getName() != ProcDecl->getName()) {
     Diags.report(Loc, diag::err_proc_identifier_not_equal);
     Diags.report(ProcDecl->getLocation(),
                  diag::note_proc_identifier_declaration);
   }
-  ProcDecl->setDecls(Decls);
-  ProcDecl->setStmts(Stmts);
+  ProcDecl->setDecls(Context.copyArray(Decls));
+  ProcDecl->setStmts(Context.copyArray(Stmts));
 }
 
 void Sema::actOnAssignment(StmtList &Stmts, SMLoc Loc,
                            Expr *D, Expr *E) {
-  if (auto Var = dyn_cast<Designator>(D)) {
-    if (Var->getType() != E->getType()) {
+  if (auto Var = dyn_cast_or_null<Designator>(D)) {
+    if (E && Var->getType() != E->getType()) {
       Diags.report(
           Loc, diag::err_types_for_operator_not_compatible,
           tok::getPunctuatorSpelling(tok::colonequal));
     }
-    Stmts.push_back(new AssignmentStatement(Var, E));
+    Stmts.push_back(
+        new (Context) AssignmentStatement(Var, E));
   } else if (D) {
     // TODO Emit error
   }
@@ -301,14 +517,16 @@ void Sema::actOnAssignment(StmtList &Stmts, SMLoc Loc,
 
 void Sema::actOnProcCall(StmtList &Stmts, SMLoc Loc,
                          Decl *D, ExprList &Params) {
-  if (auto Proc = dyn_cast<ProcedureDeclaration>(D)) {
+  if (auto Proc =
+          dyn_cast_or_null<ProcedureDeclaration>(D)) {
     checkFormalAndActualParameters(
         Loc, Proc->getFormalParams(), Params);
     if (Proc->getRetType())
       Diags.report(
           Loc, diag::err_procedure_call_on_nonprocedure);
     Stmts.push_back(
-        new ProcedureCallStatement(Proc, Params));
+        new (Context) ProcedureCallStatement(
+            Proc, Context.copyArray(Params)));
   } else if (D) {
     Diags.report(Loc,
                  diag::err_procedure_call_on_nonprocedure);
@@ -324,8 +542,9 @@ void Sema::actOnIfStatement(StmtList &Stmts, SMLoc Loc,
   if (Cond->getType() != BooleanType) {
     Diags.report(Loc, diag::err_if_expr_must_be_bool);
   }
-  Stmts.push_back(
-      new IfStatement(Cond, IfStmts, ElseStmts));
+  Stmts.push_back(new (Context) IfStatement(
+      Cond, Context.copyArray(IfStmts),
+      Context.copyArray(ElseStmts)));
 }
 
 void Sema::actOnWhileStatement(StmtList &Stmts, SMLoc Loc,
@@ -337,13 +556,19 @@ void Sema::actOnWhileStatement(StmtList &Stmts, SMLoc Loc,
   if (Cond->getType() != BooleanType) {
     Diags.report(Loc, diag::err_while_expr_must_be_bool);
   }
-  Stmts.push_back(new WhileStatement(Cond, WhileStmts));
+  Stmts.push_back(new (Context) WhileStatement(
+      Cond, Context.copyArray(WhileStmts)));
 }
 
 void Sema::actOnReturnStatement(StmtList &Stmts, SMLoc Loc,
                                 Expr *RetVal) {
-  auto *Proc = cast<ProcedureDeclaration>(CurrentDecl);
-  if (Proc->getRetType() && !RetVal)
+  // A RETURN in the module body ends the body.
+  auto *Proc = dyn_cast<ProcedureDeclaration>(CurrentDecl);
+  if (!Proc) {
+    if (RetVal)
+      Diags.report(Loc,
+                   diag::err_procedure_requires_empty_return);
+  } else if (Proc->getRetType() && !RetVal)
     Diags.report(Loc, diag::err_function_requires_return);
   else if (!Proc->getRetType() && RetVal)
     Diags.report(Loc,
@@ -353,7 +578,8 @@ void Sema::actOnReturnStatement(StmtList &Stmts, SMLoc Loc,
       Diags.report(Loc, diag::err_function_and_return_type);
   }
 
-  Stmts.push_back(new ReturnStatement(RetVal));
+  Stmts.push_back(
+      new (Context) ReturnStatement(RetVal));
 }
 
 Expr *Sema::actOnExpression(Expr *Left, Expr *Right,
@@ -371,8 +597,8 @@ Expr *Sema::actOnExpression(Expr *Left, Expr *Right,
         tok::getPunctuatorSpelling(Op.getKind()));
   }
   bool IsConst = Left->isConst() && Right->isConst();
-  return new InfixExpression(Left, Right, Op, BooleanType,
-                             IsConst);
+  return new (Context) InfixExpression(
+      Left, Right, Op, BooleanType, IsConst);
 }
 
 Expr *Sema::actOnSimpleExpression(Expr *Left, Expr *Right,
@@ -391,13 +617,11 @@ Expr *Sema::actOnSimpleExpression(Expr *Left, Expr *Right,
   }
   TypeDeclaration *Ty = Left->getType();
   bool IsConst = Left->isConst() && Right->isConst();
-  if (IsConst && Op.getKind() == tok::kw_OR) {
-    BooleanLiteral *L = dyn_cast<BooleanLiteral>(Left);
-    BooleanLiteral *R = dyn_cast<BooleanLiteral>(Right);
-    return L->getValue() || R->getValue() ? TrueLiteral
-                                          : FalseLiteral;
-  }
-  return new InfixExpression(Left, Right, Op, Ty, IsConst);
+  Expr *E = new (Context)
+      InfixExpression(Left, Right, Op, Ty, IsConst);
+  if (IsConst && Op.getKind() == tok::kw_OR)
+    return foldBoolean(E);
+  return E;
 }
 
 Expr *Sema::actOnTerm(Expr *Left, Expr *Right,
@@ -417,13 +641,18 @@ Expr *Sema::actOnTerm(Expr *Left, Expr *Right,
   }
   TypeDeclaration *Ty = Left->getType();
   bool IsConst = Left->isConst() && Right->isConst();
-  if (IsConst && Op.getKind() == tok::kw_AND) {
-    BooleanLiteral *L = dyn_cast<BooleanLiteral>(Left);
-    BooleanLiteral *R = dyn_cast<BooleanLiteral>(Right);
-    return L->getValue() && R->getValue() ? TrueLiteral
-                                          : FalseLiteral;
-  }
-  return new InfixExpression(Left, Right, Op, Ty, IsConst);
+  Expr *E = new (Context)
+      InfixExpression(Left, Right, Op, Ty, IsConst);
+  if (IsConst && Op.getKind() == tok::kw_AND)
+    return foldBoolean(E);
+  llvm::APSInt Divisor;
+  if (IsConst &&
+      (Op.getKind() == tok::kw_DIV ||
+       Op.getKind() == tok::kw_MOD) &&
+      evaluate(Right, Divisor) && Divisor.isZero())
+    Diags.report(Op.getLocation(),
+                 diag::err_const_division_by_zero);
+  return E;
 }
 
 Expr *Sema::actOnPrefixExpression(Expr *E,
@@ -438,10 +667,9 @@ Expr *Sema::actOnPrefixExpression(Expr *E,
         tok::getPunctuatorSpelling(Op.getKind()));
   }
 
-  if (E->isConst() && Op.getKind() == tok::kw_NOT) {
-    BooleanLiteral *L = dyn_cast<BooleanLiteral>(E);
-    return L->getValue() ? FalseLiteral : TrueLiteral;
-  }
+  if (E->isConst() && Op.getKind() == tok::kw_NOT)
+    return foldBoolean(new (Context) PrefixExpression(
+        E, Op, E->getType(), true));
 
   if (Op.getKind() == tok::minus) {
     bool Ambiguous = true;
@@ -460,8 +688,8 @@ Expr *Sema::actOnPrefixExpression(Expr *E,
     }
   }
 
-  return new PrefixExpression(E, Op, E->getType(),
-                              E->isConst());
+  return new (Context) PrefixExpression(
+      E, Op, E->getType(), E->isConst());
 }
 
 Expr *Sema::actOnIntegerLiteral(SMLoc Loc,
@@ -472,15 +700,16 @@ Expr *Sema::actOnIntegerLiteral(SMLoc Loc,
     Radix = 16;
   }
   llvm::APInt Value(64, Literal, Radix);
-  return new IntegerLiteral(Loc, llvm::APSInt(Value, false),
-                            IntegerType);
+  return new (Context) IntegerLiteral(
+      Loc, llvm::APSInt(Value, false), IntegerType);
 }
 
 void Sema::actOnIndexSelector(Expr *Desig, SMLoc Loc,
                               Expr *E) {
-  if (auto *D = dyn_cast<Designator>(Desig)) {
+  if (auto *D = dyn_cast_or_null<Designator>(Desig)) {
     if (auto *Ty = dyn_cast<ArrayTypeDeclaration>(D->getType())) {
-      D->addSelector(new IndexSelector(E, Ty->getType()));
+      addSelector(D, new (Context) IndexSelector(
+                         E, Ty->getType()));
     }
   // TODO Error message
   }
@@ -490,14 +719,14 @@ void Sema::actOnIndexSelector(Expr *Desig, SMLoc Loc,
 void Sema::actOnFieldSelector(Expr *Desig, SMLoc Loc,
                               StringRef Name) {
   // TODO Implement
-  if (auto *D = dyn_cast<Designator>(Desig)) {
+  if (auto *D = dyn_cast_or_null<Designator>(Desig)) {
     if (auto *R =
             dyn_cast<RecordTypeDeclaration>(D->getType())) {
       uint32_t Index = 0;
       for (const auto &F : R->getFields()) {
         if (F.getName() == Name) {
-          D->addSelector(
-              new FieldSelector(Index, Name, F.getType()));
+          addSelector(D, new (Context) FieldSelector(
+                             Index, Name, F.getType()));
           return;
         }
         ++Index;
@@ -511,9 +740,10 @@ void Sema::actOnFieldSelector(Expr *Desig, SMLoc Loc,
 
 void Sema::actOnDereferenceSelector(Expr *Desig,
                                     SMLoc Loc) {
-  if (auto *D = dyn_cast<Designator>(Desig)) {
+  if (auto *D = dyn_cast_or_null<Designator>(Desig)) {
     if (auto *Ty = dyn_cast<PointerTypeDeclaration>(D->getType())) {
-      D->addSelector(new DereferenceSelector(Ty->getType()));
+      addSelector(D, new (Context) DereferenceSelector(
+                         Ty->getType()));
     }
   // TODO Error message
   }
@@ -524,17 +754,17 @@ Expr *Sema::actOnDesignator(Decl *D) {
   if (!D)
     return nullptr;
   if (auto *V = dyn_cast<VariableDeclaration>(D))
-    return new Designator(V);
+    return new (Context) Designator(V);
   else if (auto *P =
                dyn_cast<FormalParameterDeclaration>(D))
-    return new Designator(P);
+    return new (Context) Designator(P);
   else if (auto *C = dyn_cast<ConstantDeclaration>(D)) {
     if (C == TrueConst)
       return TrueLiteral;
     if (C == FalseConst) {
       return FalseLiteral;
     }
-    return new ConstantAccess(C);
+    return new (Context) ConstantAccess(C);
   }
   return nullptr;
 }
@@ -548,7 +778,8 @@ Expr *Sema::actOnFunctionCall(Decl *D, ExprList &Params) {
     if (!P->getRetType())
       Diags.report(D->getLocation(),
                    diag::err_function_call_on_nonfunction);
-    return new FunctionCallExpr(P, Params);
+    return new (Context)
+        FunctionCallExpr(P, Context.copyArray(Params));
   }
   Diags.report(D->getLocation(),
                diag::err_function_call_on_nonfunction);
@@ -556,10 +787,21 @@ Expr *Sema::actOnFunctionCall(Decl *D, ExprList &Params) {
 }
 
 Decl *Sema::actOnQualIdentPart(Decl *Prev, SMLoc Loc,
-                               StringRef Name) {
+                               IdentifierInfo *II) {
+  StringRef Name = II->getName();
   if (!Prev) {
-    if (Decl *D = CurrentScope->lookup(Name))
+    if (Decl *D = Scope::lookup(II)) {
+      // A nested procedure has no access to the frame of
+      // an enclosing procedure.
+      if (isa<VariableDeclaration,
+              FormalParameterDeclaration>(D) &&
+          isa<ProcedureDeclaration>(D->getEnclosingDecl()) &&
+          D->getEnclosingDecl() != CurrentDecl) {
+        Diags.report(Loc, diag::err_uplevel_access, Name);
+        return nullptr;
+      }
       return D;
+    }
   } else if (auto *Mod =
                  dyn_cast<ModuleDeclaration>(Prev)) {
     auto Decls = Mod->getDecls();
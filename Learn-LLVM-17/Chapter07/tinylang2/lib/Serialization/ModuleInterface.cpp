@@ -0,0 +1,381 @@
+#include "tinylang/Serialization/ModuleInterface.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/xxhash.h"
+
+using namespace tinylang;
+
+namespace {
+class InterfaceWriter {
+  llvm::support::endian::Writer W;
+
+  // The position of the declarations in the file.
+  llvm::DenseMap<Decl *, uint32_t> Index;
+
+  void writeString(StringRef S) {
+    W.write<uint32_t>(S.size());
+    W.OS << S;
+  }
+  void writeType(TypeDeclaration *Ty);
+
+public:
+  InterfaceWriter(llvm::raw_ostream &OS)
+      : W(OS, llvm::support::little) {}
+
+  void write(ModuleDeclaration *Mod);
+};
+} // namespace
+
+void InterfaceWriter::writeType(TypeDeclaration *Ty) {
+  if (!Ty) {
+    W.write<uint32_t>(interface::NoTypeRef);
+  } else if (llvm::isa<PervasiveTypeDeclaration>(Ty)) {
+    W.write<uint32_t>(Ty->getName() == "BOOLEAN"
+                          ? interface::BooleanTypeRef
+                          : interface::IntegerTypeRef);
+  } else if (auto It = Index.find(Ty); It != Index.end()) {
+    W.write<uint32_t>(interface::FirstDeclTypeRef +
+                      It->second);
+  } else {
+    // A type exported by an imported module.
+    assert(llvm::isa<ModuleDeclaration>(
+               Ty->getEnclosingDecl()) &&
+           "Type is not visible outside its module");
+    W.write<uint32_t>(interface::ForeignTypeRef);
+    writeString(Ty->getEnclosingDecl()->getName());
+    writeString(Ty->getName());
+  }
+}
+
+void InterfaceWriter::write(ModuleDeclaration *Mod) {
+  llvm::SmallVector<Decl *, 32> Decls;
+  for (Decl *D : Mod->getDecls()) {
+    if (llvm::isa<ModuleDeclaration>(D) ||
+        llvm::isa<PervasiveTypeDeclaration>(D) ||
+        llvm::isa<FormalParameterDeclaration>(D))
+      continue;
+    Index[D] = Decls.size();
+    Decls.push_back(D);
+  }
+
+  W.OS.write(interface::Magic, sizeof(interface::Magic));
+  W.write<uint32_t>(interface::Version);
+  writeString(Mod->getName());
+  W.write<uint32_t>(Decls.size());
+  for (Decl *D : Decls) {
+    if (auto *Const =
+            llvm::dyn_cast<ConstantDeclaration>(D)) {
+      W.write<uint8_t>(interface::Const);
+      writeString(D->getName());
+      const llvm::APSInt &Value = Const->getValue();
+      writeType(Const->getExpr()->getType());
+      W.write<uint32_t>(Value.getBitWidth());
+      W.write<uint8_t>(Value.isUnsigned());
+      W.write<uint64_t>(Value.getZExtValue());
+    } else if (auto *Alias =
+                   llvm::dyn_cast<AliasTypeDeclaration>(D)) {
+      W.write<uint8_t>(interface::AliasType);
+      writeString(D->getName());
+      writeType(Alias->getType());
+    } else if (auto *Array =
+                   llvm::dyn_cast<ArrayTypeDeclaration>(D)) {
+      W.write<uint8_t>(interface::ArrayType);
+      writeString(D->getName());
+      writeType(Array->getType());
+      W.write<uint64_t>(Array->getNumElements());
+    } else if (auto *Pointer =
+                   llvm::dyn_cast<PointerTypeDeclaration>(
+                       D)) {
+      W.write<uint8_t>(interface::PointerType);
+      writeString(D->getName());
+      writeType(Pointer->getType());
+    } else if (auto *Record =
+                   llvm::dyn_cast<RecordTypeDeclaration>(
+                       D)) {
+      W.write<uint8_t>(interface::RecordType);
+      writeString(D->getName());
+      W.write<uint32_t>(Record->getFields().size());
+      for (const Field &F : Record->getFields()) {
+        writeString(F.getName());
+        writeType(F.getType());
+      }
+    } else if (auto *Var =
+                   llvm::dyn_cast<VariableDeclaration>(D)) {
+      W.write<uint8_t>(interface::Var);
+      writeString(D->getName());
+      writeType(Var->getType());
+    } else if (auto *Proc =
+                   llvm::dyn_cast<ProcedureDeclaration>(D)) {
+      W.write<uint8_t>(interface::Proc);
+      writeString(D->getName());
+      W.write<uint32_t>(Proc->getFormalParams().size());
+      for (FormalParameterDeclaration *FP :
+           Proc->getFormalParams()) {
+        writeString(FP->getName());
+        W.write<uint8_t>(FP->isVar());
+        writeType(FP->getType());
+      }
+      writeType(Proc->getRetType());
+    } else
+      llvm_unreachable("Unknown declaration");
+  }
+}
+
+void tinylang::writeModuleInterface(ModuleDeclaration *Mod,
+                                    llvm::raw_ostream &OS) {
+  InterfaceWriter(OS).write(Mod);
+}
+
+namespace {
+// Reads the primitive values of an interface file. After
+// reading past the end, all values are zero and hasError()
+// returns true.
+class Cursor {
+  const char *Ptr;
+  const char *End;
+  bool Error = false;
+
+  bool has(size_t N) {
+    if (!Error && size_t(End - Ptr) >= N)
+      return true;
+    Error = true;
+    return false;
+  }
+
+public:
+  Cursor(StringRef Data)
+      : Ptr(Data.begin()), End(Data.end()) {}
+
+  bool hasError() const { return Error; }
+  bool atEnd() const { return Ptr == End; }
+
+  uint8_t readU8() {
+    return has(1) ? static_cast<uint8_t>(*Ptr++) : 0;
+  }
+  uint32_t readU32() {
+    if (!has(4))
+      return 0;
+    uint32_t V = llvm::support::endian::read32le(Ptr);
+    Ptr += 4;
+    return V;
+  }
+  uint64_t readU64() {
+    if (!has(8))
+      return 0;
+    uint64_t V = llvm::support::endian::read64le(Ptr);
+    Ptr += 8;
+    return V;
+  }
+  StringRef readString() {
+    uint32_t Len = readU32();
+    if (!has(Len))
+      return StringRef();
+    StringRef S(Ptr, Len);
+    Ptr += Len;
+    return S;
+  }
+};
+} // namespace
+
+ModuleDeclaration *ModuleLoader::load(SMLoc Loc,
+                                      StringRef Name) {
+  auto [It, Inserted] = Modules.try_emplace(Name, nullptr);
+  if (!Inserted) {
+    if (!It->second)
+      Diags.report(Loc, diag::err_module_interface_invalid,
+                   Name);
+    return It->second;
+  }
+  for (const std::string &Dir : SearchPaths) {
+    llvm::SmallString<128> Path(Dir);
+    llvm::sys::path::append(
+        Path, llvm::Twine(Name) + interface::Extension);
+    if (llvm::sys::fs::exists(Path)) {
+      ModuleDeclaration *Mod = read(Loc, Name, Path);
+      Modules[Name] = Mod;
+      return Mod;
+    }
+  }
+  Modules.erase(Name);
+  Diags.report(Loc, diag::err_module_not_found, Name);
+  return nullptr;
+}
+
+ModuleDeclaration *ModuleLoader::read(SMLoc Loc,
+                                      StringRef Name,
+                                      StringRef Path) {
+  llvm::TimeTraceScope Scope("Import", Name);
+  // Large files are mapped into memory, not copied.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+      BufOrErr = llvm::MemoryBuffer::getFile(
+          Path, /*IsText=*/false,
+          /*RequiresNullTerminator=*/false);
+  if (!BufOrErr) {
+    Diags.report(Loc, diag::err_module_interface_invalid,
+                 Path);
+    return nullptr;
+  }
+  Files.push_back({Path.str(),
+                   llvm::xxHash64((*BufOrErr)->getBuffer())});
+  Cursor C((*BufOrErr)->getBuffer());
+  auto Invalid = [&]() -> ModuleDeclaration * {
+    Diags.report(Loc, diag::err_module_interface_invalid,
+                 Path);
+    return nullptr;
+  };
+
+  char Magic[sizeof(interface::Magic)];
+  for (char &Ch : Magic)
+    Ch = C.readU8();
+  if (StringRef(Magic, sizeof(Magic)) !=
+          StringRef(interface::Magic,
+                    sizeof(interface::Magic)) ||
+      C.readU32() != interface::Version ||
+      C.readString() != Name)
+    return Invalid();
+
+  // All names are interned, so the declarations do not
+  // refer into the buffer.
+  IdentifierTable &Idents = Context.getIdents();
+  auto ReadName = [&] {
+    return Idents.get(C.readString()).getName();
+  };
+
+  auto *Mod = new (Context) ModuleDeclaration(
+      nullptr, SMLoc(), Idents.get(Name).getName());
+  llvm::SmallVector<Decl *, 32> Decls;
+  auto ReadType = [&]() -> TypeDeclaration * {
+    uint32_t Ref = C.readU32();
+    switch (Ref) {
+    case interface::NoTypeRef:
+      return nullptr;
+    case interface::IntegerTypeRef:
+      return IntegerType;
+    case interface::BooleanTypeRef:
+      return BooleanType;
+    case interface::ForeignTypeRef: {
+      StringRef ModName = C.readString();
+      StringRef TypeName = C.readString();
+      if (C.hasError())
+        return nullptr;
+      ModuleDeclaration *Foreign = load(Loc, ModName);
+      if (!Foreign)
+        return nullptr;
+      for (Decl *D : Foreign->getDecls())
+        if (D->getName() == TypeName)
+          return llvm::dyn_cast<TypeDeclaration>(D);
+      return nullptr;
+    }
+    default:
+      if (Ref - interface::FirstDeclTypeRef < Decls.size())
+        return llvm::dyn_cast<TypeDeclaration>(
+            Decls[Ref - interface::FirstDeclTypeRef]);
+      return nullptr;
+    }
+  };
+
+  uint32_t NumDecls = C.readU32();
+  for (uint32_t I = 0; I < NumDecls && !C.hasError();
+       ++I) {
+    uint8_t Kind = C.readU8();
+    StringRef DeclName = ReadName();
+    Decl *D = nullptr;
+    switch (Kind) {
+    case interface::Const: {
+      TypeDeclaration *Ty = ReadType();
+      uint32_t BitWidth = C.readU32();
+      bool IsUnsigned = C.readU8();
+      uint64_t Bits = C.readU64();
+      if (!Ty || BitWidth == 0 || BitWidth > 64)
+        return Invalid();
+      llvm::APSInt Value(llvm::APInt(BitWidth, Bits),
+                         IsUnsigned);
+      Expr *E =
+          Ty == BooleanType
+              ? static_cast<Expr *>(new (Context)
+                                        BooleanLiteral(
+                                            Value != 0, Ty))
+              : new (Context)
+                    IntegerLiteral(SMLoc(), Value, Ty);
+      auto *Const = new (Context)
+          ConstantDeclaration(Mod, SMLoc(), DeclName, E);
+      Const->setValue(Value);
+      D = Const;
+      break;
+    }
+    case interface::AliasType:
+      if (TypeDeclaration *Ty = ReadType())
+        D = new (Context) AliasTypeDeclaration(
+            Mod, SMLoc(), DeclName, Ty);
+      break;
+    case interface::ArrayType:
+      if (TypeDeclaration *Ty = ReadType())
+        D = new (Context) ArrayTypeDeclaration(
+            Mod, SMLoc(), DeclName, nullptr, C.readU64(),
+            Ty);
+      break;
+    case interface::PointerType:
+      if (TypeDeclaration *Ty = ReadType())
+        D = new (Context) PointerTypeDeclaration(
+            Mod, SMLoc(), DeclName, Ty);
+      break;
+    case interface::RecordType: {
+      uint32_t NumFields = C.readU32();
+      llvm::SmallVector<Field, 8> Fields;
+      for (uint32_t F = 0; F < NumFields && !C.hasError();
+           ++F) {
+        StringRef FieldName = ReadName();
+        TypeDeclaration *Ty = ReadType();
+        if (!Ty)
+          return Invalid();
+        Fields.emplace_back(SMLoc(), FieldName, Ty);
+      }
+      D = new (Context) RecordTypeDeclaration(
+          Mod, SMLoc(), DeclName,
+          Context.copyArray(ArrayRef<Field>(Fields)));
+      break;
+    }
+    case interface::Var:
+      if (TypeDeclaration *Ty = ReadType())
+        D = new (Context) VariableDeclaration(
+            Mod, SMLoc(), DeclName, Ty);
+      break;
+    case interface::Proc: {
+      auto *Proc = new (Context)
+          ProcedureDeclaration(Mod, SMLoc(), DeclName);
+      uint32_t NumParams = C.readU32();
+      llvm::SmallVector<FormalParameterDeclaration *, 8>
+          Params;
+      for (uint32_t P = 0; P < NumParams && !C.hasError();
+           ++P) {
+        StringRef ParamName = ReadName();
+        bool IsVar = C.readU8();
+        TypeDeclaration *Ty = ReadType();
+        if (!Ty)
+          return Invalid();
+        Params.push_back(new (Context)
+                             FormalParameterDeclaration(
+                                 Proc, SMLoc(), ParamName,
+                                 Ty, IsVar));
+      }
+      Proc->setFormalParams(Context.copyArray(
+          ArrayRef<FormalParameterDeclaration *>(Params)));
+      Proc->setRetType(ReadType());
+      D = Proc;
+      break;
+    }
+    }
+    if (!D || C.hasError())
+      return Invalid();
+    Decls.push_back(D);
+  }
+  if (C.hasError() || !C.atEnd())
+    return Invalid();
+  Mod->setDecls(Context.copyArray(ArrayRef<Decl *>(Decls)));
+  return Mod;
+}
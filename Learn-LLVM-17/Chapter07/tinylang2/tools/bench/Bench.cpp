@@ -0,0 +1,184 @@
+#include "tinylang/AST/ASTContext.h"
+#include "tinylang/Basic/Diagnostic.h"
+#include "tinylang/CodeGen/CodeGenerator.h"
+#include "tinylang/Lexer/Lexer.h"
+#include "tinylang/Parser/Parser.h"
+#include "llvm/IR/Module.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/TargetParser/Host.h"
+#include <chrono>
+
+using namespace llvm;
+using namespace tinylang;
+
+// Times the phases of the compiler on the input files.
+// The inputs are generated by the scripts next to this
+// file. Each phase runs -repeat times, and the fastest
+// run is reported.
+
+enum class Phase { Lex, IRGen };
+
+static cl::opt<Phase> BenchPhase(
+    cl::desc("Phase to time:"), cl::Required,
+    cl::values(clEnumValN(Phase::Lex, "lex",
+                          "Lex the input"),
+               clEnumValN(Phase::IRGen, "irgen",
+                          "Generate IR for the parsed "
+                          "input")));
+
+static cl::list<std::string>
+    InputFiles(cl::Positional, cl::OneOrMore,
+               cl::desc("<input-files>"));
+
+static cl::opt<unsigned>
+    Repeat("repeat", cl::desc("Number of runs"),
+           cl::init(10));
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::duration D) {
+  return std::chrono::duration<double>(D).count();
+}
+
+// Lexes the buffer until EOF. Returns the number of
+// tokens.
+size_t lex(SourceMgr &SrcMgr, DiagnosticsEngine &Diags) {
+  IdentifierTable Idents;
+  Lexer Lex(SrcMgr, Diags, Idents);
+  size_t NumTokens = 0;
+  Token Tok;
+  do {
+    Lex.next(Tok);
+    ++NumTokens;
+  } while (Tok.isNot(tok::eof));
+  return NumTokens;
+}
+
+bool benchLex(StringRef F,
+              std::unique_ptr<MemoryBuffer> Source) {
+  size_t Size = Source->getBufferSize();
+  SourceMgr SrcMgr;
+  DiagnosticsEngine Diags(SrcMgr);
+  SrcMgr.AddNewSourceBuffer(std::move(Source), SMLoc());
+  size_t NumTokens = 0;
+  double Best = 0;
+  for (unsigned I = 0; I < Repeat; ++I) {
+    Clock::time_point Start = Clock::now();
+    NumTokens = lex(SrcMgr, Diags);
+    double Time = seconds(Clock::now() - Start);
+    if (I == 0 || Time < Best)
+      Best = Time;
+  }
+  if (Diags.numErrors())
+    return false;
+  outs() << F << ": " << Size << " bytes, " << NumTokens
+         << " tokens, "
+         << format("%.1f ms, %.0f MB/s\n", Best * 1e3,
+                   Size / Best / 1e6);
+  return true;
+}
+
+// Parses the input once, and times the generation of IR
+// from the AST.
+bool benchIRGen(StringRef F,
+                std::unique_ptr<MemoryBuffer> Source,
+                TargetMachine *TM) {
+  SourceMgr SrcMgr;
+  DiagnosticsEngine Diags(SrcMgr);
+  SrcMgr.AddNewSourceBuffer(std::move(Source), SMLoc());
+  IdentifierTable Idents;
+  Lexer Lex(SrcMgr, Diags, Idents);
+  ASTContext ASTCtx(SrcMgr, F, Idents);
+  StringRef InputDir = sys::path::parent_path(F);
+  std::string SearchPath =
+      InputDir.empty() ? "." : InputDir.str();
+  Sema Actions(ASTCtx, Diags, SearchPath);
+  Parser P(Lex, Actions);
+  ModuleDeclaration *Mod = P.parse();
+  if (!Mod || Diags.numErrors())
+    return false;
+
+  size_t NumBlocks = 0;
+  double Best = 0;
+  for (unsigned I = 0; I < Repeat; ++I) {
+    LLVMContext Ctx;
+    std::unique_ptr<CodeGenerator> CG(
+        CodeGenerator::create(Ctx, ASTCtx, TM));
+    Clock::time_point Start = Clock::now();
+    std::unique_ptr<Module> M = CG->run(Mod, F.str());
+    double Time = seconds(Clock::now() - Start);
+    if (I == 0 || Time < Best)
+      Best = Time;
+    NumBlocks = 0;
+    for (Function &Fn : *M)
+      NumBlocks += Fn.size();
+  }
+  outs() << F << ": " << NumBlocks << " blocks, "
+         << format("%.1f ms\n", Best * 1e3);
+  return true;
+}
+
+TargetMachine *createTargetMachine(const char *Argv0) {
+  std::string Triple = sys::getDefaultTargetTriple();
+  std::string Error;
+  const Target *T =
+      TargetRegistry::lookupTarget(Triple, Error);
+  if (!T) {
+    WithColor::error(errs(), Argv0) << Error << "\n";
+    return nullptr;
+  }
+  return T->createTargetMachine(Triple, "generic", "",
+                                TargetOptions(),
+                                Reloc::PIC_);
+}
+} // namespace
+
+int main(int Argc, const char **Argv) {
+  InitLLVM X(Argc, Argv);
+  cl::ParseCommandLineOptions(
+      Argc, Argv, "tinylang compiler benchmarks\n");
+  if (Repeat == 0)
+    Repeat = 1;
+
+  std::unique_ptr<TargetMachine> TM;
+  if (BenchPhase == Phase::IRGen) {
+    InitializeNativeTarget();
+    TM.reset(createTargetMachine(Argv[0]));
+    if (!TM)
+      return 1;
+  }
+
+  bool Ok = true;
+  for (const auto &F : InputFiles) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> FileOrErr =
+        MemoryBuffer::getFile(F);
+    if (std::error_code BufferError =
+            FileOrErr.getError()) {
+      WithColor::error(errs(), Argv[0])
+          << "Error reading " << F << ": "
+          << BufferError.message() << "\n";
+      Ok = false;
+      continue;
+    }
+    switch (BenchPhase) {
+    case Phase::Lex:
+      Ok &= benchLex(F, std::move(*FileOrErr));
+      break;
+    case Phase::IRGen:
+      Ok &= benchIRGen(F, std::move(*FileOrErr),
+                       TM.get());
+      break;
+    }
+  }
+  return Ok ? 0 : 1;
+}
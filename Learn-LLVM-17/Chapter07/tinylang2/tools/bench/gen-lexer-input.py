@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Generates a large tinylang module for tinylang-bench -lex.
+
+The module consists of many small procedures. With --style=code, they
+are mostly statements with short names and single spaces. With
+--style=comments, long block comments and wide indentation make up
+most of the text.
+"""
+
+import argparse
+import random
+
+WORDS = ["count", "index", "value", "result", "total", "limit", "step"]
+
+
+def identifier(rnd):
+    name = rnd.choice(WORDS)
+    if rnd.random() < 0.5:
+        name += str(rnd.randint(0, 99))
+    return name
+
+
+def expression(rnd, depth=0):
+    if depth > 1 or rnd.random() < 0.4:
+        if rnd.random() < 0.7:
+            return identifier(rnd)
+        return str(rnd.randint(0, 100000))
+    op = rnd.choice(["+", "-", "*", "DIV", "MOD"])
+    return "%s %s %s" % (expression(rnd, depth + 1), op, expression(rnd, depth + 1))
+
+
+def comment(rnd, words):
+    text = " ".join(rnd.choice(WORDS) for _ in range(words))
+    return "(* %s *)" % text
+
+
+def procedure(rnd, num, style):
+    indent = "  " if style == "code" else " " * 12
+    lines = []
+    if style == "comments":
+        lines.append(comment(rnd, 60))
+    lines.append("PROCEDURE P%d(a, b: INTEGER): INTEGER;" % num)
+    lines.append("VAR %s: INTEGER;" % ", ".join(WORDS))
+    lines.append("BEGIN")
+    for _ in range(rnd.randint(4, 12)):
+        stmt = "%s := %s;" % (rnd.choice(WORDS), expression(rnd))
+        if style == "comments" or rnd.random() < 0.1:
+            stmt += " " + comment(rnd, 12 if style == "comments" else 3)
+        lines.append(indent + stmt)
+        if rnd.random() < 0.2:
+            lines.append(indent + "IF %s < %s THEN" % (identifier(rnd), expression(rnd)))
+            lines.append(indent * 2 + "%s := %s" % (rnd.choice(WORDS), expression(rnd)))
+            lines.append(indent + "END;")
+    lines.append(indent + "RETURN %s" % expression(rnd))
+    lines.append("END P%d;" % num)
+    lines.append("")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--style", choices=["code", "comments"], default="code")
+    parser.add_argument("--size", type=float, default=11, help="size in MB")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("-o", dest="output", required=True)
+    args = parser.parse_args()
+
+    rnd = random.Random(args.seed)
+    limit = int(args.size * 1000000)
+    size = 0
+    num = 0
+    with open(args.output, "w") as out:
+        out.write("MODULE Lex;\n\n")
+        while size < limit:
+            text = procedure(rnd, num, args.style)
+            out.write(text)
+            size += len(text)
+            num += 1
+        out.write("END Lex.\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+"""Generates a tinylang module for tinylang-bench -irgen.
+
+The module has one procedure with --vars INTEGER locals and --stmts
+statements at the top level. 80% of the statements are IF/ELSE and
+20% are WHILE loops, each assigning some of the locals, so reading a
+local requires the SSA construction to look through many blocks.
+"""
+
+import argparse
+import random
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--vars", type=int, default=1000)
+    parser.add_argument("--stmts", type=int, default=500)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("-o", dest="output", required=True)
+    args = parser.parse_args()
+
+    rnd = random.Random(args.seed)
+    names = ["v%d" % i for i in range(args.vars)]
+
+    def assign():
+        return "%s := %s + %s" % (
+            rnd.choice(names),
+            rnd.choice(names),
+            rnd.randint(1, 9),
+        )
+
+    with open(args.output, "w") as out:
+        out.write("MODULE SSA;\n\n")
+        out.write("PROCEDURE P(n: INTEGER): INTEGER;\n")
+        out.write("VAR %s: INTEGER;\n" % ", ".join(names))
+        out.write("BEGIN\n")
+        for name in names:
+            out.write("  %s := n;\n" % name)
+        for _ in range(args.stmts):
+            if rnd.random() < 0.8:
+                out.write(
+                    "  IF %s < %s THEN %s ELSE %s END;\n"
+                    % (rnd.choice(names), rnd.choice(names), assign(), assign())
+                )
+            else:
+                var = rnd.choice(names)
+                out.write(
+                    "  WHILE %s < n DO %s := %s + 1; %s END;\n"
+                    % (var, var, var, assign())
+                )
+        out.write("  RETURN %s\n" % " + ".join(rnd.sample(names, min(8, len(names)))))
+        out.write("END P;\n\nEND SSA.\n")
+
+
+if __name__ == "__main__":
+    main()
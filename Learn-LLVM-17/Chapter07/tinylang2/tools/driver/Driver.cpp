@@ -3,20 +3,40 @@
 #include "tinylang/Basic/Version.h"
 #include "tinylang/CodeGen/CodeGenerator.h"
 #include "tinylang/Parser/Parser.h"
+#include "tinylang/Serialization/ModuleInterface.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/CodeGen/CommandFlags.h"
+#include "llvm/CodeGen/ParallelCG.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/IRPrintingPasses.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/PassTimingInfo.h"
 #include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/Caching.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/InitLLVM.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/WithColor.h"
+#include "llvm/Support/xxhash.h"
 #include "llvm/TargetParser/Host.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <queue>
 
 #include "llvm/Passes/PassBuilder.h" // New
+#include "llvm/Passes/StandardInstrumentations.h"
 #include "llvm/Passes/PassPlugin.h" // New
 #include "llvm/Analysis/AliasAnalysis.h" // New
 #include "llvm/Analysis/TargetTransformInfo.h" // New
@@ -71,6 +91,69 @@ static cl::opt<std::string> PipelineStartEPPipeline(
     "passes-ep-pipeline-start",
     cl::desc("Pipeline start extension point"));
 
+static cl::list<std::string> ImportPaths(
+    "I", cl::Prefix,
+    cl::desc("Add a directory to the search path for "
+             "module interfaces"),
+    cl::value_desc("directory"));
+
+static cl::opt<unsigned> Jobs(
+    "j",
+    cl::desc("Number of input files to compile in "
+             "parallel (0 = one per hardware thread)"),
+    cl::init(1));
+
+static cl::opt<unsigned> CodeGenThreads(
+    "codegen-threads",
+    cl::desc("Split each module into this many "
+             "partitions and generate code for them in "
+             "parallel, one output file per partition"),
+    cl::init(1));
+
+static cl::opt<std::string> CacheDir(
+    "cache-dir",
+    cl::desc("Reuse the outputs of earlier compilations "
+             "stored in this directory"),
+    cl::value_desc("directory"));
+
+static cl::opt<std::string> CachePolicy(
+    "cache-policy",
+    cl::desc("Pruning policy of the compile cache, e.g. "
+             "cache_size_bytes=1g:prune_interval=20m"),
+    cl::init("cache_size_bytes=1g"));
+
+static cl::opt<bool>
+    CacheStats("cache-stats",
+               cl::desc("Print the number of compile "
+                        "cache hits and misses"));
+
+static cl::opt<bool> TimeTrace(
+    "ftime-trace",
+    cl::desc("Write a Chrome trace of the compiler phases "
+             "next to the output file"));
+
+static cl::opt<unsigned> TimeTraceGranularity(
+    "ftime-trace-granularity",
+    cl::desc("Minimum duration of a traced event in "
+             "microseconds"),
+    cl::init(500));
+
+static cl::opt<bool> TimeReport(
+    "time-report",
+    cl::desc("Print the time spent in the compiler phases "
+             "and the optimization passes"));
+
+static cl::opt<bool>
+    JIT("jit",
+        cl::desc("Compile the input files into a JIT and "
+                 "run their module bodies"));
+
+static cl::opt<std::string> EntryProcedure(
+    "entry",
+    cl::desc("With -jit, the procedure of the last input "
+             "file to run after the module bodies"),
+    cl::value_desc("procedure"));
+
 static const char *Head = "tinylang - Tinylang compiler";
 
 void printVersion(llvm::raw_ostream &OS) {
@@ -144,41 +227,370 @@ std::string outputFilename(StringRef InputFilename) {
   return OutputFilename;
 }
 
-#define HANDLE_EXTENSION(Ext)                          \
-  llvm::PassPluginLibraryInfo get##Ext##PluginInfo();
-#include "llvm/Support/Extension.def"
+// The options of the driver which do not change the
+// output of a compilation. They are not part of the cache
+// key, so e.g. a parallel build shares the cache with a
+// serial one.
+static bool isDriverOption(StringRef Arg,
+                           bool &TakesValue) {
+  StringRef Name = Arg.ltrim('-').split('=').first;
+  bool IsFlag = Name == "cache-stats" ||
+                Name == "ftime-trace" ||
+                Name == "time-report";
+  bool HasValue = Name == "j" || Name == "cache-dir" ||
+                  Name == "cache-policy" ||
+                  Name == "ftime-trace-granularity";
+  TakesValue = HasValue && !Arg.contains('=');
+  return IsFlag || HasValue;
+}
 
-bool emit(StringRef Argv0, llvm::Module *M,
-          llvm::TargetMachine *TM,
-          StringRef InputFilename) {
+// Returns the SHA1 of the parts as a hex string.
+static std::string hashParts(ArrayRef<StringRef> Parts) {
+  SHA1 Hasher;
+  for (StringRef Part : Parts) {
+    // The length separates the parts.
+    Hasher.update(utostr(Part.size()) + ":");
+    Hasher.update(Part);
+  }
+  return toHex(Hasher.final(), /*LowerCase=*/true);
+}
 
-  // Create the optimization pipeline
-  PassBuilder PB(TM);
+// Returns a hash of everything besides the source which
+// determines the output of a compilation: the compiler,
+// the command line without the input files, the target
+// as resolved by the target machine, and the loaded pass
+// plugins.
+std::string hashOptions(ArrayRef<const char *> Argv,
+                        llvm::TargetMachine *TM) {
+  std::string CPU(TM->getTargetCPU());
+  std::string Features(TM->getTargetFeatureString());
+  SmallVector<std::string, 16> Parts = {
+      getTinylangVersion(), LLVM_VERSION_STRING,
+      TM->getTargetTriple().str(), CPU, Features};
 
-  // Load requested pass plugins and let them register
-  // pass builder callbacks
-  for (auto &PluginFN : PassPlugins) {
-    auto PassPlugin = PassPlugin::Load(PluginFN);
-    if (!PassPlugin) {
-      WithColor::error(errs(), Argv0)
-          << "Failed to load passes from '" << PluginFN
-          << "'. Request ignored.\n";
+  SmallVector<bool, 16> IsInput(Argv.size(), false);
+  for (unsigned I = 0, E = InputFiles.size(); I != E; ++I)
+    IsInput[InputFiles.getPosition(I)] = true;
+  for (size_t I = 1, E = Argv.size(); I < E; ++I) {
+    bool TakesValue;
+    if (isDriverOption(Argv[I], TakesValue)) {
+      I += TakesValue;
       continue;
     }
+    if (!IsInput[I])
+      Parts.push_back(Argv[I]);
+  }
+
+  // A rebuilt plugin changes the output, too.
+  for (const std::string &Plugin : PassPlugins) {
+    sys::fs::file_status Status;
+    if (sys::fs::status(Plugin, Status))
+      continue;
+    Parts.push_back(utostr(Status.getSize()));
+    Parts.push_back(utostr(
+        Status.getLastModificationTime()
+            .time_since_epoch()
+            .count()));
+  }
+  return hashParts(SmallVector<StringRef, 16>(
+      Parts.begin(), Parts.end()));
+}
+
+namespace {
+// The compile cache stores the output file and the
+// interface of a module, keyed by a hash of the inputs of
+// the compilation. The imported interface files are only
+// known after parsing, so a lookup takes two steps: the
+// hash of the options and the source finds a manifest,
+// which lists the imported interface files and the hashes
+// of their contents. If these files are unchanged, then
+// the hash of the manifest finds the outputs. A hit skips
+// parsing, optimization and code generation.
+//
+// The entries are files in the cache directory, written
+// under a temporary name and renamed, so concurrent
+// compilers never see a partial entry.
+class CompileCache {
+  FileCache Cache;
+  std::string Dir;
+  std::string OptionsHash;
+
+  // An entry found by the last lookup of a task.
+  std::vector<std::unique_ptr<MemoryBuffer>> Buffers;
+
+  Expected<std::unique_ptr<MemoryBuffer>>
+  lookup(unsigned Task, StringRef Key);
+  Error store(unsigned Task, StringRef Key,
+              StringRef Data);
+
+  static std::string
+  getResultKey(StringRef ManifestKey,
+               StringRef Manifest) {
+    return hashParts({ManifestKey, Manifest});
+  }
+
+public:
+  std::atomic<unsigned> Hits = 0;
+  std::atomic<unsigned> Misses = 0;
+
+  // The outputs of a compilation.
+  struct Result {
+    std::string ModuleName;
+    std::unique_ptr<MemoryBuffer> Output;
+    std::unique_ptr<MemoryBuffer> Interface;
+  };
+
+  CompileCache(std::string OptionsHash, size_t NumTasks)
+      : OptionsHash(std::move(OptionsHash)),
+        Buffers(NumTasks) {}
+
+  Error open(StringRef Path);
 
-    PassPlugin->registerPassBuilderCallbacks(PB);
+  std::string getManifestKey(StringRef InputFilename,
+                             StringRef Source) {
+    return hashParts({OptionsHash, InputFilename, Source});
   }
 
+  // Looks up the outputs of a compilation. R.Output is
+  // nullptr if there are none.
+  Error find(unsigned Task, StringRef ManifestKey,
+             Result &R);
+  Error add(unsigned Task, StringRef ManifestKey,
+            StringRef ModuleName,
+            ArrayRef<InterfaceFile> Imports,
+            StringRef Output, StringRef Interface);
+};
+} // namespace
+
+Error CompileCache::open(StringRef Path) {
+  Dir = Path.str();
+  // Each task collects its own entries, so the tasks do
+  // not need to synchronize.
+  Expected<FileCache> CacheOrErr = localCache(
+      "tinylang", "tinylang-cache", Dir,
+      [this](unsigned Task, const Twine &ModuleName,
+             std::unique_ptr<MemoryBuffer> MB) {
+        Buffers[Task] = std::move(MB);
+      });
+  if (!CacheOrErr)
+    return CacheOrErr.takeError();
+  Cache = std::move(*CacheOrErr);
+  return Error::success();
+}
+
+Expected<std::unique_ptr<MemoryBuffer>>
+CompileCache::lookup(unsigned Task, StringRef Key) {
+  Expected<AddStreamFn> AddStream = Cache(Task, Key, "");
+  if (!AddStream)
+    return AddStream.takeError();
+  return std::move(Buffers[Task]);
+}
+
+Error CompileCache::store(unsigned Task, StringRef Key,
+                          StringRef Data) {
+  Expected<AddStreamFn> AddStream = Cache(Task, Key, "");
+  if (!AddStream)
+    return AddStream.takeError();
+  // There is no stream if the entry is already stored,
+  // e.g. by a concurrent compilation of the same source.
+  if (*AddStream) {
+    Expected<std::unique_ptr<CachedFileStream>> File =
+        (*AddStream)(Task, "");
+    if (!File)
+      return File.takeError();
+    *(*File)->OS << Data;
+    // Destroying the stream renames the file.
+    File->reset();
+  }
+  Buffers[Task].reset();
+  return Error::success();
+}
+
+Error CompileCache::find(unsigned Task,
+                         StringRef ManifestKey, Result &R) {
+  Expected<std::unique_ptr<MemoryBuffer>> Manifest =
+      lookup(Task, ManifestKey);
+  if (!Manifest || !*Manifest)
+    return Manifest.takeError();
+
+  // The first line is the name of the module, each
+  // further line is the hash and the path of an imported
+  // interface file.
+  SmallVector<StringRef, 8> Lines;
+  (*Manifest)->getBuffer().split(Lines, '\n', -1, false);
+  if (Lines.empty())
+    return Error::success();
+  for (StringRef Line : drop_begin(Lines)) {
+    auto [Hash, Path] = Line.split(' ');
+    ErrorOr<std::unique_ptr<MemoryBuffer>> File =
+        MemoryBuffer::getFile(
+            Path, /*IsText=*/false,
+            /*RequiresNullTerminator=*/false);
+    if (!File ||
+        utohexstr(xxHash64((*File)->getBuffer())) != Hash)
+      return Error::success();
+  }
+
+  std::string ResultKey = getResultKey(
+      ManifestKey, (*Manifest)->getBuffer());
+  Expected<std::unique_ptr<MemoryBuffer>> Output =
+      lookup(Task, ResultKey);
+  if (!Output)
+    return Output.takeError();
+  Expected<std::unique_ptr<MemoryBuffer>> Interface =
+      lookup(Task, ResultKey + interface::Extension);
+  if (!Interface)
+    return Interface.takeError();
+  // The cache may have been pruned between the lookups.
+  if (!*Output || !*Interface)
+    return Error::success();
+  R.ModuleName = Lines.front().str();
+  R.Output = std::move(*Output);
+  R.Interface = std::move(*Interface);
+  return Error::success();
+}
+
+Error CompileCache::add(unsigned Task,
+                        StringRef ManifestKey,
+                        StringRef ModuleName,
+                        ArrayRef<InterfaceFile> Imports,
+                        StringRef Output,
+                        StringRef Interface) {
+  std::string Manifest = (ModuleName + "\n").str();
+  for (const InterfaceFile &Import : Imports)
+    Manifest += utohexstr(Import.Hash) + " " +
+                Import.Path + "\n";
+
+  // The manifest is stored last, so it is never found
+  // before the outputs.
+  std::string ResultKey =
+      getResultKey(ManifestKey, Manifest);
+  if (Error Err = store(Task, ResultKey, Output))
+    return Err;
+  if (Error Err =
+          store(Task, ResultKey + interface::Extension,
+                Interface))
+    return Err;
+
+  // After a change of an imported interface, the
+  // manifest is replaced. The cache does not replace
+  // entries, so the file is written here, using the
+  // naming scheme of the cache.
+  SmallString<128> Path(Dir);
+  sys::path::append(Path, "llvmcache-" + ManifestKey);
+  return writeToOutput(Path, [&](raw_ostream &OS) {
+    OS << Manifest;
+    return Error::success();
+  });
+}
+
+namespace {
+// The timers of the compiler phases for -time-report.
+// Lexing, parsing and semantic analysis are interleaved,
+// so they are timed together.
+struct PhaseTimers {
+  TimerGroup Group{"tinylang", "Tinylang compiler phases"};
+  Timer Parse{"parse", "Lexing, parsing and Sema", Group};
+  Timer IRGen{"irgen", "IR generation", Group};
+  Timer Optimizer{"optimizer", "Optimization pipeline",
+                  Group};
+  Timer CodeGen{"codegen", "Code generation passes",
+                Group};
+};
+
+// Records a compiler phase in the time trace and, with
+// -time-report, in the timer T.
+class PhaseScope {
+  TimeTraceScope Trace;
+  TimeRegion Region;
+
+public:
+  PhaseScope(StringRef Name, Timer *T)
+      : Trace(Name), Region(T) {}
+};
+} // namespace
+
 #define HANDLE_EXTENSION(Ext)                          \
-  get##Ext##PluginInfo().RegisterPassBuilderCallbacks( \
-      PB);
+  llvm::PassPluginLibraryInfo get##Ext##PluginInfo();
 #include "llvm/Support/Extension.def"
 
+// Returns the number of partitions of the code
+// generation for the input file. Only machine code is
+// partitioned, and each partition needs its own file.
+unsigned numPartitions(StringRef InputFilename) {
+  CodeGenFileType FileType = codegen::getFileType();
+  if (FileType == CGFT_Null ||
+      (FileType == CGFT_AssemblyFile && EmitLLVM) ||
+      outputFilename(InputFilename) == "-")
+    return 1;
+  return std::max(1u, unsigned(CodeGenThreads));
+}
+
+// Returns the name of the output file of a partition.
+// The first partition uses the output file of the input
+// file, e.g. Main.o, Main.1.o, Main.2.o.
+std::string partitionFilename(StringRef InputFilename,
+                              unsigned Partition) {
+  SmallString<128> Path(outputFilename(InputFilename));
+  if (Partition) {
+    std::string Ext = sys::path::extension(Path).str();
+    sys::path::replace_extension(
+        Path, "." + utostr(Partition) + Ext);
+  }
+  return std::string(Path);
+}
+
+std::unique_ptr<ToolOutputFile>
+openOutput(StringRef Argv0, StringRef InputFilename,
+           raw_ostream &ErrOS, unsigned Partition = 0) {
+  std::error_code EC;
+  sys::fs::OpenFlags OpenFlags = sys::fs::OF_None;
+  if (codegen::getFileType() == CGFT_AssemblyFile)
+    OpenFlags |= sys::fs::OF_Text;
+  auto Out = std::make_unique<llvm::ToolOutputFile>(
+      partitionFilename(InputFilename, Partition), EC,
+      OpenFlags);
+  if (EC) {
+    WithColor::error(ErrOS, Argv0)
+        << EC.message() << '\n';
+    return nullptr;
+  }
+  return Out;
+}
+
+// Runs the optimization pipeline over M.
+bool optimize(StringRef Argv0, llvm::Module *M,
+              llvm::TargetMachine *TM,
+              ArrayRef<PassPlugin> Plugins,
+              PhaseTimers *Timers, raw_ostream &ErrOS) {
   LoopAnalysisManager LAM;
   FunctionAnalysisManager FAM;
   CGSCCAnalysisManager CGAM;
   ModuleAnalysisManager MAM;
 
+  // The instrumentation adds the passes to the time
+  // trace, and times them for -time-report.
+  PassInstrumentationCallbacks PIC;
+  StandardInstrumentations SI(M->getContext(), DebugPM);
+  SI.registerCallbacks(PIC, &MAM);
+  TimePassesHandler TimePasses(TimeReport);
+  TimePasses.setOutStream(ErrOS);
+  TimePasses.registerCallbacks(PIC);
+
+  // Create the optimization pipeline
+  PassBuilder PB(TM, PipelineTuningOptions(), std::nullopt,
+                 &PIC);
+
+  // Let the loaded pass plugins register pass builder
+  // callbacks
+  for (const PassPlugin &P : Plugins)
+    P.registerPassBuilderCallbacks(PB);
+
+#define HANDLE_EXTENSION(Ext)                          \
+  get##Ext##PluginInfo().RegisterPassBuilderCallbacks( \
+      PB);
+#include "llvm/Support/Extension.def"
+
   // Register the AA manager first so that our version
   // is the one used.
   FAM.registerPass(
@@ -191,25 +603,26 @@ bool emit(StringRef Argv0, llvm::Module *M,
   PB.registerLoopAnalyses(LAM);
   PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
 
-  PB.registerPipelineStartEPCallback(
-      [&PB,
-       Argv0](ModulePassManager &PM,
-              OptimizationLevel Level) {
-        if (auto Err = PB.parsePassPipeline(
-                PM, PipelineStartEPPipeline)) {
-          WithColor::error(errs(), Argv0)
-              << "Could not parse pipeline "
-              << PipelineStartEPPipeline.ArgStr << ": "
-              << toString(std::move(Err)) << "\n";
-        }
-      });
+  if (!PipelineStartEPPipeline.empty())
+    PB.registerPipelineStartEPCallback(
+        [&PB, &ErrOS,
+         Argv0](ModulePassManager &PM,
+                OptimizationLevel Level) {
+          if (auto Err = PB.parsePassPipeline(
+                  PM, PipelineStartEPPipeline)) {
+            WithColor::error(ErrOS, Argv0)
+                << "Could not parse pipeline "
+                << PipelineStartEPPipeline.ArgStr << ": "
+                << toString(std::move(Err)) << "\n";
+          }
+        });
 
   ModulePassManager MPM;
 
   if (!PassPipeline.empty()) {
     if (auto Err = PB.parsePassPipeline(
             MPM, PassPipeline)) {
-      WithColor::error(errs(), Argv0)
+      WithColor::error(ErrOS, Argv0)
           << toString(std::move(Err)) << "\n";
       return false;
     }
@@ -225,43 +638,559 @@ bool emit(StringRef Argv0, llvm::Module *M,
     }
     if (auto Err = PB.parsePassPipeline(
             MPM, DefaultPass)) {
-      WithColor::error(errs(), Argv0)
+      WithColor::error(ErrOS, Argv0)
           << toString(std::move(Err)) << "\n";
       return false;
     }
   }
 
-  // Open the file.
-  std::error_code EC;
-  sys::fs::OpenFlags OpenFlags = sys::fs::OF_None;
-  CodeGenFileType FileType = codegen::getFileType();
-  if (FileType == CGFT_AssemblyFile)
-    OpenFlags |= sys::fs::OF_Text;
-  auto Out = std::make_unique<llvm::ToolOutputFile>(
-      outputFilename(InputFilename), EC, OpenFlags);
-  if (EC) {
-    WithColor::error(errs(), Argv0)
-        << EC.message() << '\n';
+  PhaseScope Phase("Optimizer",
+                   Timers ? &Timers->Optimizer : nullptr);
+  MPM.run(*M, MAM);
+  return true;
+}
+
+// Optimizes M and writes its code to OSs. With more than
+// one stream, M is split into one partition per stream,
+// like in LTO, and the code for the partitions is
+// generated in parallel, each with its own target
+// machine. Linking the outputs together is equivalent to
+// the output of the whole module.
+bool emit(StringRef Argv0, llvm::Module *M,
+          llvm::TargetMachine *TM,
+          ArrayRef<raw_pwrite_stream *> OSs,
+          ArrayRef<PassPlugin> Plugins,
+          PhaseTimers *Timers, raw_ostream &ErrOS) {
+  if (!optimize(Argv0, M, TM, Plugins, Timers, ErrOS))
     return false;
+
+  CodeGenFileType FileType = codegen::getFileType();
+  if (OSs.size() > 1) {
+    PhaseScope Phase("CodeGenPasses",
+                     Timers ? &Timers->CodeGen : nullptr);
+    // The partitions are generated in separate contexts,
+    // so the module must not be used afterwards.
+    splitCodeGen(
+        *M, OSs, /*BCOSs=*/{},
+        [Argv0 = Argv0.str()]() {
+          return std::unique_ptr<llvm::TargetMachine>(
+              createTargetMachine(Argv0.c_str()));
+        },
+        FileType);
+    return true;
   }
 
+  raw_pwrite_stream &OS = *OSs.front();
   legacy::PassManager CodeGenPM;
   CodeGenPM.add(createTargetTransformInfoWrapperPass(
       TM->getTargetIRAnalysis()));
   if (FileType == CGFT_AssemblyFile && EmitLLVM) {
-    CodeGenPM.add(createPrintModulePass(Out->os()));
+    CodeGenPM.add(createPrintModulePass(OS));
   } else {
-    if (TM->addPassesToEmitFile(CodeGenPM, Out->os(),
+    if (TM->addPassesToEmitFile(CodeGenPM, OS,
                                 nullptr, FileType)) {
-      WithColor::error()
+      WithColor::error(ErrOS, Argv0)
           << "No support for file type\n";
       return false;
     }
   }
 
-  MPM.run(*M, MAM);
+  PhaseScope Phase("CodeGenPasses",
+                   Timers ? &Timers->CodeGen : nullptr);
   CodeGenPM.run(*M);
+  return true;
+}
+
+// Writes the interface of module ModName next to the
+// input file. The file is written under a temporary name
+// and renamed, so a concurrent compilation never sees a
+// partial interface.
+bool writeInterface(const char *Argv0, StringRef F,
+                    StringRef ModName, StringRef Interface,
+                    raw_ostream &ErrOS) {
+  SmallString<128> Path(sys::path::parent_path(F));
+  sys::path::append(Path,
+                    Twine(ModName) + interface::Extension);
+  if (Error Err =
+          writeToOutput(Path, [Interface](raw_ostream &OS) {
+            OS << Interface;
+            return Error::success();
+          })) {
+    WithColor::error(ErrOS, Argv0)
+        << toString(std::move(Err)) << "\n";
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+readSource(const char *Argv0, StringRef F,
+           raw_ostream &ErrOS) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+      FileOrErr = llvm::MemoryBuffer::getFile(F);
+  if (std::error_code BufferError = FileOrErr.getError()) {
+    llvm::WithColor::error(ErrOS, Argv0)
+        << "Error reading " << F << ": "
+        << BufferError.message() << "\n";
+    return nullptr;
+  }
+  return std::move(*FileOrErr);
+}
+
+namespace {
+// The name of the module in an input file, and the names
+// of the modules it imports.
+struct ModuleHead {
+  std::string Name;
+  SmallVector<std::string, 4> Imports;
+};
+} // namespace
+
+// Lexes the head of the module in F, up to the first
+// declaration. Errors are not reported here, because the
+// compilation of F reports them.
+ModuleHead scanModuleHead(StringRef F) {
+  ModuleHead Head;
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+      FileOrErr = llvm::MemoryBuffer::getFile(F);
+  if (!FileOrErr)
+    return Head;
+  llvm::SourceMgr SrcMgr;
+  DiagnosticsEngine Diags(SrcMgr, nulls());
+  SrcMgr.AddNewSourceBuffer(std::move(*FileOrErr),
+                            llvm::SMLoc());
+  IdentifierTable Idents;
+  Lexer Lex(SrcMgr, Diags, Idents);
+  Token Tok;
+  Lex.next(Tok);
+  if (Tok.isNot(tok::kw_MODULE))
+    return Head;
+  Lex.next(Tok);
+  if (Tok.isNot(tok::identifier))
+    return Head;
+  Head.Name = Tok.getIdentifier().str();
+  Lex.next(Tok);
+  if (Tok.isNot(tok::semi))
+    return Head;
+  Lex.next(Tok);
+  while (Tok.isOneOf(tok::kw_FROM, tok::kw_IMPORT)) {
+    // FROM M IMPORT X imports M, IMPORT M, N imports
+    // all listed modules.
+    bool IsFrom = Tok.is(tok::kw_FROM);
+    Lex.next(Tok);
+    if (IsFrom && Tok.is(tok::identifier))
+      Head.Imports.push_back(Tok.getIdentifier().str());
+    while (Tok.isNot(tok::semi) && Tok.isNot(tok::eof)) {
+      if (!IsFrom && Tok.is(tok::identifier))
+        Head.Imports.push_back(Tok.getIdentifier().str());
+      Lex.next(Tok);
+    }
+    Lex.next(Tok);
+  }
+  return Head;
+}
+
+namespace {
+// The imports between the input files. An input is
+// compiled after the inputs defining the modules it
+// imports, because it reads the interface files they
+// write.
+struct ImportGraph {
+  // The inputs importing input I.
+  std::vector<SmallVector<size_t, 4>> Users;
+  // The number of inputs imported by input I.
+  std::vector<unsigned> NumImports;
+  // The inputs in compilation order. Independent inputs
+  // keep the order of the command line. If the imports
+  // form a cycle, this is the order of the command line.
+  std::vector<size_t> Order;
+  bool HasCycle = false;
+};
+} // namespace
+
+ImportGraph buildImportGraph(ArrayRef<std::string> Files) {
+  size_t NumInputs = Files.size();
+  ImportGraph G;
+  G.Users.resize(NumInputs);
+  G.NumImports.assign(NumInputs, 0);
+  std::vector<ModuleHead> Heads;
+  StringMap<size_t> Definitions;
+  for (size_t I = 0; I != NumInputs; ++I) {
+    Heads.push_back(scanModuleHead(Files[I]));
+    if (!Heads[I].Name.empty())
+      Definitions.try_emplace(Heads[I].Name, I);
+  }
+  for (size_t I = 0; I != NumInputs; ++I)
+    for (const std::string &Import : Heads[I].Imports) {
+      auto It = Definitions.find(Import);
+      if (It == Definitions.end() || It->second == I)
+        continue;
+      G.Users[It->second].push_back(I);
+      ++G.NumImports[I];
+    }
+
+  // Always continue with the first ready input on the
+  // command line.
+  std::vector<unsigned> Left(G.NumImports);
+  std::priority_queue<size_t, std::vector<size_t>,
+                      std::greater<size_t>>
+      Ready;
+  for (size_t I = 0; I != NumInputs; ++I)
+    if (!Left[I])
+      Ready.push(I);
+  while (!Ready.empty()) {
+    size_t I = Ready.top();
+    Ready.pop();
+    G.Order.push_back(I);
+    for (size_t U : G.Users[I])
+      if (!--Left[U])
+        Ready.push(U);
+  }
+  if (G.Order.size() != NumInputs) {
+    G.HasCycle = true;
+    G.Order.clear();
+    for (size_t I = 0; I != NumInputs; ++I)
+      G.Order.push_back(I);
+  }
+  return G;
+}
+
+namespace {
+// The interface of a compiled module, and the interface
+// files it imported.
+struct ModuleInfo {
+  std::string Name;
+  std::string Interface;
+  std::vector<InterfaceFile> Imports;
+};
+} // namespace
+
+// Parses the source of F, writes the interface of the
+// module and generates its IR in Ctx. Returns nullptr if
+// there are errors.
+std::unique_ptr<llvm::Module>
+generate(const char *Argv0, StringRef F,
+         std::unique_ptr<llvm::MemoryBuffer> Source,
+         llvm::LLVMContext &Ctx, llvm::TargetMachine *TM,
+         PhaseTimers *Timers, ModuleInfo &Info,
+         raw_ostream &ErrOS) {
+  llvm::SourceMgr SrcMgr;
+  DiagnosticsEngine Diags(SrcMgr, ErrOS);
+
+  // Tell SrcMgr about this buffer, which is what the
+  // parser will pick up.
+  SrcMgr.AddNewSourceBuffer(std::move(Source),
+                            llvm::SMLoc());
+
+  IdentifierTable Idents;
+  auto TheLexer = Lexer(SrcMgr, Diags, Idents);
+  auto ASTCtx = ASTContext(SrcMgr, F, Idents);
+  // Imported modules are searched next to the input file
+  // first.
+  std::vector<std::string> SearchPaths;
+  StringRef InputDir = sys::path::parent_path(F);
+  SearchPaths.push_back(InputDir.empty() ? "."
+                                         : InputDir.str());
+  SearchPaths.insert(SearchPaths.end(),
+                     ImportPaths.begin(),
+                     ImportPaths.end());
+  auto TheSema = Sema(ASTCtx, Diags, SearchPaths);
+  auto TheParser = Parser(TheLexer, TheSema);
+  ModuleDeclaration *Mod;
+  {
+    PhaseScope Phase("Parse",
+                     Timers ? &Timers->Parse : nullptr);
+    Mod = TheParser.parse();
+  }
+  if (!Mod || Diags.numErrors())
+    return nullptr;
+  Info.Name = Mod->getName().str();
+  raw_string_ostream InterfaceOS(Info.Interface);
+  writeModuleInterface(Mod, InterfaceOS);
+  ArrayRef<InterfaceFile> Imports =
+      TheSema.getImportedInterfaces();
+  Info.Imports.assign(Imports.begin(), Imports.end());
+  if (!writeInterface(Argv0, F, Info.Name, Info.Interface,
+                      ErrOS))
+    return nullptr;
+
+  std::unique_ptr<CodeGenerator> CG(
+      CodeGenerator::create(Ctx, ASTCtx, TM));
+  // The code generator adds itself to the time trace.
+  TimeRegion Region(Timers ? &Timers->IRGen : nullptr);
+  return CG->run(Mod, F.str());
+}
+
+bool compileFile(const char *Argv0, unsigned Task,
+                 StringRef F, ArrayRef<PassPlugin> Plugins,
+                 CompileCache *Cache, PhaseTimers *Timers,
+                 raw_ostream &ErrOS) {
+  std::unique_ptr<llvm::MemoryBuffer> Source =
+      readSource(Argv0, F, ErrOS);
+  if (!Source)
+    return false;
+
+  // A restored output is written to a file, so output to
+  // stdout is not cached. The cache holds one output file,
+  // so neither are partitioned outputs.
+  unsigned Partitions = numPartitions(F);
+  if (outputFilename(F) == "-" || Partitions > 1)
+    Cache = nullptr;
+  std::string ManifestKey;
+  if (Cache) {
+    ManifestKey = Cache->getManifestKey(
+        F, Source->getBuffer());
+    CompileCache::Result R;
+    TimeTraceScope Scope("CacheLookup");
+    if (Error Err = Cache->find(Task, ManifestKey, R))
+      WithColor::warning(ErrOS, Argv0)
+          << "compile cache: "
+          << toString(std::move(Err)) << "\n";
+    if (R.Output) {
+      ++Cache->Hits;
+      std::unique_ptr<ToolOutputFile> Out =
+          openOutput(Argv0, F, ErrOS);
+      if (!Out)
+        return false;
+      Out->os() << R.Output->getBuffer();
+      Out->keep();
+      return writeInterface(Argv0, F, R.ModuleName,
+                            R.Interface->getBuffer(),
+                            ErrOS);
+    }
+    ++Cache->Misses;
+  }
+
+  // The target machine is not shared between threads, so
+  // every compilation creates its own.
+  std::unique_ptr<llvm::TargetMachine> TM(
+      createTargetMachine(Argv0));
+  if (!TM)
+    return false;
+
+  llvm::LLVMContext Ctx;
+  ModuleInfo Info;
+  std::unique_ptr<llvm::Module> M =
+      generate(Argv0, F, std::move(Source), Ctx, TM.get(),
+               Timers, Info, ErrOS);
+  if (!M)
+    return false;
+
+  std::unique_ptr<ToolOutputFile> Out =
+      openOutput(Argv0, F, ErrOS);
+  if (!Out)
+    return false;
+  // With the cache, the output is collected in memory
+  // and then written to both the file and the cache.
+  SmallVector<char, 0> Output;
+  raw_svector_ostream OutputOS(Output);
+  raw_pwrite_stream &OS =
+      Cache ? static_cast<raw_pwrite_stream &>(OutputOS)
+            : Out->os();
+  SmallVector<raw_pwrite_stream *, 8> OSs = {&OS};
+  std::vector<std::unique_ptr<ToolOutputFile>> PartitionOuts;
+  for (unsigned I = 1; I < Partitions; ++I) {
+    PartitionOuts.push_back(openOutput(Argv0, F, ErrOS, I));
+    if (!PartitionOuts.back())
+      return false;
+    OSs.push_back(&PartitionOuts.back()->os());
+  }
+  if (!emit(Argv0, M.get(), TM.get(), OSs, Plugins, Timers,
+            ErrOS)) {
+    llvm::WithColor::error(ErrOS, Argv0)
+        << "Error writing output\n";
+    return false;
+  }
+  if (Cache) {
+    Out->os() << OutputOS.str();
+    if (Error Err = Cache->add(Task, ManifestKey, Info.Name,
+                               Info.Imports,
+                               OutputOS.str(),
+                               Info.Interface))
+      WithColor::warning(ErrOS, Argv0)
+          << "compile cache: "
+          << toString(std::move(Err)) << "\n";
+  }
   Out->keep();
+  for (std::unique_ptr<ToolOutputFile> &PartitionOut :
+       PartitionOuts)
+    PartitionOut->keep();
+  return true;
+}
+
+bool compile(const char *Argv0, unsigned Task, StringRef F,
+             ArrayRef<PassPlugin> Plugins,
+             CompileCache *Cache, raw_ostream &ErrOS) {
+  // The profiler is thread local, so each worker traces
+  // the compilation of its own input.
+  if (TimeTrace)
+    timeTraceProfilerInitialize(TimeTraceGranularity,
+                                Argv0);
+  std::unique_ptr<PhaseTimers> Timers;
+  if (TimeReport)
+    Timers = std::make_unique<PhaseTimers>();
+
+  bool Success;
+  {
+    TimeTraceScope Scope("Compile", F);
+    Success = compileFile(Argv0, Task, F, Plugins, Cache,
+                          Timers.get(), ErrOS);
+  }
+
+  if (Timers)
+    Timers->Group.print(ErrOS, /*ResetAfterPrint=*/true);
+  if (TimeTrace) {
+    SmallString<128> Path(outputFilename(F));
+    sys::path::replace_extension(Path, "json");
+    if (Error Err = timeTraceProfilerWrite(Path, F)) {
+      WithColor::error(ErrOS, Argv0)
+          << toString(std::move(Err)) << "\n";
+      Success = false;
+    }
+    timeTraceProfilerCleanup();
+  }
+  return Success;
+}
+
+// Returns the address of a procedure in the JIT.
+template <typename FnTy>
+Expected<FnTy *> lookupProcedure(orc::LLJIT &J,
+                                 StringRef Name) {
+  Expected<orc::ExecutorAddr> Addr = J.lookup(Name);
+  if (!Addr)
+    return Addr.takeError();
+  return Addr->toPtr<FnTy *>();
+}
+
+// Adds the input files to a JIT, each after the inputs
+// defining the modules it imports, and runs the module
+// bodies in the same order, so a module is initialized
+// after the modules it imports. Then the entry procedure
+// of the last input file is run and its result is
+// printed.
+//
+// A procedure is compiled and optimized on its first
+// call, so a program starts without compiling the
+// procedures it does not run.
+bool runJIT(const char *Argv0,
+            ArrayRef<PassPlugin> Plugins) {
+  auto reportError = [Argv0](Error Err) {
+    if (!Err)
+      return true;
+    WithColor::error(errs(), Argv0)
+        << toString(std::move(Err)) << "\n";
+    return false;
+  };
+
+  Expected<orc::JITTargetMachineBuilder> JTMB =
+      orc::JITTargetMachineBuilder::detectHost();
+  if (!JTMB)
+    return reportError(JTMB.takeError());
+  Expected<std::unique_ptr<TargetMachine>> TM =
+      JTMB->createTargetMachine();
+  if (!TM)
+    return reportError(TM.takeError());
+  Expected<std::unique_ptr<orc::LLLazyJIT>> J =
+      orc::LLLazyJITBuilder()
+          .setJITTargetMachineBuilder(*JTMB)
+          .create();
+  if (!J)
+    return reportError(J.takeError());
+  (*J)->setPartitionFunction(
+      orc::CompileOnDemandLayer::compileRequested);
+  (*J)->getIRTransformLayer().setTransform(
+      [&](orc::ThreadSafeModule TSM,
+          orc::MaterializationResponsibility &R)
+          -> Expected<orc::ThreadSafeModule> {
+        bool Success =
+            TSM.withModuleDo([&](llvm::Module &M) {
+              return optimize(Argv0, &M, TM->get(),
+                              Plugins, nullptr, errs());
+            });
+        if (!Success)
+          return createStringError(
+              inconvertibleErrorCode(),
+              "Could not optimize " +
+                  R.getTargetJITDylib().getName());
+        return std::move(TSM);
+      });
+
+  // All modules share one context.
+  orc::ThreadSafeContext TSCtx(
+      std::make_unique<LLVMContext>());
+  std::vector<std::string> Bodies;
+  std::string Entry;
+  Type *EntryRetTy = nullptr;
+  ImportGraph Imports = buildImportGraph(InputFiles);
+  for (size_t I : Imports.Order) {
+    const std::string &F = InputFiles[I];
+    std::unique_ptr<llvm::MemoryBuffer> Source =
+        readSource(Argv0, F, errs());
+    if (!Source)
+      return false;
+    ModuleInfo Info;
+    std::unique_ptr<llvm::Module> M;
+    {
+      orc::ThreadSafeContext::Lock Lock = TSCtx.getLock();
+      M = generate(Argv0, F, std::move(Source),
+                   *TSCtx.getContext(), TM->get(), nullptr,
+                   Info, errs());
+    }
+    if (!M)
+      return false;
+    Bodies.push_back(CodeGenerator::mangleName({Info.Name}));
+    if (I + 1 == InputFiles.size() &&
+        !EntryProcedure.empty()) {
+      Entry = CodeGenerator::mangleName(
+          {Info.Name, EntryProcedure});
+      llvm::Function *Fn = M->getFunction(Entry);
+      if (!Fn) {
+        WithColor::error(errs(), Argv0)
+            << "No procedure " << EntryProcedure << " in "
+            << Info.Name << "\n";
+        return false;
+      }
+      EntryRetTy = Fn->getReturnType();
+      if (!Fn->arg_empty()) {
+        WithColor::error(errs(), Argv0)
+            << "Procedure " << EntryProcedure
+            << " must not have parameters\n";
+        return false;
+      }
+    }
+    if (!reportError((*J)->addLazyIRModule(
+            orc::ThreadSafeModule(std::move(M), TSCtx))))
+      return false;
+  }
+
+  for (const std::string &Body : Bodies) {
+    Expected<void (*)()> Fn =
+        lookupProcedure<void()>(**J, Body);
+    if (!Fn)
+      return reportError(Fn.takeError());
+    (*Fn)();
+  }
+  if (Entry.empty())
+    return true;
+  if (EntryRetTy->isIntegerTy(64)) {
+    Expected<int64_t (*)()> Fn =
+        lookupProcedure<int64_t()>(**J, Entry);
+    if (!Fn)
+      return reportError(Fn.takeError());
+    outs() << (*Fn)() << "\n";
+  } else if (EntryRetTy->isIntegerTy(1)) {
+    Expected<bool (*)()> Fn =
+        lookupProcedure<bool()>(**J, Entry);
+    if (!Fn)
+      return reportError(Fn.takeError());
+    outs() << ((*Fn)() ? "TRUE" : "FALSE") << "\n";
+  } else {
+    Expected<void (*)()> Fn =
+        lookupProcedure<void()>(**J, Entry);
+    if (!Fn)
+      return reportError(Fn.takeError());
+    (*Fn)();
+  }
   return true;
 }
 
@@ -302,44 +1231,146 @@ int main(int Argc, const char **Argv) {
     exit(EXIT_SUCCESS);
   }
 
-  llvm::TargetMachine *TM = createTargetMachine(Argv[0]);
+  // Check the target options once, before any worker
+  // creates its own target machine.
+  std::unique_ptr<llvm::TargetMachine> TM(
+      createTargetMachine(Argv[0]));
   if (!TM)
     exit(EXIT_FAILURE);
 
-  for (const auto &F : InputFiles) {
-    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
-        FileOrErr = llvm::MemoryBuffer::getFile(F);
-    if (std::error_code BufferError =
-            FileOrErr.getError()) {
-      llvm::WithColor::error(errs(), Argv[0])
-          << "Error reading " << F << ": "
-          << BufferError.message() << "\n";
+  std::unique_ptr<CompileCache> Cache;
+  std::optional<CachePruningPolicy> Policy;
+  if (!CacheDir.empty()) {
+    Expected<CachePruningPolicy> PolicyOrErr =
+        parseCachePruningPolicy(CachePolicy);
+    if (!PolicyOrErr) {
+      WithColor::error(errs(), Argv[0])
+          << toString(PolicyOrErr.takeError()) << "\n";
+      exit(EXIT_FAILURE);
+    }
+    Policy = *PolicyOrErr;
+    Cache = std::make_unique<CompileCache>(
+        hashOptions(ArrayRef<const char *>(Argv, Argc), TM.get()),
+        InputFiles.size());
+    if (Error Err = Cache->open(CacheDir)) {
+      WithColor::error(errs(), Argv[0])
+          << toString(std::move(Err)) << "\n";
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Load the pass plugins once and share them between
+  // all compilations.
+  SmallVector<PassPlugin, 1> Plugins;
+  for (auto &PluginFN : PassPlugins) {
+    auto PassPlugin = PassPlugin::Load(PluginFN);
+    if (!PassPlugin) {
+      WithColor::error(errs(), Argv[0])
+          << "Failed to load passes from '" << PluginFN
+          << "'. Request ignored.\n";
+      consumeError(PassPlugin.takeError());
+      continue;
     }
+    Plugins.push_back(*PassPlugin);
+  }
+
+  if (JIT)
+    return runJIT(Argv[0], Plugins) ? EXIT_SUCCESS
+                                    : EXIT_FAILURE;
 
-    llvm::SourceMgr SrcMgr;
-    DiagnosticsEngine Diags(SrcMgr);
-
-    // Tell SrcMgr about this buffer, which is what the
-    // parser will pick up.
-    SrcMgr.AddNewSourceBuffer(std::move(*FileOrErr),
-                              llvm::SMLoc());
-
-    auto TheLexer = Lexer(SrcMgr, Diags);
-    auto ASTCtx = ASTContext(SrcMgr, F);
-    auto TheSema = Sema(Diags);
-    auto TheParser = Parser(TheLexer, TheSema);
-    auto *Mod = TheParser.parse();
-    if (Mod && !Diags.numErrors()) {
-      llvm::LLVMContext Ctx;
-      if (CodeGenerator *CG =
-              CodeGenerator::create(Ctx, ASTCtx, TM)) {
-        std::unique_ptr<llvm::Module> M = CG->run(Mod, F);
-        if (!emit(Argv[0], M.get(), TM, F)) {
-          llvm::WithColor::error(errs(), Argv[0])
-              << "Error writing output\n";
+  size_t NumInputs = InputFiles.size();
+  ImportGraph Imports = buildImportGraph(InputFiles);
+  // An input importing an input which was not compiled is
+  // not compiled either, because it would read a missing
+  // or an outdated interface. BlockedBy[I] is the first
+  // such import of input I.
+  const size_t NoInput = ~size_t(0);
+  std::vector<size_t> BlockedBy(NumInputs, NoInput);
+  std::vector<char> Results(NumInputs, false);
+  auto block = [&](size_t I) {
+    for (size_t U : Imports.Users[I])
+      if (BlockedBy[U] == NoInput)
+        BlockedBy[U] = I;
+  };
+  auto reportBlocked = [&](size_t I, raw_ostream &OS) {
+    WithColor::error(OS, Argv[0])
+        << "Not compiling " << InputFiles[I] << ": "
+        << InputFiles[BlockedBy[I]]
+        << " was not compiled\n";
+  };
+
+  bool Success = true;
+  if (Jobs == 1 || NumInputs <= 1 || Imports.HasCycle) {
+    for (size_t I : Imports.Order) {
+      if (BlockedBy[I] != NoInput)
+        reportBlocked(I, errs());
+      else
+        Results[I] = compile(Argv[0], I, InputFiles[I],
+                             Plugins, Cache.get(), errs());
+      if (!Results[I])
+        block(I);
+      Success &= Results[I];
+    }
+  } else {
+    // Each worker writes its diagnostics into a private
+    // buffer. The buffers are printed in the order of the
+    // input files after all workers are done, so the
+    // output does not depend on the scheduling.
+    std::vector<std::string> Logs(NumInputs);
+    ThreadPool Pool(hardware_concurrency(Jobs));
+    // A finished input starts the compilation of the
+    // importers whose last pending import it was.
+    // Pending[I] counts the imports of input I which are
+    // not finished yet.
+    std::vector<unsigned> Pending(Imports.NumImports);
+    std::mutex PendingLock;
+    std::function<void(size_t)> Start;
+    std::function<void(size_t)> Finish = [&](size_t I) {
+      if (!Results[I])
+        block(I);
+      for (size_t U : Imports.Users[I]) {
+        if (--Pending[U])
+          continue;
+        if (BlockedBy[U] == NoInput) {
+          Start(U);
+          continue;
         }
-        delete CG;
+        raw_string_ostream OS(Logs[U]);
+        reportBlocked(U, OS);
+        Finish(U);
       }
+    };
+    Start = [&](size_t I) {
+      Pool.async([&, I] {
+        raw_string_ostream OS(Logs[I]);
+        bool Result = compile(Argv[0], I, InputFiles[I],
+                              Plugins, Cache.get(), OS);
+        std::lock_guard<std::mutex> Guard(PendingLock);
+        Results[I] = Result;
+        Finish(I);
+      });
+    };
+    // The roots are collected first, because the workers
+    // update Pending while they are started.
+    SmallVector<size_t, 16> Roots;
+    for (size_t I = 0; I != NumInputs; ++I)
+      if (!Pending[I])
+        Roots.push_back(I);
+    for (size_t I : Roots)
+      Start(I);
+    Pool.wait();
+    for (size_t I = 0; I != NumInputs; ++I) {
+      errs() << Logs[I];
+      Success &= Results[I];
     }
   }
+
+  if (Cache) {
+    if (CacheStats)
+      errs() << "compile cache: " << Cache->Hits
+             << " hits, " << Cache->Misses
+             << " misses\n";
+    pruneCache(CacheDir, *Policy);
+  }
+  return Success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
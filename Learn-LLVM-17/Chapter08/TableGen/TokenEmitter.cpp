@@ -1,5 +1,9 @@
 #include "TableGenBackends.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/TableGen/Error.h"
 #include "llvm/TableGen/Record.h"
 #include "llvm/TableGen/TableGenBackend.h"
 #include <algorithm>
@@ -7,6 +11,64 @@
 using namespace llvm;
 
 namespace {
+enum class KeywordLookupKind { SortedTable, PerfectHash };
+
+cl::opt<KeywordLookupKind> KeywordLookup(
+    "keyword-lookup",
+    cl::desc("Lookup strategy of the keyword filter:"),
+    cl::values(
+        clEnumValN(KeywordLookupKind::SortedTable,
+                   "sorted",
+                   "Binary search in a sorted table"),
+        clEnumValN(KeywordLookupKind::PerfectHash,
+                   "perfect-hash",
+                   "Perfect hash with a single string "
+                   "compare (default)")),
+    cl::init(KeywordLookupKind::PerfectHash));
+
+using KeyFlag = std::pair<StringRef, uint64_t>;
+
+/// Perfect hash over the length and the first and last
+/// character of a keyword:
+///   (Len + MulFirst * First + MulLast * Last) & (Size-1)
+struct CharHash {
+  unsigned Size = 0;
+  unsigned MulFirst = 0;
+  unsigned MulLast = 0;
+  std::vector<int> Slots;
+
+  unsigned hash(StringRef Key) const {
+    return (Key.size() +
+            MulFirst * (unsigned char)Key.front() +
+            MulLast * (unsigned char)Key.back()) &
+           (Size - 1);
+  }
+};
+
+/// Hash-and-displace (CHD) perfect hash over the whole
+/// keyword. The FNV-1a hash of the keyword selects a
+/// bucket, and the seed stored for the bucket scrambles
+/// the same hash into the slot. The keyword is only
+/// read once.
+struct DisplacedHash {
+  unsigned Size = 0;
+  unsigned Shift = 0;
+  std::vector<unsigned> Seeds;
+  std::vector<int> Slots;
+
+  // The next two functions must match the code emitted
+  // by emitPerfectHashLookup().
+  static uint32_t hash(StringRef Key) {
+    uint32_t H = 2166136261u;
+    for (char C : Key)
+      H = (H ^ (unsigned char)C) * 16777619u;
+    return H;
+  }
+  unsigned slot(uint32_t H, unsigned Seed) const {
+    return ((H ^ Seed) * 0x9E3779B9u) >> Shift;
+  }
+};
+
 class TokenAndKeywordFilterEmitter {
   RecordKeeper &Records;
 
@@ -20,7 +82,100 @@ private:
   void emitFlagsFragment(raw_ostream &OS);
   void emitTokenKind(raw_ostream &OS);
   void emitKeywordFilter(raw_ostream &OS);
+  void emitSortedTableLookup(raw_ostream &OS,
+                             ArrayRef<KeyFlag> Table);
+  bool emitPerfectHashLookup(raw_ostream &OS,
+                             ArrayRef<KeyFlag> Table);
+  void emitEntries(raw_ostream &OS,
+                   ArrayRef<KeyFlag> Table,
+                   ArrayRef<int> Slots);
 };
+
+/// Searches multipliers which map all keywords to
+/// different slots. Fails if two keywords agree in
+/// length, first and last character.
+bool findCharHash(ArrayRef<KeyFlag> Table,
+                  CharHash &CH) {
+  unsigned MinSize = PowerOf2Ceil(Table.size());
+  for (CH.Size = MinSize; CH.Size <= 8 * MinSize;
+       CH.Size *= 2) {
+    for (CH.MulFirst = 1; CH.MulFirst < 64;
+         ++CH.MulFirst) {
+      for (CH.MulLast = 1; CH.MulLast < 64;
+           ++CH.MulLast) {
+        CH.Slots.assign(CH.Size, -1);
+        bool Collision = false;
+        for (size_t I = 0, E = Table.size(); I < E;
+             ++I) {
+          int &Slot = CH.Slots[CH.hash(Table[I].first)];
+          if (Slot != -1) {
+            Collision = true;
+            break;
+          }
+          Slot = I;
+        }
+        if (!Collision)
+          return true;
+      }
+    }
+  }
+  return false;
+}
+
+/// Places the keywords bucket by bucket, largest
+/// bucket first, trying seeds until all keywords of a
+/// bucket land in free slots.
+bool findDisplacedHash(ArrayRef<KeyFlag> Table,
+                       DisplacedHash &DH) {
+  // At least two slots, so that the shift is less than
+  // the width of the hash.
+  DH.Size = std::max<unsigned>(
+      PowerOf2Ceil(Table.size()), 2);
+  DH.Shift = 32 - Log2_32(DH.Size);
+  unsigned NumBuckets = (Table.size() + 3) / 4;
+  std::vector<uint32_t> Hashes;
+  std::vector<std::vector<unsigned>> Buckets(NumBuckets);
+  for (size_t I = 0, E = Table.size(); I < E; ++I) {
+    Hashes.push_back(DisplacedHash::hash(Table[I].first));
+    Buckets[Hashes[I] % NumBuckets].push_back(I);
+  }
+  std::vector<unsigned> Order(NumBuckets);
+  for (unsigned I = 0; I < NumBuckets; ++I)
+    Order[I] = I;
+  llvm::stable_sort(Order, [&](unsigned A, unsigned B) {
+    return Buckets[A].size() > Buckets[B].size();
+  });
+
+  DH.Seeds.assign(NumBuckets, 0);
+  DH.Slots.assign(DH.Size, -1);
+  for (unsigned B : Order) {
+    if (Buckets[B].empty())
+      break;
+    bool Placed = false;
+    for (unsigned Seed = 1; Seed < (1U << 16) && !Placed;
+         ++Seed) {
+      SmallVector<unsigned, 8> Used;
+      Placed = true;
+      for (unsigned I : Buckets[B]) {
+        unsigned Slot = DH.slot(Hashes[I], Seed);
+        if (DH.Slots[Slot] != -1 ||
+            llvm::is_contained(Used, Slot)) {
+          Placed = false;
+          break;
+        }
+        Used.push_back(Slot);
+      }
+      if (Placed) {
+        DH.Seeds[B] = Seed;
+        for (size_t J = 0; J < Used.size(); ++J)
+          DH.Slots[Used[J]] = Buckets[B][J];
+      }
+    }
+    if (!Placed)
+      return false;
+  }
+  return true;
+}
 } // End anonymous namespace
 
 void TokenAndKeywordFilterEmitter::run(raw_ostream &OS) {
@@ -139,7 +294,6 @@ void TokenAndKeywordFilterEmitter::emitKeywordFilter(
     return;
 
   // Collect the keyword/flag values.
-  using KeyFlag = std::pair<StringRef, uint64_t>;
   std::vector<KeyFlag> Table;
   for (size_t I = 0, E = TokenFilter->size(); I < E;
        ++I) {
@@ -169,30 +323,10 @@ void TokenAndKeywordFilterEmitter::emitKeywordFilter(
   OS << "  struct Entry {\n"
      << "    unsigned Value;\n"
      << "    llvm::StringRef Keyword;\n"
-     << "  };\n"
-     << "static const Entry Table[" << Table.size()
-     << "] = {\n";
-  for (const auto &[Keyword, Value] : Table) {
-   OS << "    { " << Value << ", llvm::StringRef(\""
-      << Keyword << "\", " << Keyword.size()
-      << ") },\n";
-  }
-  OS << "  };\n\n";
-  OS << "  const Entry *E = "
-        "std::lower_bound(&Table[0], "
-        "&Table["
-     << Table.size()
-     << "], Keyword, [](const Entry &A, const "
-        "StringRef "
-        "&B) {\n";
-  OS << "    return A.Keyword < B;\n";
-  OS << "  });\n";
-  OS << "  if (E != &Table[" << Table.size()
-     << "]) {\n";
-  OS << "    Value = E->Value;\n";
-  OS << "    return true;\n";
-  OS << "  }\n";
-  OS << "  return false;\n";
+     << "  };\n";
+  if (KeywordLookup == KeywordLookupKind::SortedTable ||
+      !emitPerfectHashLookup(OS, Table))
+    emitSortedTableLookup(OS, Table);
   OS << "}\n";
 
   // Add some test code. This is optional.
@@ -221,6 +355,110 @@ void TokenAndKeywordFilterEmitter::emitKeywordFilter(
   OS << "#endif\n";
 }
 
+void TokenAndKeywordFilterEmitter::emitSortedTableLookup(
+    raw_ostream &OS, ArrayRef<KeyFlag> Table) {
+  OS << "static const Entry Table[" << Table.size()
+     << "] = {\n";
+  for (const auto &[Keyword, Value] : Table) {
+   OS << "    { " << Value << ", llvm::StringRef(\""
+      << Keyword << "\", " << Keyword.size()
+      << ") },\n";
+  }
+  OS << "  };\n\n";
+  OS << "  const Entry *E = "
+        "std::lower_bound(&Table[0], "
+        "&Table["
+     << Table.size()
+     << "], Keyword, [](const Entry &A, const "
+        "StringRef "
+        "&B) {\n";
+  OS << "    return A.Keyword < B;\n";
+  OS << "  });\n";
+  OS << "  if (E != &Table[" << Table.size()
+     << "] && E->Keyword == Keyword) {\n";
+  OS << "    Value = E->Value;\n";
+  OS << "    return true;\n";
+  OS << "  }\n";
+  OS << "  return false;\n";
+}
+
+void TokenAndKeywordFilterEmitter::emitEntries(
+    raw_ostream &OS, ArrayRef<KeyFlag> Table,
+    ArrayRef<int> Slots) {
+  OS << "  static const Entry Table[" << Slots.size()
+     << "] = {\n";
+  for (int Slot : Slots) {
+    if (Slot == -1) {
+      OS << "    { 0, llvm::StringRef() },\n";
+      continue;
+    }
+    const auto &[Keyword, Value] = Table[Slot];
+    OS << "    { " << Value << ", llvm::StringRef(\""
+       << Keyword << "\", " << Keyword.size()
+       << ") },\n";
+  }
+  OS << "  };\n\n";
+}
+
+bool TokenAndKeywordFilterEmitter::emitPerfectHashLookup(
+    raw_ostream &OS, ArrayRef<KeyFlag> Table) {
+  if (Table.empty())
+    return false;
+  size_t MinLen = Table[0].first.size();
+  size_t MaxLen = MinLen;
+  for (const auto &KF : Table) {
+    MinLen = std::min(MinLen, KF.first.size());
+    MaxLen = std::max(MaxLen, KF.first.size());
+  }
+  // Every keyword has at least one character, so the
+  // length check also protects front() and back().
+  MinLen = std::max<size_t>(MinLen, 1);
+
+  CharHash CH;
+  if (findCharHash(Table, CH)) {
+    emitEntries(OS, Table, CH.Slots);
+    OS << "  if (Keyword.size() < " << MinLen
+       << " || Keyword.size() > " << MaxLen << ")\n"
+       << "    return false;\n"
+       << "  unsigned H = (Keyword.size() + " << CH.MulFirst
+       << "u * (unsigned char)Keyword.front() + "
+       << CH.MulLast
+       << "u * (unsigned char)Keyword.back()) & "
+       << (CH.Size - 1) << "u;\n";
+  } else {
+    DisplacedHash DH;
+    if (!findDisplacedHash(Table, DH)) {
+      PrintWarning("no perfect hash found for the "
+                   "keyword filter, using a sorted "
+                   "table");
+      return false;
+    }
+    emitEntries(OS, Table, DH.Slots);
+    OS << "  static const unsigned short Seeds["
+       << DH.Seeds.size() << "] = {";
+    ListSeparator LS;
+    for (unsigned Seed : DH.Seeds)
+      OS << LS << Seed;
+    OS << "};\n"
+       << "  if (Keyword.size() < " << MinLen
+       << " || Keyword.size() > " << MaxLen << ")\n"
+       << "    return false;\n"
+       << "  unsigned Hash = 2166136261u;\n"
+       << "  for (char C : Keyword)\n"
+       << "    Hash = (Hash ^ (unsigned char)C) * "
+          "16777619u;\n"
+       << "  unsigned H = ((Hash ^ Seeds[Hash % "
+       << DH.Seeds.size() << "]) * 0x9E3779B9u) >> "
+       << DH.Shift << ";\n";
+  }
+  OS << "  const Entry &E = Table[H];\n"
+     << "  if (E.Keyword != Keyword)\n"
+     << "    return false;\n"
+     << "  Value = E.Value;\n"
+     << "  return true;\n";
+  return true;
+}
+
 void EmitTokensAndKeywordFilter(RecordKeeper &RK,
                                 raw_ostream &OS) {
   emitSourceFileHeader("Token Kind and Keyword Filter "
@@ -0,0 +1,121 @@
+// Times the keyword filter generated by tinylang-tblgen
+// against a StringMap of the same keywords. KEYWORD_INC
+// names the generated file.
+//
+// The names looked up are the keywords, the keywords with
+// one character changed or appended, and random
+// identifiers, shuffled, so about a third of the lookups
+// hit.
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+using llvm::StringRef;
+
+#define GET_TOKEN_KIND_DECLARATION
+#define GET_TOKEN_KIND_DEFINITION
+#define GET_KEYWORD_FILTER
+#define SELFCHECK
+#include KEYWORD_INC
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr unsigned NumLookups = 2000000;
+constexpr unsigned Repeat = 5;
+
+std::vector<std::string> makeNames() {
+  std::vector<std::string> Keywords;
+  for (unsigned K = 0; K < tok::NUM_TOKENS; ++K) {
+    unsigned Value;
+    if (lookupKeyword(TokNames[K], Value))
+      Keywords.push_back(TokNames[K]);
+  }
+  std::mt19937 Rng(1);
+  const char *Alpha = "abcdefghijklmnopqrstuvwxyz"
+                      "ABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+  std::vector<std::string> Names;
+  while (Names.size() < NumLookups) {
+    for (const std::string &K : Keywords) {
+      Names.push_back(K);
+      std::string Changed = K;
+      Changed[Rng() % K.size()] = Alpha[Rng() % 53];
+      Names.push_back(Changed);
+      std::string Random;
+      for (unsigned I = 0, E = 2 + Rng() % 10; I < E; ++I)
+        Random += Alpha[Rng() % 53];
+      Names.push_back(Random);
+    }
+  }
+  Names.resize(NumLookups);
+  std::shuffle(Names.begin(), Names.end(), Rng);
+  return Names;
+}
+
+// Returns the best time per lookup in ns, and the number
+// of hits.
+template <typename Fn>
+double time(const std::vector<StringRef> &Names,
+            unsigned &Hits, Fn Lookup) {
+  double Best = 0;
+  for (unsigned R = 0; R < Repeat; ++R) {
+    Hits = 0;
+    Clock::time_point Start = Clock::now();
+    for (StringRef Name : Names) {
+      unsigned Value;
+      Hits += Lookup(Name, Value);
+    }
+    double Time =
+        std::chrono::duration<double>(Clock::now() - Start)
+            .count();
+    if (R == 0 || Time < Best)
+      Best = Time;
+  }
+  return Best * 1e9 / Names.size();
+}
+} // namespace
+
+int main() {
+  selfcheck();
+  std::vector<std::string> Storage = makeNames();
+  std::vector<StringRef> Names(Storage.begin(),
+                               Storage.end());
+
+  llvm::StringMap<unsigned> Map;
+  for (unsigned K = 0; K < tok::NUM_TOKENS; ++K) {
+    unsigned Value;
+    if (lookupKeyword(TokNames[K], Value))
+      Map[TokNames[K]] = Value;
+  }
+
+  unsigned FilterHits, MapHits;
+  double Filter = time(Names, FilterHits, lookupKeyword);
+  double MapTime = time(
+      Names, MapHits, [&Map](StringRef Name, unsigned &Value) {
+        auto It = Map.find(Name);
+        if (It == Map.end())
+          return false;
+        Value = It->second;
+        return true;
+      });
+  if (FilterHits != MapHits) {
+    llvm::errs() << "filter and StringMap disagree\n";
+    return 1;
+  }
+  llvm::outs() << Map.size() << " keywords, " << Names.size()
+               << " lookups, " << FilterHits << " hits\n"
+               << llvm::format("  filter:    %5.1f ns\n", Filter)
+               << llvm::format("  StringMap: %5.1f ns\n",
+                               MapTime);
+  return 0;
+}
@@ -0,0 +1,189 @@
+#ifndef DISKOBJECTCACHE_H
+#define DISKOBJECTCACHE_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <mutex>
+
+// An object cache in a directory, keyed by a hash of the
+// unoptimized module, the target and the optimization
+// pipeline. The key is computed before optimization, so a
+// hit skips both the optimization and the code generation
+// of the module.
+//
+// An entry is written under a temporary name and renamed,
+// so a concurrent process never sees a partial object. A
+// hit maps the file and hands the mapping to the JIT
+// without a copy. The files are pruned in least recently
+// used order to the size of the pruning policy.
+class DiskObjectCache : public llvm::ObjectCache {
+  // The files use the naming scheme of pruneCache.
+  static constexpr const char *Prefix = "llvmcache-";
+
+  std::string Dir;
+  std::string OptionsHash;
+  llvm::CachePruningPolicy Policy;
+
+  // A module between its lookup before optimization and
+  // its compilation, with the cached object on a hit.
+  struct Entry {
+    std::string Key;
+    std::unique_ptr<llvm::MemoryBuffer> Object;
+  };
+  std::mutex EntriesLock;
+  llvm::DenseMap<const llvm::Module *, Entry> Entries;
+
+  DiskObjectCache(std::string Dir,
+                  std::string OptionsHash,
+                  llvm::CachePruningPolicy Policy)
+      : Dir(std::move(Dir)),
+        OptionsHash(std::move(OptionsHash)),
+        Policy(Policy) {}
+
+  // Returns the SHA1 of the parts as a hex string.
+  static std::string
+  hashParts(llvm::ArrayRef<llvm::StringRef> Parts) {
+    llvm::SHA1 Hasher;
+    for (llvm::StringRef Part : Parts) {
+      // The length separates the parts.
+      Hasher.update(llvm::utostr(Part.size()) + ":");
+      Hasher.update(Part);
+    }
+    return llvm::toHex(Hasher.final(),
+                       /*LowerCase=*/true);
+  }
+
+  std::string getPath(llvm::StringRef Key) {
+    llvm::SmallString<128> Path(Dir);
+    llvm::sys::path::append(Path,
+                            llvm::Twine(Prefix) + Key);
+    return std::string(Path);
+  }
+
+  // Maps the object stored under Key. Returns nullptr if
+  // there is none.
+  std::unique_ptr<llvm::MemoryBuffer>
+  load(llvm::StringRef Key) {
+    std::string Path = getPath(Key);
+    llvm::Expected<llvm::sys::fs::file_t> FD =
+        llvm::sys::fs::openNativeFileForRead(Path);
+    if (!FD) {
+      llvm::consumeError(FD.takeError());
+      return nullptr;
+    }
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+        Object = llvm::MemoryBuffer::getOpenFile(
+            *FD, Path, /*FileSize=*/-1,
+            /*RequiresNullTerminator=*/false);
+    // The pruning removes the entries with the oldest
+    // access time first, so a hit renews it.
+    if (Object)
+      llvm::sys::fs::setLastAccessAndModificationTime(
+          *FD, std::chrono::system_clock::now());
+    llvm::sys::fs::closeFile(*FD);
+    if (!Object)
+      return nullptr;
+    return std::move(*Object);
+  }
+
+public:
+  std::atomic<unsigned> Hits = 0;
+  std::atomic<unsigned> Misses = 0;
+
+  // Opens the cache in directory Dir for the target of
+  // JTMB. Pipeline describes the optimization of the
+  // modules, e.g. "default<O2>".
+  static llvm::Expected<std::unique_ptr<DiskObjectCache>>
+  create(llvm::StringRef Dir, llvm::StringRef PolicyStr,
+         const llvm::orc::JITTargetMachineBuilder &JTMB,
+         llvm::StringRef Pipeline) {
+    llvm::Expected<llvm::CachePruningPolicy> Policy =
+        llvm::parseCachePruningPolicy(PolicyStr);
+    if (!Policy)
+      return Policy.takeError();
+    if (std::error_code EC =
+            llvm::sys::fs::create_directories(Dir))
+      return llvm::createFileError(Dir, EC);
+    std::string Features =
+        JTMB.getFeatures().getString();
+    std::string OptionsHash = hashParts(
+        {LLVM_VERSION_STRING,
+         JTMB.getTargetTriple().str(), JTMB.getCPU(),
+         Features, Pipeline});
+    return std::unique_ptr<DiskObjectCache>(
+        new DiskObjectCache(Dir.str(),
+                            std::move(OptionsHash),
+                            *Policy));
+  }
+
+  ~DiskObjectCache() override {
+    llvm::pruneCache(Dir, Policy);
+  }
+
+  // Looks up the object of M before M is optimized.
+  // Returns true on a hit, and the object is then handed
+  // to the compiler of M.
+  bool lookup(const llvm::Module &M) {
+    llvm::SmallVector<char, 0> Bitcode;
+    llvm::raw_svector_ostream OS(Bitcode);
+    llvm::WriteBitcodeToFile(M, OS);
+    Entry E;
+    E.Key = hashParts(
+        {OptionsHash,
+         llvm::StringRef(Bitcode.data(), Bitcode.size())});
+    E.Object = load(E.Key);
+    bool Hit = E.Object != nullptr;
+    ++(Hit ? Hits : Misses);
+    std::lock_guard<std::mutex> Guard(EntriesLock);
+    Entries[&M] = std::move(E);
+    return Hit;
+  }
+
+  std::unique_ptr<llvm::MemoryBuffer>
+  getObject(const llvm::Module *M) override {
+    std::lock_guard<std::mutex> Guard(EntriesLock);
+    auto It = Entries.find(M);
+    if (It == Entries.end() || !It->second.Object)
+      return nullptr;
+    std::unique_ptr<llvm::MemoryBuffer> Object =
+        std::move(It->second.Object);
+    Entries.erase(It);
+    return Object;
+  }
+
+  void
+  notifyObjectCompiled(const llvm::Module *M,
+                       llvm::MemoryBufferRef Obj) override {
+    std::string Key;
+    {
+      std::lock_guard<std::mutex> Guard(EntriesLock);
+      auto It = Entries.find(M);
+      if (It == Entries.end())
+        return;
+      Key = std::move(It->second.Key);
+      Entries.erase(It);
+    }
+    // A failed write only costs a later compilation.
+    llvm::consumeError(llvm::writeToOutput(
+        getPath(Key), [Obj](llvm::raw_ostream &OS) {
+          OS << Obj.getBuffer();
+          return llvm::Error::success();
+        }));
+  }
+};
+
+#endif
@@ -1,8 +1,11 @@
 #include "JIT.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/InitLLVM.h"
 #include "llvm/Support/TargetSelect.h"
+#include <chrono>
 
 using namespace llvm;
 
@@ -10,6 +13,86 @@ static cl::opt<std::string>
     InputFile(cl::Positional, cl::Required,
               cl::desc("<input-file>"));
 
+static cl::opt<std::string> CacheDir(
+    "cache-dir",
+    cl::desc("Reuse the compiled objects of earlier "
+             "runs stored in this directory"),
+    cl::value_desc("directory"));
+
+static cl::opt<std::string> CachePolicy(
+    "cache-policy",
+    cl::desc("Pruning policy of the object cache, e.g. "
+             "cache_size_bytes=1g:prune_interval=20m"),
+    cl::init("cache_size_bytes=1g"));
+
+static cl::opt<bool>
+    CacheStats("cache-stats",
+               cl::desc("Print the number of object "
+                        "cache hits and misses"));
+
+static cl::opt<LazyPartitioning> Lazy(
+    "lazy", cl::desc("Compile functions on their first call"),
+    cl::values(
+        clEnumValN(LazyPartitioning::None, "none",
+                   "Compile whole modules"),
+        clEnumValN(LazyPartitioning::Function, "function",
+                   "Compile each function on its own"),
+        clEnumValN(LazyPartitioning::SCC, "scc",
+                   "Compile the functions of a call graph "
+                   "SCC together")),
+    cl::init(LazyPartitioning::None));
+
+static cl::opt<bool> Tiered(
+    "tiered",
+    cl::desc("Compile functions without optimization "
+             "first, and optimize frequently called "
+             "functions in the background"));
+
+static cl::opt<unsigned> TierUpThreshold(
+    "tier-up-threshold",
+    cl::desc("With -tiered, the number of calls after "
+             "which a function is optimized"),
+    cl::init(1000));
+
+static cl::opt<unsigned> TierUpLevel(
+    "tier-up-level",
+    cl::desc("With -tiered, the optimization level (2 "
+             "or 3) of frequently called functions"),
+    cl::init(2));
+
+static cl::opt<bool> TimeStartup(
+    "time-startup",
+    cl::desc("Print the time from the start of jitty to "
+             "the first instruction of main"));
+
+static std::chrono::steady_clock::time_point StartTime;
+
+// Called by the first instruction of main with
+// -time-startup.
+static void mainEntered() {
+  static bool Entered = false;
+  if (Entered)
+    return;
+  Entered = true;
+  std::chrono::duration<double, std::milli> Startup =
+      std::chrono::steady_clock::now() - StartTime;
+  errs() << "time to first instruction of main: "
+         << format("%.3f", Startup.count()) << " ms\n";
+}
+
+// Inserts a call of HookName at the start of main.
+static void instrumentMain(Module &M,
+                           StringRef HookName) {
+  Function *MainFn = M.getFunction("main");
+  if (!MainFn || MainFn->isDeclaration())
+    return;
+  FunctionCallee Hook = M.getOrInsertFunction(
+      HookName, Type::getVoidTy(M.getContext()));
+  IRBuilder<> Builder(
+      &*MainFn->getEntryBlock().getFirstInsertionPt());
+  Builder.CreateCall(Hook);
+}
+
 std::unique_ptr<Module>
 loadModule(StringRef Filename, LLVMContext &Ctx,
            const char *ProgName) {
@@ -26,10 +109,27 @@ loadModule(StringRef Filename, LLVMContext &Ctx,
 Error jitmain(std::unique_ptr<Module> M,
               std::unique_ptr<LLVMContext> Ctx,
               int argc, char *argv[]) {
-  auto JIT = JIT::create();
+  JITOptions Opts;
+  Opts.CacheDir = CacheDir;
+  Opts.CachePolicy = CachePolicy;
+  Opts.Lazy = Lazy;
+  Opts.Tiered = Tiered;
+  Opts.TierUpThreshold = TierUpThreshold;
+  Opts.TierUpLevel = TierUpLevel == 3
+                         ? OptimizationLevel::O3
+                         : OptimizationLevel::O2;
+  auto JIT = JIT::create(Opts);
   if (!JIT)
     return JIT.takeError();
 
+  if (TimeStartup) {
+    instrumentMain(*M, "jitty_main_entered");
+    if (auto Err = (*JIT)->addHostSymbol(
+            "jitty_main_entered",
+            orc::ExecutorAddr::fromPtr(&mainEntered)))
+      return Err;
+  }
+
   if (auto Err = (*JIT)->addIRModule(
           orc::ThreadSafeModule(std::move(M),
                                 std::move(Ctx))))
@@ -43,10 +143,15 @@ Error jitmain(std::unique_ptr<Module> M,
   auto *Main = MainExecutorAddr.toPtr<int(int, char**)>();
 
   (void)Main(argc, argv);
+  if (DiskObjectCache *Cache = (*JIT)->getObjectCache();
+      Cache && CacheStats)
+    errs() << "object cache: " << Cache->Hits
+           << " hits, " << Cache->Misses << " misses\n";
   return Error::success();
 }
 
 int main(int argc, char *argv[]) {
+  StartTime = std::chrono::steady_clock::now();
   InitLLVM X(argc, argv);
 
   InitializeNativeTarget();
@@ -2,13 +2,20 @@
 #ifndef JIT_H
 #define JIT_H
 
+#include "DiskObjectCache.h"
+#include "TieredCompilation.h"
+#include "llvm/ADT/SCCIterator.h"
 #include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/CallGraph.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
 #include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
 #include "llvm/ExecutionEngine/Orc/Mangling.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
@@ -17,12 +24,46 @@
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/Error.h"
 
+// The partitioning of the modules for lazy compilation.
+enum class LazyPartitioning {
+  // Compile a whole module on the first lookup of one of
+  // its symbols.
+  None,
+  // Compile each function on its first call.
+  Function,
+  // Compile each function on its first call, together
+  // with the other functions of its strongly connected
+  // component in the call graph.
+  SCC,
+};
+
+struct JITOptions {
+  // Reuse the objects of earlier runs stored in this
+  // directory, if not empty.
+  std::string CacheDir;
+  // The pruning policy of the object cache.
+  std::string CachePolicy = "cache_size_bytes=1g";
+  LazyPartitioning Lazy = LazyPartitioning::None;
+  // Compile functions without optimization first, and
+  // optimize them at TierUpLevel after TierUpThreshold
+  // calls. The object cache and Lazy do not apply.
+  bool Tiered = false;
+  unsigned TierUpThreshold = 1000;
+  llvm::OptimizationLevel TierUpLevel =
+      llvm::OptimizationLevel::O2;
+};
+
 class JIT {
+public:
+  // The optimization pipeline of optimizeModule.
+  static constexpr const char *Pipeline = "default<O2>";
+
 private:
   std::unique_ptr<llvm::orc::ExecutorProcessControl> EPC;
   std::unique_ptr<llvm::orc::ExecutionSession> ES;
   llvm::DataLayout DL;
   llvm::orc::MangleAndInterner Mangle;
+  std::unique_ptr<DiskObjectCache> ObjCache;
 
   std::unique_ptr<llvm::orc::RTDyldObjectLinkingLayer>
       ObjectLinkingLayer;
@@ -30,7 +71,14 @@ private:
       CompileLayer;
   std::unique_ptr<llvm::orc::IRTransformLayer>
       OptIRLayer;
+  std::unique_ptr<llvm::orc::LazyCallThroughManager>
+      LCTMgr;
+  std::unique_ptr<llvm::orc::CompileOnDemandLayer>
+      CODLayer;
   llvm::orc::JITDylib &MainJITDylib;
+  std::unique_ptr<llvm::orc::IRCompileLayer>
+      Tier0CompileLayer;
+  std::unique_ptr<TieredCompilation> Tiering;
 
 public:
   JIT(std::unique_ptr<llvm::orc::ExecutorProcessControl>
@@ -38,31 +86,60 @@ public:
       std::unique_ptr<llvm::orc::ExecutionSession>
           ExeS,
       llvm::DataLayout DataL,
-      llvm::orc::JITTargetMachineBuilder JTMB)
+      llvm::orc::JITTargetMachineBuilder JTMB,
+      std::unique_ptr<DiskObjectCache> Cache = nullptr,
+      std::unique_ptr<llvm::orc::LazyCallThroughManager>
+          LazyCTMgr = nullptr,
+      const JITOptions &Opts = JITOptions())
       : EPC(std::move(EPCtrl)), ES(std::move(ExeS)),
         DL(std::move(DataL)), Mangle(*ES, DL),
+        ObjCache(std::move(Cache)),
         ObjectLinkingLayer(std::move(
             createObjectLinkingLayer(*ES, JTMB))),
         CompileLayer(std::move(createCompileLayer(
-            *ES, *ObjectLinkingLayer,
-            std::move(JTMB)))),
-        OptIRLayer(std::move(
-            createOptIRLayer(*ES, *CompileLayer))),
+            *ES, *ObjectLinkingLayer, JTMB,
+            ObjCache.get()))),
+        OptIRLayer(std::move(createOptIRLayer(
+            *ES, *CompileLayer, ObjCache.get()))),
+        LCTMgr(std::move(LazyCTMgr)),
+        CODLayer(LCTMgr ? createCODLayer(*ES, *OptIRLayer,
+                                         *LCTMgr, Opts.Lazy)
+                        : nullptr),
         MainJITDylib(
             ES->createBareJITDylib("<main>")) {
     MainJITDylib.addGenerator(llvm::cantFail(
         llvm::orc::DynamicLibrarySearchGenerator::
             GetForCurrentProcess(
                 DL.getGlobalPrefix())));
+    if (Opts.Tiered) {
+      // The first tier is compiled without optimization,
+      // for a fast startup.
+      JTMB.setCodeGenOptLevel(llvm::CodeGenOpt::None);
+      Tier0CompileLayer = createCompileLayer(
+          *ES, *ObjectLinkingLayer, std::move(JTMB),
+          nullptr);
+      Tiering = std::make_unique<TieredCompilation>(
+          *ES, Mangle, MainJITDylib, *Tier0CompileLayer,
+          *CompileLayer,
+          llvm::orc::createLocalIndirectStubsManagerBuilder(
+              ES->getExecutorProcessControl()
+                  .getTargetTriple())(),
+          Opts.TierUpThreshold,
+          [Level = Opts.TierUpLevel](llvm::Module &M) {
+            runPipeline(M, Level);
+          });
+    }
   }
 
   ~JIT() {
+    // Stop the background compilation first.
+    Tiering.reset();
     if (auto Err = ES->endSession())
       ES->reportError(std::move(Err));
   }
 
   static llvm::Expected<std::unique_ptr<JIT>>
-  create() {
+  create(const JITOptions &Opts = JITOptions()) {
     auto SSP = std::make_shared<
         llvm::orc::SymbolStringPool>();
     auto EPC =
@@ -77,13 +154,39 @@ public:
     if (!DL)
       return DL.takeError();
 
+    std::unique_ptr<DiskObjectCache> Cache;
+    if (!Opts.CacheDir.empty() && !Opts.Tiered) {
+      auto CacheOrErr = DiskObjectCache::create(
+          Opts.CacheDir, Opts.CachePolicy, JTMB,
+          Pipeline);
+      if (!CacheOrErr)
+        return CacheOrErr.takeError();
+      Cache = std::move(*CacheOrErr);
+    }
+
     auto ES =
         std::make_unique<llvm::orc::ExecutionSession>(
             std::move(*EPC));
 
+    // A failed lazy compilation has no address to
+    // continue at, so the error handler is null.
+    std::unique_ptr<llvm::orc::LazyCallThroughManager>
+        LCTMgr;
+    if (Opts.Lazy != LazyPartitioning::None &&
+        !Opts.Tiered) {
+      auto LCTMgrOrErr =
+          llvm::orc::createLocalLazyCallThroughManager(
+              JTMB.getTargetTriple(), *ES,
+              llvm::orc::ExecutorAddr());
+      if (!LCTMgrOrErr)
+        return LCTMgrOrErr.takeError();
+      LCTMgr = std::move(*LCTMgrOrErr);
+    }
+
     return std::make_unique<JIT>(
         std::move(*EPC), std::move(ES), std::move(*DL),
-        std::move(JTMB));
+        std::move(JTMB), std::move(Cache),
+        std::move(LCTMgr), Opts);
   }
 
   static std::unique_ptr<
@@ -113,10 +216,11 @@ public:
   createCompileLayer(
       llvm::orc::ExecutionSession &ES,
       llvm::orc::RTDyldObjectLinkingLayer &OLLayer,
-      llvm::orc::JITTargetMachineBuilder JTMB) {
+      llvm::orc::JITTargetMachineBuilder JTMB,
+      llvm::ObjectCache *ObjCache) {
     auto IRCompiler = std::make_unique<
         llvm::orc::ConcurrentIRCompiler>(
-        std::move(JTMB));
+        std::move(JTMB), ObjCache);
     auto IRCLayer =
         std::make_unique<llvm::orc::IRCompileLayer>(
             ES, OLLayer, std::move(IRCompiler));
@@ -126,13 +230,101 @@ public:
   static std::unique_ptr<llvm::orc::IRTransformLayer>
   createOptIRLayer(
       llvm::orc::ExecutionSession &ES,
-      llvm::orc::IRCompileLayer &CompileLayer) {
+      llvm::orc::IRCompileLayer &CompileLayer,
+      DiskObjectCache *ObjCache) {
     auto OptIRLayer =
         std::make_unique<llvm::orc::IRTransformLayer>(
             ES, CompileLayer, optimizeModule);
+    // A cached object is already optimized, so a hit
+    // skips the optimization. The compiler then takes
+    // the object from the cache.
+    if (ObjCache)
+      OptIRLayer->setTransform(
+          [ObjCache](llvm::orc::ThreadSafeModule TSM,
+                     const llvm::orc::
+                         MaterializationResponsibility &R)
+              -> llvm::Expected<
+                  llvm::orc::ThreadSafeModule> {
+            bool Hit = TSM.withModuleDo(
+                [ObjCache](llvm::Module &M) {
+                  return ObjCache->lookup(M);
+                });
+            if (Hit)
+              return std::move(TSM);
+            return optimizeModule(std::move(TSM), R);
+          });
     return OptIRLayer;
   }
 
+  // Calls to the functions of an added module go through
+  // stubs. The first call of a function extracts its
+  // partition into a new module, which is optimized and
+  // compiled by OptIRLayer, and repoints the stub.
+  static std::unique_ptr<llvm::orc::CompileOnDemandLayer>
+  createCODLayer(llvm::orc::ExecutionSession &ES,
+                 llvm::orc::IRLayer &BaseLayer,
+                 llvm::orc::LazyCallThroughManager &LCTMgr,
+                 LazyPartitioning Lazy) {
+    auto CODLayer = std::make_unique<
+        llvm::orc::CompileOnDemandLayer>(
+        ES, BaseLayer, LCTMgr,
+        llvm::orc::createLocalIndirectStubsManagerBuilder(
+            ES.getExecutorProcessControl()
+                .getTargetTriple()));
+    if (Lazy == LazyPartitioning::SCC)
+      CODLayer->setPartitionFunction(partitionSCC);
+    else
+      CODLayer->setPartitionFunction(
+          llvm::orc::CompileOnDemandLayer::
+              compileRequested);
+    return CODLayer;
+  }
+
+  // Adds the functions of the strongly connected
+  // components of the requested functions to the
+  // partition. Mutually recursive functions are then
+  // compiled and optimized together. The call graph is
+  // only walked from the requested functions.
+  static std::optional<
+      llvm::orc::CompileOnDemandLayer::GlobalValueSet>
+  partitionSCC(
+      llvm::orc::CompileOnDemandLayer::GlobalValueSet
+          Requested) {
+    llvm::orc::CompileOnDemandLayer::GlobalValueSet
+        Partition;
+    std::optional<llvm::CallGraph> CG;
+    for (const llvm::GlobalValue *GV : Requested) {
+      Partition.insert(GV);
+      auto *F = llvm::dyn_cast<llvm::Function>(GV);
+      if (!F || F->isDeclaration())
+        continue;
+      // The call graph only reads the module.
+      if (!CG)
+        CG.emplace(
+            *const_cast<llvm::Module *>(F->getParent()));
+      llvm::CallGraphNode *Node = (*CG)[F];
+      // The components are visited in post order, so the
+      // one of F comes last.
+      for (auto I = llvm::scc_begin(Node); !I.isAtEnd();
+           ++I) {
+        if (!llvm::is_contained(*I, Node))
+          continue;
+        for (llvm::CallGraphNode *N : *I)
+          if (llvm::Function *G = N->getFunction();
+              G && !G->isDeclaration())
+            Partition.insert(G);
+        break;
+      }
+    }
+    return Partition;
+  }
+
+  DiskObjectCache *getObjectCache() {
+    return ObjCache.get();
+  }
+
+  TieredCompilation *getTiering() { return Tiering.get(); }
+
   llvm::orc::JITDylib &getMainJITDylib() {
     return MainJITDylib;
   }
@@ -142,37 +334,56 @@ public:
       llvm::orc::ResourceTrackerSP RT = nullptr) {
     if (!RT)
       RT = MainJITDylib.getDefaultResourceTracker();
+    if (Tiering)
+      return Tiering->add(RT, std::move(TSM));
+    if (CODLayer)
+      return CODLayer->add(RT, std::move(TSM));
     return OptIRLayer->add(RT, std::move(TSM));
   }
 
+  // Makes a function of the host process available to
+  // the JIT'd code under Name.
+  llvm::Error addHostSymbol(llvm::StringRef Name,
+                            llvm::orc::ExecutorAddr Addr) {
+    return MainJITDylib.define(llvm::orc::absoluteSymbols(
+        {{Mangle(Name.str()),
+          {Addr, llvm::JITSymbolFlags::Exported |
+                     llvm::JITSymbolFlags::Callable}}}));
+  }
+
   llvm::Expected<llvm::orc::ExecutorSymbolDef>
   lookup(llvm::StringRef Name) {
     return ES->lookup({&MainJITDylib},
                       Mangle(Name.str()));
   }
 
+  // Runs the default pipeline of Level over M.
+  static void runPipeline(llvm::Module &M,
+                          llvm::OptimizationLevel Level) {
+    llvm::PassBuilder PB;
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    FAM.registerPass(
+        [&] { return PB.buildDefaultAAPipeline(); });
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    llvm::ModulePassManager MPM =
+        PB.buildPerModuleDefaultPipeline(Level);
+    MPM.run(M, MAM);
+  }
+
   static llvm::Expected<llvm::orc::ThreadSafeModule>
   optimizeModule(
       llvm::orc::ThreadSafeModule TSM,
       const llvm::orc::MaterializationResponsibility
           &R) {
     TSM.withModuleDo([](llvm::Module &M) {
-      llvm::PassBuilder PB;
-      llvm::LoopAnalysisManager LAM;
-      llvm::FunctionAnalysisManager FAM;
-      llvm::CGSCCAnalysisManager CGAM;
-      llvm::ModuleAnalysisManager MAM;
-      FAM.registerPass(
-          [&] { return PB.buildDefaultAAPipeline(); });
-      PB.registerModuleAnalyses(MAM);
-      PB.registerCGSCCAnalyses(CGAM);
-      PB.registerFunctionAnalyses(FAM);
-      PB.registerLoopAnalyses(LAM);
-      PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
-      llvm::ModulePassManager MPM =
-          PB.buildPerModuleDefaultPipeline(
-              llvm::OptimizationLevel::O2);
-      MPM.run(M, MAM);
+      runPipeline(M, llvm::OptimizationLevel::O2);
     });
 
     return TSM;
@@ -0,0 +1,360 @@
+#ifndef TIEREDCOMPILATION_H
+#define TIEREDCOMPILATION_H
+
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/Layer.h"
+#include "llvm/ExecutionEngine/Orc/Mangling.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Compiles the functions of a module in two tiers.
+//
+// A module is first compiled without optimization. Every
+// function F gets an indirect stub named F, and all calls
+// and references to F go through the stub. The body of F
+// is renamed to F.tier0 and counts its calls. When the
+// count reaches the threshold, F is queued for the
+// background thread. The thread optimizes F in a copy of
+// the unoptimized module, where the other functions are
+// available_externally, so they can be inlined. Then it
+// compiles the copy and repoints the stub of F to the
+// optimized body, F.opt. The stub update is a single
+// pointer store, so a concurrent call either runs the old
+// or the new body.
+//
+// Only calls switch to the optimized body. A function
+// which is called once, e.g. main with a hot loop, stays
+// in the unoptimized tier.
+class TieredCompilation {
+public:
+  using OptimizeFunction =
+      std::function<void(llvm::Module &)>;
+
+private:
+  // The host function called by the call counters.
+  static constexpr const char *TierUpName =
+      "__jit_tier_up";
+
+  llvm::orc::ExecutionSession &ES;
+  llvm::orc::MangleAndInterner &Mangle;
+  llvm::orc::JITDylib &JD;
+  llvm::orc::IRLayer &Tier0Layer;
+  llvm::orc::IRLayer &OptLayer;
+  std::unique_ptr<llvm::orc::IndirectStubsManager> ISM;
+  uint64_t Threshold;
+  OptimizeFunction Optimize;
+
+  // A function, and the index of its unoptimized module
+  // in Sources.
+  struct TieredFunction {
+    std::string Name;
+    unsigned Source;
+    bool Queued = false;
+  };
+
+  std::mutex Lock;
+  std::condition_variable Cond;
+  std::vector<TieredFunction> Functions;
+  // A deque does not move the modules on growth, so the
+  // background thread can use a module without the lock.
+  std::deque<llvm::orc::ThreadSafeModule> Sources;
+  std::deque<unsigned> Queue;
+  bool Stop = false;
+  std::thread Worker;
+
+  static void tierUp(TieredCompilation *TC, uint32_t Id) {
+    {
+      std::lock_guard<std::mutex> Guard(TC->Lock);
+      TieredFunction &F = TC->Functions[Id];
+      if (F.Queued)
+        return;
+      F.Queued = true;
+      TC->Queue.push_back(Id);
+    }
+    TC->Cond.notify_one();
+  }
+
+  // Gives the local symbols of M external names, unique
+  // across modules, so the optimized tier can refer to
+  // the symbols of the unoptimized one. The symbols are
+  // made visible to lookups.
+  static void promoteSymbols(llvm::Module &M,
+                             unsigned SourceId) {
+    for (llvm::GlobalValue &GV : M.global_values()) {
+      if (GV.isDeclarationForLinker() ||
+          GV.hasAppendingLinkage())
+        continue;
+      if (GV.hasLocalLinkage())
+        GV.setName(GV.getName() + ".m" +
+                   llvm::Twine(SourceId));
+      GV.setLinkage(llvm::GlobalValue::ExternalLinkage);
+      GV.setVisibility(
+          llvm::GlobalValue::DefaultVisibility);
+      if (auto *GO =
+              llvm::dyn_cast<llvm::GlobalObject>(&GV))
+        GO->setComdat(nullptr);
+    }
+  }
+
+  // Prepares a copy of a module for the unoptimized
+  // tier. The functions are renamed and counted, and
+  // their names are added to Names in the order of
+  // their IDs.
+  void instrument(llvm::Module &M, unsigned FirstId,
+                  std::vector<std::string> &Names) {
+    llvm::LLVMContext &Ctx = M.getContext();
+    llvm::Type *Int64Ty = llvm::Type::getInt64Ty(Ctx);
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(Ctx);
+    llvm::PointerType *PtrTy =
+        llvm::PointerType::getUnqual(Ctx);
+    llvm::FunctionCallee TierUp = M.getOrInsertFunction(
+        TierUpName, llvm::Type::getVoidTy(Ctx), PtrTy,
+        Int32Ty);
+    llvm::Constant *This = llvm::ConstantExpr::getIntToPtr(
+        llvm::ConstantInt::get(
+            Int64Ty, reinterpret_cast<uintptr_t>(this)),
+        PtrTy);
+
+    llvm::SmallVector<llvm::Function *, 32> Defined;
+    for (llvm::Function &F : M)
+      if (!F.isDeclarationForLinker())
+        Defined.push_back(&F);
+    unsigned Id = FirstId;
+    for (llvm::Function *F : Defined) {
+      std::string Name = F->getName().str();
+      Names.push_back(Name);
+
+      // The declaration resolves to the stub.
+      llvm::Function *Decl = llvm::Function::Create(
+          F->getFunctionType(),
+          llvm::GlobalValue::ExternalLinkage,
+          F->getAddressSpace(), "", &M);
+      Decl->setCallingConv(F->getCallingConv());
+      Decl->setAttributes(F->getAttributes());
+      F->replaceAllUsesWith(Decl);
+      F->setName(Name + ".tier0");
+      Decl->setName(Name);
+
+      // The counter is not atomic. A lost update only
+      // delays the optimization.
+      auto *Counter = new llvm::GlobalVariable(
+          M, Int64Ty, /*isConstant=*/false,
+          llvm::GlobalValue::InternalLinkage,
+          llvm::ConstantInt::get(Int64Ty, 0),
+          Name + ".calls");
+      llvm::BasicBlock &Entry = F->getEntryBlock();
+      llvm::BasicBlock::iterator IP =
+          Entry.getFirstInsertionPt();
+      while (llvm::isa<llvm::AllocaInst>(IP))
+        ++IP;
+      llvm::IRBuilder<> Builder(&Entry, IP);
+      llvm::Value *Calls = Builder.CreateAdd(
+          Builder.CreateLoad(Int64Ty, Counter),
+          llvm::ConstantInt::get(Int64Ty, 1));
+      Builder.CreateStore(Calls, Counter);
+      llvm::Value *Hot = Builder.CreateICmpEQ(
+          Calls, llvm::ConstantInt::get(Int64Ty, Threshold));
+      llvm::Instruction *Then =
+          llvm::SplitBlockAndInsertIfThen(Hot, &*IP,
+                                          false);
+      Builder.SetInsertPoint(Then);
+      Builder.CreateCall(
+          TierUp,
+          {This, llvm::ConstantInt::get(Int32Ty, Id++)});
+    }
+  }
+
+  // Prepares a copy of a module for the optimization of
+  // function Name, which is renamed to OptName. The other
+  // symbols are defined by the unoptimized tier.
+  static void prepareOptimized(llvm::Module &M,
+                               llvm::StringRef Name,
+                               llvm::StringRef OptName) {
+    for (llvm::Function &F : M) {
+      if (F.isDeclaration())
+        continue;
+      if (F.getName() == Name)
+        F.setName(OptName);
+      else
+        F.setLinkage(
+            llvm::GlobalValue::AvailableExternallyLinkage);
+      F.setDSOLocal(false);
+    }
+    for (llvm::GlobalVariable &GV :
+         llvm::make_early_inc_range(M.globals())) {
+      if (GV.hasAppendingLinkage()) {
+        GV.eraseFromParent();
+        continue;
+      }
+      if (GV.isDeclaration())
+        continue;
+      // Constant initializers still help the optimizer.
+      if (GV.isConstant())
+        GV.setLinkage(
+            llvm::GlobalValue::AvailableExternallyLinkage);
+      else {
+        GV.setInitializer(nullptr);
+        GV.setLinkage(llvm::GlobalValue::ExternalLinkage);
+      }
+      GV.setDSOLocal(false);
+    }
+  }
+
+  // Optimizes and compiles function Name and repoints
+  // its stub.
+  llvm::Error optimize(llvm::StringRef Name,
+                       llvm::orc::ThreadSafeModule &Source) {
+    std::string OptName = (Name + ".opt").str();
+    llvm::orc::ThreadSafeModule TSM =
+        Source.withModuleDo([&](llvm::Module &Src) {
+          std::unique_ptr<llvm::Module> M =
+              llvm::CloneModule(Src);
+          prepareOptimized(*M, Name, OptName);
+          Optimize(*M);
+          return llvm::orc::ThreadSafeModule(
+              std::move(M), Source.getContext());
+        });
+    if (auto Err = OptLayer.add(JD, std::move(TSM)))
+      return Err;
+    auto Sym = ES.lookup({&JD}, Mangle(OptName));
+    if (!Sym)
+      return Sym.takeError();
+    if (auto Err = ISM->updatePointer(*Mangle(Name),
+                                      Sym->getAddress()))
+      return Err;
+    ++NumOptimized;
+    return llvm::Error::success();
+  }
+
+  void run() {
+    while (true) {
+      std::string Name;
+      llvm::orc::ThreadSafeModule *Source;
+      {
+        std::unique_lock<std::mutex> Guard(Lock);
+        Cond.wait(Guard, [this] {
+          return Stop || !Queue.empty();
+        });
+        if (Stop)
+          return;
+        TieredFunction &F = Functions[Queue.front()];
+        Queue.pop_front();
+        Name = F.Name;
+        Source = &Sources[F.Source];
+      }
+      if (auto Err = optimize(Name, *Source))
+        ES.reportError(std::move(Err));
+    }
+  }
+
+public:
+  // The number of functions in the optimized tier.
+  std::atomic<unsigned> NumOptimized = 0;
+
+  // Functions are compiled by Tier0Layer first, and by
+  // OptLayer after Threshold calls. Optimize runs the
+  // optimization pipeline of the second tier.
+  TieredCompilation(
+      llvm::orc::ExecutionSession &ES,
+      llvm::orc::MangleAndInterner &Mangle,
+      llvm::orc::JITDylib &JD,
+      llvm::orc::IRLayer &Tier0Layer,
+      llvm::orc::IRLayer &OptLayer,
+      std::unique_ptr<llvm::orc::IndirectStubsManager> ISM,
+      unsigned Threshold, OptimizeFunction Optimize)
+      : ES(ES), Mangle(Mangle), JD(JD),
+        Tier0Layer(Tier0Layer), OptLayer(OptLayer),
+        ISM(std::move(ISM)), Threshold(Threshold),
+        Optimize(std::move(Optimize)) {
+    llvm::cantFail(JD.define(llvm::orc::absoluteSymbols(
+        {{Mangle(TierUpName),
+          {llvm::orc::ExecutorAddr::fromPtr(&tierUp),
+           llvm::JITSymbolFlags::Exported |
+               llvm::JITSymbolFlags::Callable}}})));
+    Worker = std::thread([this] { run(); });
+  }
+
+  // Functions still queued are not optimized.
+  ~TieredCompilation() {
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      Stop = true;
+    }
+    Cond.notify_one();
+    Worker.join();
+  }
+
+  // Adds a module and compiles its unoptimized tier.
+  llvm::Error add(llvm::orc::ResourceTrackerSP RT,
+                  llvm::orc::ThreadSafeModule TSM) {
+    std::vector<std::string> Names;
+    llvm::orc::ThreadSafeModule Tier0;
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      unsigned SourceId = Sources.size();
+      unsigned FirstId = Functions.size();
+      TSM.withModuleDo([&](llvm::Module &M) {
+        promoteSymbols(M, SourceId);
+        std::unique_ptr<llvm::Module> Clone =
+            llvm::CloneModule(M);
+        instrument(*Clone, FirstId, Names);
+        Tier0 = llvm::orc::ThreadSafeModule(
+            std::move(Clone), TSM.getContext());
+      });
+      for (const std::string &Name : Names)
+        Functions.push_back({Name, SourceId});
+      Sources.push_back(std::move(TSM));
+    }
+
+    // The stubs are created without a target, which is
+    // only known after the compilation.
+    llvm::orc::IndirectStubsManager::StubInitsMap Stubs;
+    for (const std::string &Name : Names)
+      Stubs[*Mangle(Name)] = {
+          llvm::orc::ExecutorAddr(),
+          llvm::JITSymbolFlags::Exported |
+              llvm::JITSymbolFlags::Callable};
+    if (auto Err = ISM->createStubs(Stubs))
+      return Err;
+    llvm::orc::SymbolMap StubSymbols;
+    llvm::orc::SymbolLookupSet Bodies;
+    for (const std::string &Name : Names) {
+      StubSymbols[Mangle(Name)] =
+          ISM->findStub(*Mangle(Name), false);
+      Bodies.add(Mangle(Name + ".tier0"));
+    }
+    if (auto Err = RT->getJITDylib().define(
+            llvm::orc::absoluteSymbols(
+                std::move(StubSymbols)),
+            RT))
+      return Err;
+    if (auto Err = Tier0Layer.add(RT, std::move(Tier0)))
+      return Err;
+
+    auto Symbols = ES.lookup(
+        llvm::orc::makeJITDylibSearchOrder(
+            &RT->getJITDylib()),
+        std::move(Bodies));
+    if (!Symbols)
+      return Symbols.takeError();
+    for (const std::string &Name : Names)
+      if (auto Err = ISM->updatePointer(
+              *Mangle(Name),
+              (*Symbols)[Mangle(Name + ".tier0")]
+                  .getAddress()))
+        return Err;
+    return llvm::Error::success();
+  }
+};
+
+#endif
@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+"""Generates an IR module for the startup time of the lazy JIT.
+
+The module has --funcs functions, each with a loop of --ops
+arithmetic instructions, and a main which calls only the first one.
+The eager JIT optimizes and compiles all functions before main
+starts, the lazy JIT only main and the first function.
+
+The IR uses no pointer types, so it is read by any LLVM version.
+Compare e.g.
+
+  ./JIT -time-startup wide.ll
+  ./JIT -time-startup -lazy=function wide.ll
+"""
+
+import argparse
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--funcs", type=int, default=1000)
+    parser.add_argument("--ops", type=int, default=20)
+    parser.add_argument("-o", dest="output", required=True)
+    args = parser.parse_args()
+
+    opcodes = ["add", "mul", "xor", "sub"]
+    with open(args.output, "w") as out:
+        for f in range(args.funcs):
+            out.write("define i32 @f%d(i32 %%x) {\n" % f)
+            out.write("entry:\n  br label %loop\n")
+            out.write("loop:\n")
+            out.write("  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]\n")
+            out.write(
+                "  %%v0 = phi i32 [ %%x, %%entry ], [ %%v%d, %%loop ]\n" % args.ops
+            )
+            for op in range(1, args.ops + 1):
+                out.write(
+                    "  %%v%d = %s i32 %%v%d, %d\n"
+                    % (op, opcodes[op % 4], op - 1, f * 31 + op)
+                )
+            out.write("  %i.next = add i32 %i, 1\n")
+            out.write("  %cmp = icmp slt i32 %i.next, 100\n")
+            out.write("  br i1 %cmp, label %loop, label %exit\n")
+            out.write("exit:\n  ret i32 %%v%d\n}\n\n" % args.ops)
+        out.write("define i32 @main() {\n")
+        out.write("entry:\n  %r = call i32 @f0(i32 1)\n  ret i32 0\n}\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Compares the eager O2 JIT with the lazy and the tiered
+# JIT. Run from the build directory of the JIT,
+# optionally with another C file. The startup time is the
+# time to the first instruction of main. Later batches
+# use larger numbers and run longer, so compare the same
+# batch across runs.
+SRC=${1:-$(dirname "$0")/tiering.c}
+# Without optnone, so the O2 pipeline optimizes the code.
+clang -O0 -Xclang -disable-O0-optnone -S -emit-llvm "$SRC" -o bench.ll
+echo "== eager, O2 =="
+./JIT -time-startup bench.ll
+echo "== lazy, per function =="
+./JIT -time-startup -lazy=function bench.ll
+echo "== lazy, per SCC =="
+./JIT -time-startup -lazy=scc bench.ll
+echo "== tiered, O0 then O2 =="
+./JIT -time-startup -tiered bench.ll
+echo "== tiered, O0 then O3 =="
+./JIT -time-startup -tiered -tier-up-level=3 bench.ll
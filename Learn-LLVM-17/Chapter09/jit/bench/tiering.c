@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <time.h>
+
+// A benchmark for the tiers of the JIT. Each batch calls
+// a hot function and prints the calls per millisecond, so
+// the switch to the optimized tier shows in the output.
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static long collatz_steps(long n) {
+  long steps = 0;
+  while (n != 1) {
+    n = (n & 1) ? 3 * n + 1 : n / 2;
+    ++steps;
+  }
+  return steps;
+}
+
+int main(int argc, char **argv) {
+  const long calls = 20000;
+  long total = 0;
+  for (int batch = 0; batch < 20; ++batch) {
+    double start = now_ms();
+    for (long i = 1; i <= calls; ++i)
+      total += collatz_steps(batch * calls + i);
+    double time = now_ms() - start;
+    printf("batch %2d: %8.1f calls/ms\n", batch,
+           calls / time);
+  }
+  printf("steps: %ld\n", total);
+  return 0;
+}
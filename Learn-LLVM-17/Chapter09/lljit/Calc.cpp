@@ -25,16 +25,25 @@ int main(int argc, const char **argv) {
   // the name of the arguments (a vector of strings). All of these arguments
   // will automatically be represented as integers.
   StringMap<size_t> JITtedFunctions;
+  // The trampolines compiled so far, keyed by their name. A trampoline
+  // takes the arguments of the call through a pointer, so repeated calls
+  // of the same function reuse it without generating or linking new IR.
+  using TrampolineFn = int (*)(const int *);
+  StringMap<TrampolineFn> Trampolines;
 
   while (true) {
     outs() << "JIT calc > ";
     std::string calcExp;
     std::getline(std::cin, calcExp);
 
-    // Create a new context and module.
-    std::unique_ptr<LLVMContext> Ctx = std::make_unique<LLVMContext>();
-    std::unique_ptr<Module> M = std::make_unique<Module>("JIT calc.expr", *Ctx);
-    M->setDataLayout(JIT->getDataLayout());
+    // Creates a new context and module.
+    std::unique_ptr<LLVMContext> Ctx;
+    std::unique_ptr<Module> M;
+    auto CreateModule = [&]() {
+      Ctx = std::make_unique<LLVMContext>();
+      M = std::make_unique<Module>("JIT calc.expr", *Ctx);
+      M->setDataLayout(JIT->getDataLayout());
+    };
 
     // Declare the code generator.
     CodeGen CodeGenerator;
@@ -54,6 +63,7 @@ int main(int argc, const char **argv) {
         return 1;
       }
       // Generate the IR.
+      CreateModule();
       CodeGenerator.compileToIR(Tree, M.get(), JITtedFunctions);
       ExitOnErr(
           JIT->addIRModule(ThreadSafeModule(std::move(M), std::move(Ctx))));
@@ -68,32 +78,58 @@ int main(int argc, const char **argv) {
         llvm::errs() << "Syntax errors occured\n";
         return 1;
       }
+      // A wrong call is reported, and the calculator reads the next line.
       Sema Semantic;
       if (Semantic.semantic(Tree, JITtedFunctions)) {
         llvm::errs() << "Semantic errors occured\n";
-        return 1;
+        continue;
       }
       llvm::StringRef FuncCallName = Tree->getFnName();
-      // Prepare the function call to the JITted (previously defined) function.
-      CodeGenerator.prepareCalculationCallFunc(Tree, M.get(), FuncCallName,
-                                               JITtedFunctions);
-      // A resource tracker will track the memory that is allocated to the
-      // JITted function that calls the user defined function.
-      auto RT = JIT->getMainJITDylib().createResourceTracker();
-      auto TSM = ThreadSafeModule(std::move(M), std::move(Ctx));
-      ExitOnErr(JIT->addIRModule(RT, std::move(TSM)));
-      // Generate the function call by querying the JIT for the temporary
-      // call function (that will call the function defined by the user
-      // to evaluate the calculator expression).
-      auto CalcExprCall = ExitOnErr(JIT->lookup("calc_expr_func"));
-      // Get the address of the symbol for "calc_expr_func" (the temporary call
-      // function, and cast to the appropriate type. This function returns an
-      // integer and takes no arguments. It simply produces a call to the
-      // calculator function (previously) defined by the user.
-      int (*UserFnCall)() = CalcExprCall.toPtr<int (*)()>();
-      outs() << "User defined function evaluated to: " << UserFnCall() << "\n";
-      // Free the memory that was previously allocated.
-      ExitOnErr(RT->remove());
+      auto *Call = static_cast<FuncCallFromDef *>(Tree);
+      llvm::SmallVector<int, 8> Args;
+      for (llvm::StringRef Arg : Call->getArgs()) {
+        int IntArg;
+        Arg.getAsInteger(10, IntArg);
+        Args.push_back(IntArg);
+      }
+      // The trampoline reads as many arguments as the callee takes, so the
+      // argument array must have exactly that size.
+      size_t NumParams = JITtedFunctions.lookup(FuncCallName);
+      if (Args.size() != NumParams) {
+        llvm::errs() << FuncCallName << " takes " << NumParams
+                     << " arguments, but " << Args.size()
+                     << " were given\n";
+        continue;
+      }
+      std::string TrampolineName =
+          CodeGen::getTrampolineName(FuncCallName, NumParams);
+      TrampolineFn &UserFnCall = Trampolines[TrampolineName];
+      if (!UserFnCall) {
+        // Prepare the trampoline which calls the JITted (previously
+        // defined) function. It stays in the JIT for later calls.
+        CreateModule();
+        CodeGenerator.prepareCalculationCallFunc(Tree, M.get(), FuncCallName,
+                                                 JITtedFunctions);
+        auto RT = JIT->getMainJITDylib().createResourceTracker();
+        auto TSM = ThreadSafeModule(std::move(M), std::move(Ctx));
+        ExitOnErr(JIT->addIRModule(RT, std::move(TSM)));
+        // Get the address of the trampoline, and cast it to the
+        // appropriate type. It returns an integer and reads the arguments
+        // of the calculator function (previously) defined by the user from
+        // the given array.
+        auto CalcExprCall = JIT->lookup(TrampolineName);
+        if (!CalcExprCall) {
+          logAllUnhandledErrors(CalcExprCall.takeError(), errs(),
+                                "Cannot call " + FuncCallName + ": ");
+          // Remove the trampoline, so that a later call can add it again.
+          ExitOnErr(RT->remove());
+          Trampolines.erase(TrampolineName);
+          continue;
+        }
+        UserFnCall = CalcExprCall->toPtr<TrampolineFn>();
+      }
+      outs() << "User defined function evaluated to: "
+             << UserFnCall(Args.data()) << "\n";
     }
   }
 
@@ -109,16 +109,6 @@ public:
   };
 
   virtual void visit(FuncCallFromDef &Node) override {
-    llvm::StringRef CalcExprFunName = "calc_expr_func";
-    // Prepare the function signature for the temporary function that will
-    // call the user defined function.
-    FunctionType *CalcExprFunTy = FunctionType::get(Int32Ty, {}, false);
-    Function *CalcExprFun = Function::Create(
-        CalcExprFunTy, GlobalValue::ExternalLinkage, CalcExprFunName, M);
-
-    BasicBlock *BB = BasicBlock::Create(M->getContext(), "entry", CalcExprFun);
-    Builder.SetInsertPoint(BB);
-
     // Get the original function definition.
     llvm::StringRef CalleeFnName = Node.getFnName();
     Function *CalleeFn = genUserDefinedFunction(CalleeFnName);
@@ -127,14 +117,26 @@ public:
       return;
     }
 
-    // Set the parameters for the function call.
-    auto CalleeFnVars = Node.getArgs();
+    // Prepare the signature of the trampoline. The arguments are passed
+    // through a pointer, so that the same trampoline can be called with
+    // different values.
+    size_t NumArgs = CalleeFn->arg_size();
+    FunctionType *TrampolineTy = FunctionType::get(
+        Int32Ty, {PointerType::getUnqual(Int32Ty)}, false);
+    Function *Trampoline = Function::Create(
+        TrampolineTy, GlobalValue::ExternalLinkage,
+        CodeGen::getTrampolineName(CalleeFnName, NumArgs), M);
+
+    BasicBlock *BB = BasicBlock::Create(M->getContext(), "entry", Trampoline);
+    Builder.SetInsertPoint(BB);
+
+    // Load the parameters for the function call.
+    Value *Args = Trampoline->getArg(0);
+    Args->setName("args");
     llvm::SmallVector<Value *> IntParams;
-    for (unsigned i = 0, end = CalleeFnVars.size(); i != end; ++i) {
-      int ArgsToIntType;
-      CalleeFnVars[i].getAsInteger(10, ArgsToIntType);
-      Value *IntParam = ConstantInt::get(Int32Ty, ArgsToIntType, true);
-      IntParams.push_back(IntParam);
+    for (unsigned i = 0; i != NumArgs; ++i) {
+      Value *ArgPtr = Builder.CreateConstInBoundsGEP1_32(Int32Ty, Args, i);
+      IntParams.push_back(Builder.CreateLoad(Int32Ty, ArgPtr));
     }
 
     Value *Res = Builder.CreateCall(CalleeFn, IntParams, "calc_expr_res");
@@ -157,3 +159,8 @@ void CodeGen::prepareCalculationCallFunc(AST *FuncCall, Module *M,
   ToIR.genFuncEvaluationCall(FuncCall);
   M->print(outs(), nullptr);
 }
+
+std::string CodeGen::getTrampolineName(llvm::StringRef FnName,
+                                       size_t NumArgs) {
+  return ("calc_expr_func." + FnName + "." + Twine(NumArgs)).str();
+}
@@ -4,6 +4,7 @@
 #include "AST.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/IR/LLVMContext.h"
+#include <string>
 
 using namespace llvm;
 
@@ -11,8 +12,14 @@ class CodeGen {
 public:
   void compileToIR(
       AST *Tree, Module *M, StringMap<size_t> &JITtedFunctions);
+  // Emits a trampoline `int (const int *Args)` which loads
+  // the arguments of FuncCall from Args and calls FnName.
+  // The trampoline only depends on the name and the arity
+  // of the callee, so it can be reused for every call.
   void prepareCalculationCallFunc(
       AST *FuncCall, Module *M, llvm::StringRef FnName,
       StringMap<size_t> &JITtedFunctions);
+  static std::string getTrampolineName(llvm::StringRef FnName,
+                                       size_t NumArgs);
 };
 #endif
@@ -46,6 +46,32 @@ class TimingScriptGenerator:
         self.shfile.write('echo "" >> %s\n' % self.timeFile)
         self.shfile.write('echo "" >> %s\n' % self.timeFile)
 
+    def writeCacheTimingCall(self, filename, numFuncs, funcsCalled, totalCalls):
+        """Invoke the MCJIT toy with an empty and then with a filled object cache"""
+        rootname = filename
+        if "." in filename:
+            rootname = filename[: filename.rfind(".")]
+        self.shfile.write(
+            'echo "%s: Calls %d of %d functions, %d total" >> %s\n'
+            % (filename, funcsCalled, numFuncs, totalCalls, self.timeFile)
+        )
+        self.shfile.write('echo "" >> %s\n' % self.timeFile)
+        self.shfile.write("rm -rf toy_object_cache\n")
+        for run in ["cold", "warm"]:
+            self.shfile.write(
+                'echo "With MCJIT, %s object cache" >> %s\n' % (run, self.timeFile)
+            )
+            self.shfile.write(
+                '/usr/bin/time -f "Command %C\\n\\tuser time: %U s\\n\\tsytem time: %S s\\n\\tmax set: %M kb"'
+            )
+            self.shfile.write(" -o %s -a " % self.timeFile)
+            self.shfile.write(
+                "./toy-mcjit -use-object-cache < %s > %s-mcjit-%s.out 2> %s-mcjit-%s.err\n"
+                % (filename, rootname, run, rootname, run)
+            )
+            self.shfile.write('echo "" >> %s\n' % self.timeFile)
+        self.shfile.write('echo "" >> %s\n' % self.timeFile)
+
 
 class KScriptGenerator:
     """Used to generate random Kaleidoscope code"""
@@ -204,7 +230,13 @@ class KScriptGenerator:
 
 
 def generateKScript(
-    filename, numFuncs, elementsPerFunc, funcsBetweenExec, callWeighting, timingScript
+    filename,
+    numFuncs,
+    elementsPerFunc,
+    funcsBetweenExec,
+    callWeighting,
+    timingScript,
+    cacheTimingScript,
 ):
     """Generate a random Kaleidoscope script based on the given parameters"""
     print("Generating " + filename)
@@ -249,12 +281,18 @@ def generateKScript(
     timingScript.writeTimingCall(
         filename, numFuncs, funcsCalled, script.totalCallsExecuted
     )
+    cacheTimingScript.writeCacheTimingCall(
+        filename, numFuncs, funcsCalled, script.totalCallsExecuted
+    )
 
 
 # Execution begins here
 random.seed()
 
 timingScript = TimingScriptGenerator("time-toy.sh", "timing-data.txt")
+cacheTimingScript = TimingScriptGenerator(
+    "time-toy-cache.sh", "cache-timing-data.txt"
+)
 
 dataSets = [
     (5000, 3, 50, 0.50),
@@ -286,5 +324,6 @@ for (numFuncs, elementsPerFunc, funcsBetweenExec, callWeighting) in dataSets:
         funcsBetweenExec,
         callWeighting,
         timingScript,
+        cacheTimingScript,
     )
 print("All done!")
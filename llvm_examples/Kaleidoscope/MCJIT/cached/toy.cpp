@@ -1,6 +1,9 @@
 #define MINIMAL_STDERR_OUTPUT
 
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Analysis/Passes.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/MCJIT.h"
 #include "llvm/ExecutionEngine/ObjectCache.h"
@@ -15,11 +18,15 @@
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Scalar.h"
+#include <algorithm>
 #include <cctype>
 #include <cstdio>
 #include <map>
@@ -41,6 +48,13 @@ UseObjectCache("use-object-cache",
                cl::desc("Enable use of the MCJIT object caching"),
                cl::init(false));
 
+cl::opt<unsigned>
+ObjectCacheSize("object-cache-size",
+                cl::desc("Maximum size of the MCJIT object cache in kilobytes "
+                         "(0 for no limit)"),
+                cl::value_desc("kilobytes"),
+                cl::init(64 * 1024));
+
 //===----------------------------------------------------------------------===//
 // Lexer
 //===----------------------------------------------------------------------===//
@@ -669,66 +683,177 @@ std::string MakeLegalFunctionName(std::string Name)
 // MCJIT object cache class
 //===----------------------------------------------------------------------===//
 
+// The object cache keys each module by a hash of its bitcode and of the target
+// it is compiled for, so any module can be cached, not only the modules loaded
+// from IR files, and a changed module or a different host never picks up a
+// stale object.  An object is written to a temporary file and then renamed
+// into place, so a concurrent or interrupted run never sees a partial object.
+// The cache is kept below ObjectCacheSize by removing the least recently used
+// objects, and a hit renews the modification time of its file.
 class MCJITObjectCache : public ObjectCache {
 public:
-  MCJITObjectCache() {
+  MCJITObjectCache() : CacheSize(0), CacheScanned(false) {
     // Set IR cache directory
     sys::fs::current_path(CacheDir);
     sys::path::append(CacheDir, "toy_object_cache");
+
+    // Anything that changes the generated code for the same module is part
+    // of the target.
+    Target = std::string(LLVM_VERSION_STRING) + ";" + sys::getProcessTriple() +
+             ";" + sys::getHostCPUName().str();
   }
 
   virtual ~MCJITObjectCache() {
   }
 
   virtual void notifyObjectCompiled(const Module *M, const MemoryBuffer *Obj) {
-    // Get the ModuleID
-    const std::string ModuleID = M->getModuleIdentifier();
-
-    // If we've flagged this as an IR file, cache it
-    if (0 == ModuleID.compare(0, 3, "IR:")) {
-      std::string IRFileName = ModuleID.substr(3);
-      SmallString<128>IRCacheFile = CacheDir;
-      sys::path::append(IRCacheFile, IRFileName);
-      if (!sys::fs::exists(CacheDir.str()) && sys::fs::create_directory(CacheDir.str())) {
-        fprintf(stderr, "Unable to create cache directory\n");
+    // MCJIT may have changed the module while compiling it, so use the key
+    // computed when it looked the module up.
+    std::map<const Module *, std::string>::iterator it = PendingKeys.find(M);
+    if (it == PendingKeys.end())
+      return;
+    std::string Key = it->second;
+    PendingKeys.erase(it);
+
+    if (!sys::fs::exists(CacheDir.str()) && sys::fs::create_directory(CacheDir.str())) {
+      fprintf(stderr, "Unable to create cache directory\n");
+      return;
+    }
+
+    // Write the object under a unique temporary name and rename it, which
+    // publishes it atomically.  A failure only costs a later compilation.
+    SmallString<128> TmpFile = CacheDir;
+    sys::path::append(TmpFile, "tmp-%%%%%%%%");
+    int FD;
+    if (sys::fs::createUniqueFile(TmpFile.str(), FD, TmpFile))
+      return;
+    {
+      raw_fd_ostream TmpObjectFile(FD, /*shouldClose=*/true);
+      TmpObjectFile << Obj->getBuffer();
+      TmpObjectFile.close();
+      if (TmpObjectFile.has_error()) {
+        TmpObjectFile.clear_error();
+        sys::fs::remove(TmpFile.str());
         return;
       }
-      std::string ErrStr;
-      raw_fd_ostream IRObjectFile(IRCacheFile.c_str(), ErrStr, raw_fd_ostream::F_Binary);
-      IRObjectFile << Obj->getBuffer();
     }
+    if (sys::fs::rename(TmpFile.str(), getCacheFile(Key).str())) {
+      sys::fs::remove(TmpFile.str());
+      return;
+    }
+
+    // The first scan of the directory already counts the new object.
+    if (CacheScanned)
+      CacheSize += Obj->getBufferSize();
+    if (!CacheScanned || (ObjectCacheSize && CacheSize > getCacheLimit()))
+      pruneCache();
   }
 
   // MCJIT will call this function before compiling any module
   // MCJIT takes ownership of both the MemoryBuffer object and the memory
   // to which it refers.
   virtual MemoryBuffer* getObject(const Module* M) {
-    // Get the ModuleID
-    const std::string ModuleID = M->getModuleIdentifier();
-
-    // If we've flagged this as an IR file, cache it
-    if (0 == ModuleID.compare(0, 3, "IR:")) {
-      std::string IRFileName = ModuleID.substr(3);
-      SmallString<128> IRCacheFile = CacheDir;
-      sys::path::append(IRCacheFile, IRFileName);
-      if (!sys::fs::exists(IRCacheFile.str())) {
-        // This file isn't in our cache
-        return NULL;
-      }
-      std::unique_ptr<MemoryBuffer> IRObjectBuffer;
-      MemoryBuffer::getFile(IRCacheFile.c_str(), IRObjectBuffer, -1, false);
-      // MCJIT will want to write into this buffer, and we don't want that
-      // because the file has probably just been mmapped.  Instead we make
-      // a copy.  The filed-based buffer will be released when it goes
-      // out of scope.
-      return MemoryBuffer::getMemBufferCopy(IRObjectBuffer->getBuffer());
+    std::string Key = getKey(M);
+    SmallString<128> IRCacheFile = getCacheFile(Key);
+    if (!sys::fs::exists(IRCacheFile.str())) {
+      // This module isn't in our cache
+      PendingKeys[M] = Key;
+      return NULL;
+    }
+    std::unique_ptr<MemoryBuffer> IRObjectBuffer;
+    if (MemoryBuffer::getFile(IRCacheFile.c_str(), IRObjectBuffer, -1, false)) {
+      PendingKeys[M] = Key;
+      return NULL;
     }
 
-    return NULL;
+    // Renew the entry for the least recently used order of pruneCache.
+    int FD;
+    if (!sys::fs::openFileForWrite(IRCacheFile.str(), FD, sys::fs::F_Append)) {
+      sys::fs::setLastModificationAndAccessTime(FD, sys::TimeValue::now());
+      sys::Process::SafelyCloseFileDescriptor(FD);
+    }
+
+    // RuntimeDyld copies the sections into memory from the memory manager, so
+    // it does not need its own copy of the file.  The ELF loader, however,
+    // writes the load addresses of the sections back into the object for the
+    // debugger, which must not happen to the mapped file, so ELF objects are
+    // still copied.
+    if (sys::fs::identify_magic(IRObjectBuffer->getBuffer()) ==
+        sys::fs::file_magic::elf_relocatable)
+      return MemoryBuffer::getMemBufferCopy(IRObjectBuffer->getBuffer());
+    return IRObjectBuffer.release();
   }
 
 private:
+  // Returns the MD5 of the bitcode of M and the target as a hex string.
+  std::string getKey(const Module *M) {
+    std::string Bitcode;
+    raw_string_ostream BitcodeStream(Bitcode);
+    WriteBitcodeToFile(M, BitcodeStream);
+    BitcodeStream.flush();
+
+    MD5 Hash;
+    Hash.update(Target);
+    // The target has no fixed length, so separate it from the bitcode.
+    Hash.update(StringRef("\0", 1));
+    Hash.update(Bitcode);
+    MD5::MD5Result Result;
+    Hash.final(Result);
+    SmallString<32> Key;
+    MD5::stringifyResult(Result, Key);
+    return Key.str();
+  }
+
+  SmallString<128> getCacheFile(const std::string &Key) {
+    SmallString<128> CacheFile = CacheDir;
+    sys::path::append(CacheFile, Key + ".o");
+    return CacheFile;
+  }
+
+  uint64_t getCacheLimit() {
+    return (uint64_t)ObjectCacheSize * 1024;
+  }
+
+  // Removes the least recently used objects until the cache is at three
+  // quarters of its limit, so that the directory is not scanned again for
+  // every new object, and recomputes CacheSize.  Left-over temporary files
+  // are not touched, since another run may still be writing them.
+  void pruneCache() {
+    CacheScanned = true;
+    CacheSize = 0;
+    std::vector<std::pair<sys::TimeValue, std::pair<std::string, uint64_t> > >
+      Objects;
+    std::error_code EC;
+    for (sys::fs::directory_iterator I(CacheDir.str(), EC), E; I != E && !EC;
+         I.increment(EC)) {
+      if (sys::path::extension(I->path()) != ".o")
+        continue;
+      sys::fs::file_status Status;
+      if (I->status(Status) || !sys::fs::is_regular_file(Status))
+        continue;
+      CacheSize += Status.getSize();
+      Objects.push_back(std::make_pair(Status.getLastModificationTime(),
+                                       std::make_pair(I->path(),
+                                                      Status.getSize())));
+    }
+    if (!ObjectCacheSize || CacheSize <= getCacheLimit())
+      return;
+
+    std::sort(Objects.begin(), Objects.end());
+    uint64_t Goal = getCacheLimit() / 4 * 3;
+    for (size_t i = 0, e = Objects.size(); i != e && CacheSize > Goal; ++i) {
+      if (!sys::fs::remove(Objects[i].second.first))
+        CacheSize -= Objects[i].second.second;
+    }
+  }
+
   SmallString<128> CacheDir;
+  std::string Target;
+  // The keys of the modules that missed, until MCJIT has compiled them.
+  std::map<const Module *, std::string> PendingKeys;
+  // The size of the objects in CacheDir, once it has been scanned.
+  uint64_t CacheSize;
+  bool CacheScanned;
 };
 
 //===----------------------------------------------------------------------===//
@@ -753,10 +878,24 @@ public:
 private:
   typedef std::vector<Module*> ModuleVector;
 
+  // The first module which declares or defines a function, the module
+  // which defines it and the engine of that module, once compiled.
+  struct FunctionEntry {
+    FunctionEntry() : M(NULL), Def(NULL), EE(NULL) {}
+    Module          *M;
+    Module          *Def;
+    ExecutionEngine *EE;
+  };
+  typedef StringMap<FunctionEntry> FunctionIndexMap;
+
+  void indexModule(Module *M);
+
   LLVMContext  &Context;
   Module       *OpenModule;
   ModuleVector  Modules;
   std::map<Module *, ExecutionEngine *> EngineMap;
+  // The functions of all modules but the open one, by name.
+  FunctionIndexMap FunctionIndex;
   MCJITObjectCache OurObjectCache;
 };
 
@@ -817,35 +956,29 @@ MCJITHelper::~MCJITHelper()
 }
 
 Function *MCJITHelper::getFunction(const std::string FnName) {
-  ModuleVector::iterator begin = Modules.begin();
-  ModuleVector::iterator end = Modules.end();
-  ModuleVector::iterator it;
-  for (it = begin; it != end; ++it) {
-    Function *F = (*it)->getFunction(FnName);
-    if (F) {
-      if (*it == OpenModule)
-          return F;
-
-      assert(OpenModule != NULL);
-
-      // This function is in a module that has already been JITed.
-      // We need to generate a new prototype for external linkage.
-      Function *PF = OpenModule->getFunction(FnName);
-      if (PF && !PF->empty()) {
-        ErrorF("redefinition of function across modules");
-        return 0;
-      }
-
-      // If we don't have a prototype yet, create one.
-      if (!PF)
-        PF = Function::Create(F->getFunctionType(),
-                                      Function::ExternalLinkage,
-                                      FnName,
-                                      OpenModule);
-      return PF;
-    }
+  FunctionIndexMap::iterator it = FunctionIndex.find(FnName);
+  // Functions of the open module are not in the index yet.
+  if (it == FunctionIndex.end())
+    return OpenModule ? OpenModule->getFunction(FnName) : NULL;
+
+  Function *F = it->second.M->getFunction(FnName);
+  assert(OpenModule != NULL);
+
+  // This function is in a module that has already been JITed.
+  // We need to generate a new prototype for external linkage.
+  Function *PF = OpenModule->getFunction(FnName);
+  if (PF && !PF->empty()) {
+    ErrorF("redefinition of function across modules");
+    return 0;
   }
-  return NULL;
+
+  // If we don't have a prototype yet, create one.
+  if (!PF)
+    PF = Function::Create(F->getFunctionType(),
+                                  Function::ExternalLinkage,
+                                  FnName,
+                                  OpenModule);
+  return PF;
 }
 
 Module *MCJITHelper::getModuleForNewFunction() {
@@ -862,31 +995,29 @@ Module *MCJITHelper::getModuleForNewFunction() {
 }
 
 void *MCJITHelper::getPointerToFunction(Function* F) {
-  // Look for this function in an existing module
-  ModuleVector::iterator begin = Modules.begin();
-  ModuleVector::iterator end = Modules.end();
-  ModuleVector::iterator it;
-  std::string FnName = F->getName();
-  for (it = begin; it != end; ++it) {
-    Function *MF = (*it)->getFunction(FnName);
-    if (MF == F) {
-      std::map<Module*, ExecutionEngine*>::iterator eeIt = EngineMap.find(*it);
-      if (eeIt != EngineMap.end()) {
-        void *P = eeIt->second->getPointerToFunction(F);
-        if (P)
-          return P;
-      } else {
-        ExecutionEngine *EE = compileModule(*it);
-        void *P = EE->getPointerToFunction(F);
-        if (P)
-          return P;
-      }
-    }
+  // Compile the module of this function, if we haven't yet.
+  Module *M = F->getParent();
+  std::map<Module*, ExecutionEngine*>::iterator eeIt = EngineMap.find(M);
+  ExecutionEngine *EE =
+      eeIt != EngineMap.end() ? eeIt->second : compileModule(M);
+  return EE->getPointerToFunction(F);
+}
+
+void MCJITHelper::indexModule(Module *M) {
+  Module::iterator it;
+  Module::iterator end = M->end();
+  for (it = M->begin(); it != end; ++it) {
+    FunctionEntry &Entry = FunctionIndex[it->getName()];
+    if (!Entry.M)
+      Entry.M = M;
+    if (!Entry.Def && !it->empty())
+      Entry.Def = M;
   }
-  return NULL;
 }
 
 void MCJITHelper::closeCurrentModule() {
+  if (OpenModule)
+    indexModule(OpenModule);
   OpenModule = NULL;
 }
 
@@ -946,6 +1077,11 @@ ExecutionEngine *MCJITHelper::compileModule(Module *M) {
 
   // Store this engine
   EngineMap[M] = NewEngine;
+  for (Module::iterator it = M->begin(), end = M->end(); it != end; ++it) {
+    FunctionIndexMap::iterator indexIt = FunctionIndex.find(it->getName());
+    if (indexIt != FunctionIndex.end() && indexIt->second.Def == M)
+      indexIt->second.EE = NewEngine;
+  }
   NewEngine->finalizeObject();
 
   return NewEngine;
@@ -953,31 +1089,30 @@ ExecutionEngine *MCJITHelper::compileModule(Module *M) {
 
 void *MCJITHelper::getPointerToNamedFunction(const std::string &Name)
 {
-  // Look for the functions in our modules, compiling only as necessary
-  ModuleVector::iterator begin = Modules.begin();
-  ModuleVector::iterator end = Modules.end();
-  ModuleVector::iterator it;
-  for (it = begin; it != end; ++it) {
-    Function *F = (*it)->getFunction(Name);
-    if (F && !F->empty()) {
-      std::map<Module*, ExecutionEngine*>::iterator eeIt = EngineMap.find(*it);
-      if (eeIt != EngineMap.end()) {
-        void *P = eeIt->second->getPointerToFunction(F);
-        if (P)
-          return P;
-      } else {
-        ExecutionEngine *EE = compileModule(*it);
-        void *P = EE->getPointerToFunction(F);
-        if (P)
-          return P;
-      }
-    }
+  // Look for the function in our modules, compiling only as necessary
+  Module *M = NULL;
+  ExecutionEngine *EE = NULL;
+  FunctionIndexMap::iterator it = FunctionIndex.find(Name);
+  if (it != FunctionIndex.end()) {
+    M = it->second.Def;
+    EE = it->second.EE;
+  } else if (OpenModule) {
+    // Functions of the open module are not in the index yet.
+    Function *F = OpenModule->getFunction(Name);
+    if (F && !F->empty())
+      M = OpenModule;
   }
-  return NULL;
+  if (!M)
+    return NULL;
+
+  if (!EE)
+    EE = compileModule(M);
+  return EE->getPointerToFunction(M->getFunction(Name));
 }
 
 void MCJITHelper::addModule(Module* M) {
   Modules.push_back(M);
+  indexModule(M);
 }
 
 void MCJITHelper::dump()